@@ -0,0 +1,613 @@
+#define STRINGFUN_NO_MAIN
+#include "../libstringfun.c"
+#include "../stringfun.c"
+
+#include <stdint.h>
+#include <getopt.h>
+#ifdef HAVE_X86_SIMD
+#include <x86intrin.h>
+#endif
+
+/*
+ *  sfbench - micro benchmark for the stringfun kernels
+ *
+ *  Runs setup_buff, count_words, reverse_string and print_words over
+ *  generated text of each size and word density, every variant of a
+ *  kernel on the same input: the scalar reference first, then each vector
+ *  version the CPU supports.  Before any of it is timed, each vector
+ *  kernel is checked against the scalar one (see check_corpus()) and
+ *  sfbench fails if one disagrees.  libstringfun.c and stringfun.c are
+ *  included rather than linked so the kernels can be called directly,
+ *  whatever SIMD level the dispatch would pick.
+ *
+ *  Density is the fraction of bytes that are separators, so 0.2 means
+ *  words of about four letters.  setup_buff gets the raw text, with runs
+ *  of spaces and tabs; the other kernels get what setup_buff made of it.
+ *
+ *  Each measurement is warmup untimed runs, then reps timed runs of
+ *  enough calls to cover about BYTES bytes.  ns/op is per call, bytes per
+ *  cycle counts TSC cycles (not core cycles under turbo), both are medians
+ *  over the reps.  print_words output goes to /dev/null.
+ */
+
+#define BENCH_DEF_SIZES     "64,4096,1048576"
+#define BENCH_DEF_DENSITIES "0.1,0.2,0.5"
+#define BENCH_DEF_WARMUP    2
+#define BENCH_DEF_REPS      7
+#define BENCH_DEF_BYTES     (2 << 20)   //per timed rep
+#define BENCH_MAX_LIST      16
+#define BENCH_MAX_REPS      101
+
+typedef struct bench_args{
+    long    sizes[BENCH_MAX_LIST];
+    int     nsizes;
+    double  densities[BENCH_MAX_LIST];
+    int     ndensities;
+    int     warmup;
+    int     reps;
+    long    bytes;
+    char   *kernel;             //only run kernels whose name contains this
+} bench_args_t;
+
+typedef struct bench_corpus{
+    char   *raw;                //NUL terminated input for setup_buff
+    char   *buf;                //setup_buff output for the other kernels
+    char   *work;               //scratch the kernel may write to
+    int     len;
+} bench_corpus_t;
+
+typedef struct bench_variant{
+    const char *kernel;
+    const char *name;
+    int       (*supported)(void);
+    long long (*run)(bench_corpus_t *c);
+} bench_variant_t;
+
+static volatile long long bench_sink;   //keeps results from being optimized out
+
+//xorshift64*, the same generator sdbbench uses
+static uint64_t rng_state = 0x5f5b;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static double rng_unit(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#ifdef HAVE_X86_SIMD
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*
+ *  Kernel variants.  Each returns something derived from its result so
+ *  the call can not be dropped.
+ */
+static int always(void)
+{
+    return 1;
+}
+
+static long long run_setup_scalar(bench_corpus_t *c)
+{
+    return setup_buff_scalar(c->work, c->raw, c->len);
+}
+
+static long long run_count_scalar(bench_corpus_t *c)
+{
+    int in_word = 0;
+    return words_scalar(c->buf, c->len, SF_SEP_DOT, &in_word);
+}
+
+static long long run_reverse_bytes(bench_corpus_t *c)
+{
+    reverse_string(c->work, c->len);
+    return c->work[0];
+}
+
+static long long run_reverse_utf8(bench_corpus_t *c)
+{
+    reverse_string_utf8(c->work, c->len);
+    return c->work[0];
+}
+
+static long long run_print_bytes(bench_corpus_t *c)
+{
+    print_words(c->buf, c->len, c->len);
+    return 0;
+}
+
+static long long run_print_utf8(bench_corpus_t *c)
+{
+    print_words_utf8(c->buf, c->len, c->len);
+    return 0;
+}
+
+//sf_setup_buff() with a given compaction kernel
+static long long setup_with(compact_kernel_t kernel, bench_corpus_t *c)
+{
+    long out = kernel(c->work, c->len, c->raw, strlen(c->raw));
+
+    if (out < 0)
+        return -1;
+    if (out > 0 && c->work[out - 1] == ' ')
+        out--;
+    memset(c->work + out, '.', c->len - out);
+    return c->len;
+}
+
+#ifdef HAVE_X86_SIMD
+static int has_sse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+static int has_ssse3(void)
+{
+    return __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("popcnt");
+}
+
+static int has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+
+static int has_avx512(void)
+{
+    return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt");
+}
+
+static int has_vbmi2(void)
+{
+    return has_avx512() && __builtin_cpu_supports("avx512vbmi2");
+}
+
+static long long run_setup_ssse3(bench_corpus_t *c)
+{
+    return setup_with(compact_ssse3, c);
+}
+
+static long long run_setup_vbmi2(bench_corpus_t *c)
+{
+    return setup_with(compact_vbmi2, c);
+}
+
+static long long run_count_sse2(bench_corpus_t *c)
+{
+    int in_word = 0;
+    return words_sse2(c->buf, c->len, SF_SEP_DOT, &in_word);
+}
+
+static long long run_count_avx2(bench_corpus_t *c)
+{
+    int in_word = 0;
+    return words_avx2(c->buf, c->len, SF_SEP_DOT, &in_word);
+}
+
+static long long run_count_avx512(bench_corpus_t *c)
+{
+    int in_word = 0;
+    return words_avx512(c->buf, c->len, SF_SEP_DOT, &in_word);
+}
+#endif
+
+//the first variant of each kernel is the baseline for its speedup column
+static const bench_variant_t variants[] = {
+    { "setup_buff",     "scalar", always,     run_setup_scalar },
+#ifdef HAVE_X86_SIMD
+    { "setup_buff",     "ssse3",  has_ssse3,  run_setup_ssse3 },
+    { "setup_buff",     "vbmi2",  has_vbmi2,  run_setup_vbmi2 },
+#endif
+    { "count_words",    "scalar", always,     run_count_scalar },
+#ifdef HAVE_X86_SIMD
+    { "count_words",    "sse2",   has_sse2,   run_count_sse2 },
+    { "count_words",    "avx2",   has_avx2,   run_count_avx2 },
+    { "count_words",    "avx512", has_avx512, run_count_avx512 },
+#endif
+    { "reverse_string", "bytes",  always,     run_reverse_bytes },
+    { "reverse_string", "utf8",   always,     run_reverse_utf8 },
+    { "print_words",    "bytes",  always,     run_print_bytes },
+    { "print_words",    "utf8",   always,     run_print_utf8 },
+};
+
+#define NVARIANTS ((int)(sizeof(variants) / sizeof(variants[0])))
+
+/*
+ *  make_corpus
+ *
+ *  len bytes of lower case words, each byte a separator with probability
+ *  density.  Separators are mostly single spaces, with some runs of
+ *  spaces and tabs and some dots, so setup_buff has runs to collapse and
+ *  count_words sees both of its separators.
+ */
+static int make_corpus(bench_corpus_t *c, int len, double density)
+{
+    c->len = len;
+    c->raw = malloc(len + 1);
+    c->buf = malloc(len);
+    c->work = malloc(len);
+    if (c->raw == NULL || c->buf == NULL || c->work == NULL)
+        return -1;
+
+    for (int i = 0; i < len; i++) {
+        if (rng_unit() >= density) {
+            c->raw[i] = 'a' + rng_next() % 26;
+            continue;
+        }
+        switch (rng_next() % 8) {
+            case 0:
+                c->raw[i] = '\t';
+                break;
+            case 1:
+                c->raw[i] = '.';
+                break;
+            default:
+                c->raw[i] = ' ';
+        }
+    }
+    c->raw[len] = '\0';
+
+    return setup_buff_scalar(c->buf, c->raw, len) < 0 ? -1 : 0;
+}
+
+static void free_corpus(bench_corpus_t *c)
+{
+    free(c->raw);
+    free(c->buf);
+    free(c->work);
+}
+
+/*
+ *  Equivalence checks.  The vector kernels must give exactly what the
+ *  scalar ones give: count_words the same count and in_word state for
+ *  every separator set, setup_buff the same bytes as setup_buff_scalar(),
+ *  for the compact_scalar() fallback as well.  Each is run from the first
+ *  BENCH_CHECK_OFFSETS offsets of the input so every alignment and tail
+ *  length is seen.
+ */
+#define BENCH_CHECK_OFFSETS 64
+
+typedef struct bench_check{
+    const char      *name;
+    int            (*supported)(void);
+    word_kernel_t    words;
+    compact_kernel_t compact;
+} bench_check_t;
+
+static const bench_check_t checks[] = {
+    { "compact", always,     NULL,         compact_scalar },
+#ifdef HAVE_X86_SIMD
+    { "sse2",    has_sse2,   words_sse2,   NULL },
+    { "ssse3",   has_ssse3,  NULL,         compact_ssse3 },
+    { "avx2",    has_avx2,   words_avx2,   NULL },
+    { "avx512",  has_avx512, words_avx512, NULL },
+    { "vbmi2",   has_vbmi2,  NULL,         compact_vbmi2 },
+#endif
+};
+
+#define NCHECKS ((int)(sizeof(checks) / sizeof(checks[0])))
+
+//count_words of p[0..n) with every kernel against words_scalar()
+static int check_words(const char *what, const char *p, int n)
+{
+    for (int off = 0; off < BENCH_CHECK_OFFSETS && off < n; off++) {
+        for (int seps = SF_SEP_DOT; seps <= SF_SEP_SHELL; seps++) {
+            for (int start = 0; start <= 1; start++) {
+                int want_in = start;
+                size_t want = words_scalar(p + off, n - off, seps, &want_in);
+
+                for (int k = 0; k < NCHECKS; k++) {
+                    int in = start;
+
+                    if (checks[k].words == NULL || !checks[k].supported())
+                        continue;
+                    size_t got = checks[k].words(p + off, n - off, seps, &in);
+                    if (got != want || in != want_in) {
+                        fprintf(stderr, "Error: count_words %s gives %zu (in_word %d),"
+                                " scalar %zu (in_word %d) on %s of %d bytes at offset %d,"
+                                " seps %d\n", checks[k].name, got, in, want, want_in,
+                                what, n, off, seps);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+//setup_buff of the '\0' terminated raw with every compaction kernel
+//against setup_buff_scalar()
+static int check_setup(const char *what, const char *raw, int n)
+{
+    char *want = malloc(n);
+    char *got = malloc(n);
+    int rc = 0;
+
+    if (want == NULL || got == NULL) {
+        fprintf(stderr, "Error: no memory for the %d byte setup_buff check\n", n);
+        rc = -1;
+    }
+    for (int off = 0; rc == 0 && off < BENCH_CHECK_OFFSETS && off < n; off++) {
+        char *src = (char *)raw + off;
+        int len = n - off;
+        int want_rc = setup_buff_scalar(want, src, len);
+
+        for (int k = 0; rc == 0 && k < NCHECKS; k++) {
+            bench_corpus_t c = { .raw = src, .work = got, .len = len };
+
+            if (checks[k].compact == NULL || !checks[k].supported())
+                continue;
+            int got_rc = setup_with(checks[k].compact, &c);
+            if (got_rc != want_rc || (want_rc >= 0 && memcmp(got, want, len) != 0)) {
+                fprintf(stderr, "Error: setup_buff %s differs from scalar"
+                        " on %s of %d bytes at offset %d\n", checks[k].name, what, n, off);
+                rc = -1;
+            }
+        }
+    }
+    free(want);
+    free(got);
+    return rc;
+}
+
+/*
+ *  check_corpus
+ *
+ *  Checks every kernel on the raw text, on what setup_buff made of it,
+ *  and on the same number of random bytes, which have every separator
+ *  and every byte next to one.
+ *
+ *  returns:  0 if all of them agree with scalar, -1 after printing the
+ *            first that does not to stderr, so it shows past the table
+ */
+static int check_corpus(bench_corpus_t *c)
+{
+    char *bytes = malloc(c->len + 1);
+    uint64_t saved_rng = rng_state;     //the corpora stay as they were
+    int rc = -1;
+
+    if (bytes == NULL) {
+        fprintf(stderr, "Error: no memory for the %d byte check\n", c->len);
+        return -1;
+    }
+    for (int i = 0; i < c->len; i++)
+        bytes[i] = (char)(rng_next() % 255 + 1);
+    bytes[c->len] = '\0';
+    rng_state = saved_rng;
+
+    if (check_words("raw text", c->raw, c->len) == 0 &&
+        check_words("setup_buff text", c->buf, c->len) == 0 &&
+        check_words("random bytes", bytes, c->len) == 0 &&
+        check_setup("raw text", c->raw, c->len) == 0 &&
+        check_setup("random bytes", bytes, c->len) == 0)
+        rc = 0;
+    free(bytes);
+    return rc;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int quiet_begin(void)
+{
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || devnull < 0) {
+        perror("bench stdout");
+        exit(1);
+    }
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    return saved_stdout;
+}
+
+static void quiet_end(int saved_stdout)
+{
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+/*
+ *  measure
+ *
+ *  Median ns and TSC cycles per call of v over c.
+ */
+static void measure(const bench_variant_t *v, bench_corpus_t *c, bench_args_t *args,
+                    double *ns_per_op, double *cycles_per_op)
+{
+    double ns[BENCH_MAX_REPS];
+    double cycles[BENCH_MAX_REPS];
+    long calls = args->bytes / c->len;
+    long long sum = 0;
+
+    if (calls < 1)
+        calls = 1;
+
+    memcpy(c->work, c->buf, c->len);
+    int saved_stdout = quiet_begin();
+    for (int w = 0; w < args->warmup; w++)
+        for (long i = 0; i < calls; i++)
+            sum += v->run(c);
+
+    for (int r = 0; r < args->reps; r++) {
+        uint64_t t0 = now_ns();
+        uint64_t c0 = now_cycles();
+        for (long i = 0; i < calls; i++)
+            sum += v->run(c);
+        uint64_t c1 = now_cycles();
+        uint64_t t1 = now_ns();
+
+        ns[r] = (double)(t1 - t0) / calls;
+        cycles[r] = (double)(c1 - c0) / calls;
+    }
+    quiet_end(saved_stdout);
+    bench_sink = sum;
+
+    qsort(ns, args->reps, sizeof(double), cmp_double);
+    qsort(cycles, args->reps, sizeof(double), cmp_double);
+    *ns_per_op = ns[args->reps / 2];
+    *cycles_per_op = cycles[args->reps / 2];
+}
+
+static int parse_list(const char *str, double *out, int max)
+{
+    char *copy = strdup(str);
+    int n = 0;
+
+    for (char *tok = strtok(copy, ","); tok != NULL && n < max; tok = strtok(NULL, ","))
+        out[n++] = atof(tok);
+    free(copy);
+    return n;
+}
+
+static void bench_usage(const char *progname)
+{
+    printf("Usage: %s [-s SIZES] [-d DENSITIES] [-w WARMUP] [-r REPS] [-b BYTES] [-k KERNEL]\n", progname);
+    printf("  -s SIZES      comma separated input sizes in bytes (default %s)\n", BENCH_DEF_SIZES);
+    printf("  -d DENSITIES  comma separated separator fractions, 0 < d < 1 (default %s)\n",
+           BENCH_DEF_DENSITIES);
+    printf("  -w WARMUP     untimed runs before measuring (default %d)\n", BENCH_DEF_WARMUP);
+    printf("  -r REPS       timed runs, the median is reported (default %d)\n", BENCH_DEF_REPS);
+    printf("  -b BYTES      bytes processed per timed run (default %d)\n", BENCH_DEF_BYTES);
+    printf("  -k KERNEL     only kernels whose name contains KERNEL\n");
+    exit(1);
+}
+
+static void parse_args(int argc, char *argv[], bench_args_t *args)
+{
+    double list[BENCH_MAX_LIST];
+    int opt;
+
+    memset(args, 0, sizeof(*args));
+    args->warmup = BENCH_DEF_WARMUP;
+    args->reps = BENCH_DEF_REPS;
+    args->bytes = BENCH_DEF_BYTES;
+    args->nsizes = parse_list(BENCH_DEF_SIZES, list, BENCH_MAX_LIST);
+    for (int i = 0; i < args->nsizes; i++)
+        args->sizes[i] = (long)list[i];
+    args->ndensities = parse_list(BENCH_DEF_DENSITIES, args->densities, BENCH_MAX_LIST);
+
+    while ((opt = getopt(argc, argv, "s:d:w:r:b:k:h")) != -1) {
+        switch (opt) {
+            case 's':
+                args->nsizes = parse_list(optarg, list, BENCH_MAX_LIST);
+                for (int i = 0; i < args->nsizes; i++) {
+                    args->sizes[i] = (long)list[i];
+                    if (args->sizes[i] < 1 || args->sizes[i] > INT_MAX)
+                        bench_usage(argv[0]);
+                }
+                break;
+            case 'd':
+                args->ndensities = parse_list(optarg, args->densities, BENCH_MAX_LIST);
+                for (int i = 0; i < args->ndensities; i++)
+                    if (args->densities[i] <= 0 || args->densities[i] >= 1)
+                        bench_usage(argv[0]);
+                break;
+            case 'w':
+                args->warmup = atoi(optarg);
+                if (args->warmup < 0)
+                    bench_usage(argv[0]);
+                break;
+            case 'r':
+                args->reps = atoi(optarg);
+                if (args->reps < 1 || args->reps > BENCH_MAX_REPS)
+                    bench_usage(argv[0]);
+                break;
+            case 'b':
+                args->bytes = atol(optarg);
+                if (args->bytes < 1)
+                    bench_usage(argv[0]);
+                break;
+            case 'k':
+                args->kernel = optarg;
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if (args->nsizes == 0 || args->ndensities == 0)
+        bench_usage(argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_args_t args;
+
+    parse_args(argc, argv, &args);
+#ifdef HAVE_X86_SIMD
+    compact_init_shuffles();
+#endif
+
+    printf("warmup %d, reps %d, about %ld bytes per rep, median reported\n",
+           args.warmup, args.reps, args.bytes);
+    printf("%-15s %-7s %9s %7s %11s %9s %8s %8s\n",
+           "KERNEL", "VARIANT", "SIZE", "DENSITY", "NS/OP", "B/CYCLE", "GB/S", "SPEEDUP");
+
+    for (int s = 0; s < args.nsizes; s++) {
+        for (int d = 0; d < args.ndensities; d++) {
+            bench_corpus_t corpus;
+
+            if (make_corpus(&corpus, args.sizes[s], args.densities[d]) < 0) {
+                printf("Error: could not build a %ld byte corpus\n", args.sizes[s]);
+                return 2;
+            }
+            if (check_corpus(&corpus) < 0)
+                return 3;
+
+            const char *kernel = NULL;
+            double base_ns = 0;
+            for (int v = 0; v < NVARIANTS; v++) {
+                double ns, cycles;
+
+                if (args.kernel != NULL && strstr(variants[v].kernel, args.kernel) == NULL)
+                    continue;
+                if (kernel == NULL || strcmp(kernel, variants[v].kernel) != 0) {
+                    kernel = variants[v].kernel;
+                    base_ns = 0;
+                }
+                if (!variants[v].supported())
+                    continue;
+
+                measure(&variants[v], &corpus, &args, &ns, &cycles);
+                if (base_ns == 0)
+                    base_ns = ns;
+
+                printf("%-15s %-7s %9d %7.2f %11.1f ", variants[v].kernel, variants[v].name,
+                       corpus.len, args.densities[d], ns);
+                if (cycles > 0)
+                    printf("%9.2f ", corpus.len / cycles);
+                else
+                    printf("%9s ", "-");
+                printf("%8.2f %7.2fx\n", corpus.len / ns, base_ns / ns);
+            }
+            free_corpus(&corpus);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,824 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "libstringfun.h"
+
+
+//SIMD DISPATCH
+//
+//The vector paths below are chosen at run time from what the CPU
+//supports.  STRINGFUN_SIMD set to scalar, sse2, avx2 or avx512 caps the
+//level, to compare a kernel against the scalar reference.
+
+int sf_simd_level(void) {
+    static int level = -1;
+
+    if (level >= 0) {
+        return level;
+    }
+
+    level = SF_SIMD_SCALAR;
+#ifdef HAVE_X86_SIMD
+    static const char *names[] = { "scalar", "sse2", "avx2", "avx512" };
+    const char *want = getenv("STRINGFUN_SIMD");
+    int cap = SF_SIMD_AVX512;
+
+    for (int i = 0; want != NULL && i <= SF_SIMD_AVX512; i++) {
+        if (strcmp(want, names[i]) == 0) {
+            cap = i;
+        }
+    }
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        level = SF_SIMD_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        level = SF_SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("avx512bw")) {
+        level = SF_SIMD_AVX512;
+    }
+    if (level > cap) {
+        level = cap;
+    }
+#endif
+    return level;
+}
+
+
+//WHITESPACE COMPACTION
+//
+//sf_normalize() keeps a space or tab only if it follows something that
+//is not one, writes it as ' ' and drops leading ones.  As a bit mask over a
+//block that is keep = ~(ws & (ws << 1 | carry)), with carry set if the
+//block before ended in whitespace, and set at the start.  The vector
+//kernels compute that mask 16 or 64 bytes at a time and pack the kept
+//bytes together: with a pshufb per 8 bytes from a table of 256 shuffles,
+//or with one AVX-512 VBMI2 compress.  Each returns the packed length, or
+//SF_ERR_SPACE as soon as it would pass cap, and sf_normalize() drops the
+//trailing space for all of them.
+
+typedef long (*compact_kernel_t)(char *, size_t, const char *, size_t);
+
+static long compact_tail(char *dst, size_t cap, size_t out,
+                         const char *src, size_t n, int prev_ws) {
+    for (size_t i = 0; i < n; i++) {
+        int ws = src[i] == ' ' || src[i] == '\t';
+
+        if (ws && prev_ws) {
+            continue;
+        }
+        if (out >= cap) {
+            return SF_ERR_SPACE;
+        }
+        dst[out++] = ws ? ' ' : src[i];
+        prev_ws = ws;
+    }
+    return out;
+}
+
+static long compact_scalar(char *dst, size_t cap, const char *src, size_t n) {
+    return compact_tail(dst, cap, 0, src, n, 1);
+}
+
+#ifdef HAVE_X86_SIMD
+static uint64_t compact_shuffles[256];  //byte k is the index of set bit k
+
+static void compact_init_shuffles(void) {
+    for (int mask = 0; mask < 256; mask++) {
+        uint64_t shuf = 0;
+        int k = 0;
+
+        for (int b = 0; b < 8; b++) {
+            if (mask & (1 << b)) {
+                shuf |= (uint64_t)b << (8 * k++);
+            }
+        }
+        for (; k < 8; k++) {
+            shuf |= (uint64_t)0x80 << (8 * k);      //pshufb writes a 0
+        }
+        compact_shuffles[mask] = shuf;
+    }
+}
+
+__attribute__((target("ssse3,popcnt")))
+static long compact_ssse3(char *dst, size_t cap, const char *src, size_t n) {
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i hi_off = _mm_set_epi64x(0x0808080808080808LL, 0);
+    unsigned carry = 1;
+    size_t out = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab));
+        unsigned m = _mm_movemask_epi8(ws);
+        unsigned keep = ~(m & ((m << 1) | carry)) & 0xFFFF;
+        carry = m >> 15;
+
+        size_t n_lo = __builtin_popcount(keep & 0xFF);
+        size_t n_all = __builtin_popcount(keep);
+        if (out + n_all > cap) {
+            return SF_ERR_SPACE;
+        }
+
+        //tabs become spaces, then each half is packed to its low end
+        v = _mm_or_si128(_mm_andnot_si128(ws, v), _mm_and_si128(ws, sp));
+        __m128i shuf = _mm_set_epi64x(compact_shuffles[keep >> 8],
+                                      compact_shuffles[keep & 0xFF]);
+        v = _mm_shuffle_epi8(v, _mm_add_epi8(shuf, hi_off));
+
+        if (out + n_lo + 8 <= cap) {
+            _mm_storel_epi64((__m128i *)(dst + out), v);
+            _mm_storel_epi64((__m128i *)(dst + out + n_lo), _mm_srli_si128(v, 8));
+        } else {
+            char packed[16];
+            _mm_storeu_si128((__m128i *)packed, v);
+            memcpy(dst + out, packed, n_lo);
+            memcpy(dst + out + n_lo, packed + 8, n_all - n_lo);
+        }
+        out += n_all;
+    }
+    return compact_tail(dst, cap, out, src + i, n - i, carry);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi2,popcnt")))
+static long compact_vbmi2(char *dst, size_t cap, const char *src, size_t n) {
+    const __m512i sp = _mm512_set1_epi8(' ');
+    const __m512i tab = _mm512_set1_epi8('\t');
+    unsigned long long carry = 1;
+    size_t out = 0;
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(src + i));
+        __mmask64 ws = _mm512_cmpeq_epi8_mask(v, sp) | _mm512_cmpeq_epi8_mask(v, tab);
+        __mmask64 keep = ~(ws & ((ws << 1) | carry));
+        carry = ws >> 63;
+
+        size_t n_all = __builtin_popcountll(keep);
+        if (out + n_all > cap) {
+            return SF_ERR_SPACE;
+        }
+
+        v = _mm512_mask_mov_epi8(v, ws, sp);
+        if (out + 64 <= cap) {
+            _mm512_storeu_si512((void *)(dst + out), _mm512_maskz_compress_epi8(keep, v));
+        } else {
+            _mm512_mask_compressstoreu_epi8(dst + out, keep, v);
+        }
+        out += n_all;
+    }
+    return compact_tail(dst, cap, out, src + i, n - i, carry);
+}
+#endif
+
+static compact_kernel_t compact_kernel(void) {
+    static compact_kernel_t kernel = NULL;
+
+    if (kernel == NULL) {
+        kernel = compact_scalar;
+#ifdef HAVE_X86_SIMD
+        int level = sf_simd_level();
+
+        if (level >= SF_SIMD_SSE2 && __builtin_cpu_supports("ssse3") &&
+            __builtin_cpu_supports("popcnt")) {
+            compact_init_shuffles();
+            kernel = compact_ssse3;
+        }
+        if (level >= SF_SIMD_AVX512 && __builtin_cpu_supports("avx512vbmi2") &&
+            __builtin_cpu_supports("popcnt")) {
+            kernel = compact_vbmi2;
+        }
+#endif
+    }
+    return kernel;
+}
+
+
+/*
+ *  sf_normalize
+ *      dst, cap:  where the text goes, and its size
+ *      src, n:    the text, need not be '\0' terminated
+ *
+ *  Copies src to dst with every run of spaces and tabs turned into one
+ *  space and none at either end.  dst and src must not overlap.
+ *
+ *  returns:  the length written to dst
+ *            SF_ERR_SPACE  if it does not fit in cap bytes
+ */
+ssize_t sf_normalize(char *dst, size_t cap, const char *src, size_t n) {
+    long out = compact_kernel()(dst, cap, src, n);
+
+    if (out < 0) {
+        return SF_ERR_SPACE;
+    }
+    if (out > 0 && dst[out - 1] == ' ') {
+        out--;
+    }
+    return out;
+}
+
+//sf_normalize() into the stringfun buffer: the rest of its len bytes are
+//filled with '.', and len is returned
+ssize_t sf_setup_buff(char *buff, size_t len, const char *src, size_t n) {
+    ssize_t out = sf_normalize(buff, len, src, n);
+
+    if (out < 0) {
+        return out;
+    }
+    memset(buff + out, '.', len - out);
+    return len;
+}
+
+
+int sf_is_sep(char c, int seps) {
+    int ws = c == ' ' || (c >= '\t' && c <= '\r');
+
+    switch (seps) {
+    case SF_SEP_DOT:
+        return c == ' ' || c == '.';
+    case SF_SEP_WS:
+        return ws || c == '.';
+    default:
+        return ws;
+    }
+}
+
+//WORD COUNT KERNELS
+//
+//Counting words is counting word starts: bytes that are not a separator
+//and follow one.  The vector kernels compare 16, 32 or 64 bytes at a time
+//against the separators, turn the result into a bit mask of word bytes and
+//add popcount(word & ~(word << 1 | carry)), where carry is whether the
+//previous block ended inside a word.  The tail is finished by the scalar
+//kernel, which stays the reference all of them must agree with.
+//
+//seps is one of the SF_SEP_* sets.  For SF_SEP_SHELL the vector kernels
+//compare against ' ' where the others compare against '.'.
+
+typedef size_t (*word_kernel_t)(const char *, size_t, int, int *);
+
+static size_t words_scalar(const char *p, size_t n, int seps, int *in_word) {
+    size_t count = 0;
+    int in = *in_word;
+
+    for (size_t i = 0; i < n; i++) {
+        int sep = sf_is_sep(p[i], seps);
+
+        if (!sep && !in) {
+            count++;
+        }
+        in = !sep;
+    }
+    *in_word = in;
+    return count;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static size_t words_sse2(const char *p, size_t n, int seps, int *in_word) {
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i dot = _mm_set1_epi8(seps == SF_SEP_SHELL ? ' ' : '.');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    unsigned carry = *in_word;
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i sep = _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, dot));
+        if (seps != SF_SEP_DOT) {
+            //'\t'..'\r' is v - '\t' <= 4 unsigned
+            __m128i t = _mm_sub_epi8(v, tab);
+            sep = _mm_or_si128(sep, _mm_cmpeq_epi8(_mm_min_epu8(t, four), t));
+        }
+        unsigned word = ~(unsigned)_mm_movemask_epi8(sep) & 0xFFFF;
+        count += __builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 15;
+    }
+
+    *in_word = carry;
+    return count + words_scalar(p + i, n - i, seps, in_word);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t words_avx2(const char *p, size_t n, int seps, int *in_word) {
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i dot = _mm256_set1_epi8(seps == SF_SEP_SHELL ? ' ' : '.');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+    unsigned carry = *in_word;
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i sep = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, dot));
+        if (seps != SF_SEP_DOT) {
+            __m256i t = _mm256_sub_epi8(v, tab);
+            sep = _mm256_or_si256(sep, _mm256_cmpeq_epi8(_mm256_min_epu8(t, four), t));
+        }
+        unsigned word = ~(unsigned)_mm256_movemask_epi8(sep);
+        count += __builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 31;
+    }
+
+    *in_word = carry;
+    return count + words_scalar(p + i, n - i, seps, in_word);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static size_t words_avx512(const char *p, size_t n, int seps, int *in_word) {
+    const __m512i sp = _mm512_set1_epi8(' ');
+    const __m512i dot = _mm512_set1_epi8(seps == SF_SEP_SHELL ? ' ' : '.');
+    const __m512i tab = _mm512_set1_epi8('\t');
+    const __m512i four = _mm512_set1_epi8(4);
+    unsigned long long carry = *in_word;
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(p + i));
+        __mmask64 sep = _mm512_cmpeq_epi8_mask(v, sp) | _mm512_cmpeq_epi8_mask(v, dot);
+        if (seps != SF_SEP_DOT) {
+            sep |= _mm512_cmple_epu8_mask(_mm512_sub_epi8(v, tab), four);
+        }
+        unsigned long long word = ~(unsigned long long)sep;
+        count += __builtin_popcountll(word & ~((word << 1) | carry));
+        carry = word >> 63;
+    }
+
+    *in_word = carry;
+    return count + words_scalar(p + i, n - i, seps, in_word);
+}
+#endif
+
+static word_kernel_t word_kernel(void) {
+    static word_kernel_t kernel = NULL;
+
+    if (kernel != NULL) {
+        return kernel;
+    }
+
+    kernel = words_scalar;
+#ifdef HAVE_X86_SIMD
+    int level = sf_simd_level();
+
+    if (level >= SF_SIMD_SSE2) {
+        kernel = words_sse2;
+    }
+    if (level >= SF_SIMD_AVX2 && __builtin_cpu_supports("popcnt")) {
+        kernel = words_avx2;
+    }
+    if (level >= SF_SIMD_AVX512 && __builtin_cpu_supports("popcnt")) {
+        kernel = words_avx512;
+    }
+#endif
+    return kernel;
+}
+
+/*
+ *  sf_count_words
+ *      p, n:     the text
+ *      seps:     SF_SEP_* separator set
+ *      in_word:  whether the text before p ended inside a word, updated
+ *                for the text after it.  Start a new text with 0.
+ *
+ *  Counts the words that start in p[0..n), so a long text can be counted
+ *  in pieces.
+ */
+size_t sf_count_words(const char *p, size_t n, int seps, int *in_word) {
+    return word_kernel()(p, n, seps, in_word);
+}
+
+
+/*
+ *  sf_next_word
+ *      p, n:   the text
+ *      seps:   SF_SEP_* separator set
+ *      start:  where to look from, set to where the word found starts
+ *
+ *  Finds the next word at or after *start.  To walk every word, add the
+ *  length returned to *start after each call.
+ *
+ *  returns:  the length of the word, 0 when there are no more
+ */
+size_t sf_next_word(const char *p, size_t n, int seps, size_t *start) {
+    size_t i = *start;
+
+    while (i < n && sf_is_sep(p[i], seps)) {
+        i++;
+    }
+    *start = i;
+    while (i < n && !sf_is_sep(p[i], seps)) {
+        i++;
+    }
+    return i - *start;
+}
+
+
+//REVERSE
+
+void sf_reverse(char *p, size_t n) {
+    for (size_t a = 0, b = n; a + 1 < b; a++, b--) {
+        char temp = p[a];
+        p[a] = p[b - 1];
+        p[b - 1] = temp;
+    }
+}
+
+/*
+ *  sf_reverse_utf8
+ *
+ *  Reverses characters rather than bytes.  sf_reverse() leaves every
+ *  multi-byte character back to front, continuation bytes first, so each
+ *  of those is turned around once more.
+ *
+ *  returns:  0 on success
+ *            SF_ERR_UTF8  p is not valid UTF-8, and is left as it was
+ */
+int sf_reverse_utf8(char *p, size_t n) {
+    if (!sf_utf8_valid(p, n)) {
+        return SF_ERR_UTF8;
+    }
+
+    sf_reverse(p, n);
+    for (size_t i = 0; i < n; i++) {
+        if (!sf_utf8_is_cont(p[i])) {
+            continue;
+        }
+
+        size_t lead = i;
+        while (lead + 1 < n && sf_utf8_is_cont(p[lead])) {
+            lead++;
+        }
+        for (size_t a = i, b = lead; a < b; a++, b--) {
+            char temp = p[a];
+            p[a] = p[b];
+            p[b] = temp;
+        }
+        i = lead;
+    }
+    return 0;
+}
+
+//UTF-8
+//
+//Valid means no stray or missing continuation bytes, no overlong forms,
+//no surrogates and nothing past U+10FFFF.  Separators are all ASCII and
+//never occur inside a multi-byte character, so the word functions work on
+//UTF-8 unchanged; only reversing and lengths need to know where
+//characters start.
+//
+//utf8_scalar_byte() is a byte at a time state machine and the reference.
+//The SSSE3 path is the lookup table method of Keiser and Lemire: three
+//pshufb lookups on the high and low nibbles of each byte and the one
+//before it flag every bad two byte combination, and the third and fourth
+//bytes of a character are checked with saturating subtractions.  It has
+//no branches on the data, so multi-byte text costs about what ASCII does,
+//and 32 bytes of ASCII at a time skip the lookups altogether.  Both take
+//the input in pieces of any size, so a character may be cut by a chunk.
+
+size_t sf_utf8_chars(const char *p, size_t n) {
+    size_t chars = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        chars += !sf_utf8_is_cont(p[i]);
+    }
+    return chars;
+}
+
+static void utf8_scalar_byte(sf_utf8_t *st, unsigned char c) {
+    if (st->need > 0) {
+        if (c < st->lo || c > st->hi) {
+            st->error = 1;
+        }
+        st->need--;
+        st->lo = 0x80;
+        st->hi = 0xBF;
+        return;
+    }
+
+    st->lo = 0x80;
+    st->hi = 0xBF;
+    if (c < 0x80) {
+        return;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        st->need = 1;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        st->need = 2;
+        if (c == 0xE0) {
+            st->lo = 0xA0;      //overlong
+        } else if (c == 0xED) {
+            st->hi = 0x9F;      //surrogates
+        }
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        st->need = 3;
+        if (c == 0xF0) {
+            st->lo = 0x90;      //overlong
+        } else if (c == 0xF4) {
+            st->hi = 0x8F;      //past U+10FFFF
+        }
+    } else {
+        st->error = 1;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+#define U8_TOO_SHORT    (1 << 0)    //lead byte not followed by enough continuations
+#define U8_TOO_LONG     (1 << 1)    //ASCII followed by a continuation
+#define U8_OVERLONG_3   (1 << 2)
+#define U8_TOO_LARGE    (1 << 3)
+#define U8_SURROGATE    (1 << 4)
+#define U8_OVERLONG_2   (1 << 5)
+#define U8_TOO_LARGE_1000 (1 << 6)
+#define U8_OVERLONG_4   (1 << 6)
+#define U8_TWO_CONTS    (1 << 7)    //two continuations, fine if inside a 3 or 4 byte character
+#define U8_CARRY        (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static __m128i utf8_check_block(__m128i in, __m128i prev) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i byte_1_high = _mm_setr_epi8(
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+        U8_TOO_SHORT | U8_OVERLONG_2,
+        U8_TOO_SHORT,
+        U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+        U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4);
+    const __m128i byte_1_low = _mm_setr_epi8(
+        U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+        U8_CARRY | U8_OVERLONG_2,
+        U8_CARRY,
+        U8_CARRY,
+        U8_CARRY | U8_TOO_LARGE,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000);
+    const __m128i byte_2_high = _mm_setr_epi8(
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT);
+
+    //prev1 is each byte's predecessor, prev2 and prev3 the ones before
+    __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+    __m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(
+            _mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+            _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+    //two continuations in a row must be the 3rd or 4th byte of a character
+    __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+
+    return _mm_xor_si128(must23, special);
+}
+
+//n is a multiple of 16
+__attribute__((target("ssse3")))
+static void utf8_blocks_ssse3(sf_utf8_t *st, const unsigned char *p, size_t n) {
+    //a lead byte in the last three places still wants continuations
+    const __m128i max_end = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                          -1, -1, -1, -1, -1, (char)(0xF0 - 1),
+                                          (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m128i prev = _mm_loadu_si128((const __m128i *)st->prev);
+    __m128i incomplete = _mm_set1_epi8(st->incomplete ? 1 : 0);
+    __m128i err = _mm_setzero_si128();
+    size_t i = 0;
+
+    while (i < n) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(p + i));
+
+        if (i + 32 <= n) {
+            __m128i in2 = _mm_loadu_si128((const __m128i *)(p + i + 16));
+            if (_mm_movemask_epi8(_mm_or_si128(in, in2)) == 0) {
+                err = _mm_or_si128(err, incomplete);
+                incomplete = _mm_setzero_si128();
+                prev = in2;
+                i += 32;
+                continue;
+            }
+        }
+
+        if (_mm_movemask_epi8(in) == 0) {
+            err = _mm_or_si128(err, incomplete);
+            incomplete = _mm_setzero_si128();
+        } else {
+            err = _mm_or_si128(err, utf8_check_block(in, prev));
+            incomplete = _mm_subs_epu8(in, max_end);
+        }
+        prev = in;
+        i += 16;
+    }
+
+    _mm_storeu_si128((__m128i *)st->prev, prev);
+    st->incomplete = _mm_movemask_epi8(_mm_cmpeq_epi8(incomplete, _mm_setzero_si128())) != 0xFFFF;
+    st->error |= _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128())) != 0xFFFF;
+}
+#endif
+
+void sf_utf8_init(sf_utf8_t *st) {
+    memset(st, 0, sizeof(*st));
+#ifdef HAVE_X86_SIMD
+    st->simd = sf_simd_level() >= SF_SIMD_SSE2 && __builtin_cpu_supports("ssse3");
+#endif
+}
+
+/*
+ *  sf_utf8_feed
+ *
+ *  Validates the next n bytes of a text, which may be cut anywhere, even
+ *  inside a character.  sf_utf8_finish() gives the verdict.
+ */
+void sf_utf8_feed(sf_utf8_t *st, const char *p, size_t n) {
+    if (!st->simd) {
+        for (size_t i = 0; i < n; i++) {
+            utf8_scalar_byte(st, p[i]);
+        }
+        return;
+    }
+#ifdef HAVE_X86_SIMD
+    if (st->npend > 0) {
+        size_t room = 16 - st->npend;
+        size_t take = room < n ? room : n;
+
+        memcpy(st->pend + st->npend, p, take);
+        st->npend += take;
+        p += take;
+        n -= take;
+        if (st->npend < 16) {
+            return;
+        }
+        utf8_blocks_ssse3(st, st->pend, 16);
+        st->npend = 0;
+    }
+
+    size_t whole = n & ~(size_t)15;
+    utf8_blocks_ssse3(st, (const unsigned char *)p, whole);
+    memcpy(st->pend, p + whole, n - whole);
+    st->npend = n - whole;
+#endif
+}
+
+//returns 0 if everything fed was valid UTF-8, else SF_ERR_UTF8
+int sf_utf8_finish(sf_utf8_t *st) {
+    if (!st->simd) {
+        return st->error || st->need > 0 ? SF_ERR_UTF8 : 0;
+    }
+#ifdef HAVE_X86_SIMD
+    if (st->npend > 0) {
+        //zeros are ASCII, a cut off character shows up as too short
+        memset(st->pend + st->npend, 0, 16 - st->npend);
+        utf8_blocks_ssse3(st, st->pend, 16);
+        st->npend = 0;
+    }
+#endif
+    return st->error || st->incomplete ? SF_ERR_UTF8 : 0;
+}
+
+//returns 1 if p[0..n) is valid UTF-8
+int sf_utf8_valid(const char *p, size_t n) {
+    sf_utf8_t st;
+
+    sf_utf8_init(&st);
+    sf_utf8_feed(&st, p, n);
+    return sf_utf8_finish(&st) == 0;
+}
+
+//SUBSTRING SEARCH
+//
+//Boyer-Moore-Horspool: a window that does not match is shifted by how far
+//its last byte is from the end of the needle, so most of the text is never
+//looked at when the needle is long.  Every match also starts with the
+//first byte of the needle, so each window is first moved up to the next
+//such byte with memchr(), which is vectorized in libc and does the work
+//when the needle is too short for Horspool to skip much.
+
+void sf_finder_init(sf_finder_t *f, const char *needle, size_t m) {
+    f->needle = needle;
+    f->m = m;
+    for (int c = 0; c < 256; c++) {
+        f->skip[c] = m;
+    }
+    for (size_t i = 0; i + 1 < m; i++) {
+        f->skip[(unsigned char)needle[i]] = m - 1 - i;
+    }
+}
+
+//returns the first match in hay[0..n), or NULL
+const char *sf_find(const sf_finder_t *f, const char *hay, size_t n) {
+    size_t m = f->m;
+
+    if (m == 0 || n < m) {
+        return NULL;
+    }
+
+    size_t last_start = n - m;
+    size_t i = 0;
+    while (i <= last_start) {
+        const char *c = memchr(hay + i, f->needle[0], last_start - i + 1);
+        if (c == NULL) {
+            return NULL;
+        }
+        i = c - hay;
+
+        unsigned char tail = hay[i + m - 1];
+        if (tail == (unsigned char)f->needle[m - 1] &&
+            memcmp(hay + i + 1, f->needle + 1, m - 1) == 0) {
+            return hay + i;
+        }
+        i += f->skip[tail];
+    }
+    return NULL;
+}
+
+
+//returns the length of src[0..n) with every find[0..m) replaced by r
+//bytes, the size sf_replace() needs
+size_t sf_replace_size(const char *src, size_t n, const char *find, size_t m, size_t r) {
+    sf_finder_t f;
+    const char *hit;
+    size_t matches = 0;
+
+    if (m == 0) {
+        return n;
+    }
+    sf_finder_init(&f, find, m);
+    for (const char *p = src; (hit = sf_find(&f, p, src + n - p)) != NULL; p = hit + m) {
+        matches++;
+    }
+    return n + matches * r - matches * m;
+}
+
+/*
+ *  sf_replace
+ *      dst, cap:  where the result goes, and its size
+ *      src, n:    the text
+ *      find, m:   what to replace, at least one byte
+ *      repl, r:   what to put in its place
+ *
+ *  Replaces every occurrence of find, left to right and without overlaps.
+ *  dst and src must not overlap.  sf_replace_size() tells how big dst
+ *  has to be.
+ *
+ *  returns:  the length written to dst
+ *            SF_ERR_ARGS   m is 0
+ *            SF_ERR_SPACE  it does not fit in cap bytes
+ */
+ssize_t sf_replace(char *dst, size_t cap, const char *src, size_t n,
+                   const char *find, size_t m, const char *repl, size_t r) {
+    sf_finder_t f;
+    const char *end = src + n;
+    const char *hit;
+    size_t out = 0;
+
+    if (m == 0) {
+        return SF_ERR_ARGS;
+    }
+    sf_finder_init(&f, find, m);
+
+    for (const char *p = src; p < end; p = hit + m) {
+        hit = sf_find(&f, p, end - p);
+
+        size_t keep = (hit == NULL ? end : hit) - p;
+        if (cap - out < keep || (hit != NULL && cap - out - keep < r)) {
+            return SF_ERR_SPACE;
+        }
+        memcpy(dst + out, p, keep);
+        out += keep;
+        if (hit == NULL) {
+            break;
+        }
+        memcpy(dst + out, repl, r);
+        out += r;
+    }
+    return out;
+}
@@ -0,0 +1,82 @@
+#ifndef __LIBSTRINGFUN_H__
+    #define __LIBSTRINGFUN_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+//libstringfun - the stringfun text kernels, for any program to link.
+//
+//Every function takes explicit lengths, never looks past them and never
+//needs a terminating '\0'.  Output goes only to buffers the caller passes
+//in, with their size, and nothing here allocates memory or prints.
+//Functions that can fail return a negative SF_ERR_* code.
+//
+//The vector paths are picked at run time from what the CPU supports, see
+//sf_simd_level().
+
+#define SF_ERR_SPACE    -1      //the output does not fit in the caller's buffer
+#define SF_ERR_UTF8     -2      //the input is not valid UTF-8
+#define SF_ERR_ARGS     -3
+
+//separator sets for the word functions
+#define SF_SEP_DOT      0       //' ' and '.', the stringfun buffer
+#define SF_SEP_WS       1       //ASCII whitespace and '.', the streaming modes
+#define SF_SEP_SHELL    2       //ASCII whitespace only, command lines
+
+//values of sf_simd_level(), STRINGFUN_SIMD=scalar|sse2|avx2|avx512 caps it
+#define SF_SIMD_SCALAR  0
+#define SF_SIMD_SSE2    1
+#define SF_SIMD_AVX2    2
+#define SF_SIMD_AVX512  3
+
+//Boyer-Moore-Horspool search state for one needle, see sf_find()
+typedef struct sf_finder {
+    const char *needle;
+    size_t      m;
+    size_t      skip[256];
+} sf_finder_t;
+
+//Streaming UTF-8 validator state, see sf_utf8_feed().  The fields are
+//private to the library.
+typedef struct sf_utf8 {
+    int           simd;
+    int           error;
+    int           need;         //scalar: continuation bytes still wanted
+    unsigned char lo;           //scalar: range of the next one
+    unsigned char hi;
+    unsigned char prev[16];     //simd: the last block
+    int           incomplete;   //simd: it ended inside a character
+    unsigned char pend[16];     //simd: bytes waiting to fill a block
+    int           npend;
+} sf_utf8_t;
+
+static inline int sf_utf8_is_cont(char c) {
+    return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+//prototypes
+int     sf_simd_level(void);
+
+ssize_t sf_normalize(char *dst, size_t cap, const char *src, size_t n);
+ssize_t sf_setup_buff(char *buff, size_t len, const char *src, size_t n);
+
+int     sf_is_sep(char c, int seps);
+size_t  sf_count_words(const char *p, size_t n, int seps, int *in_word);
+size_t  sf_next_word(const char *p, size_t n, int seps, size_t *start);
+
+void    sf_reverse(char *p, size_t n);
+int     sf_reverse_utf8(char *p, size_t n);
+
+void        sf_finder_init(sf_finder_t *f, const char *needle, size_t m);
+const char *sf_find(const sf_finder_t *f, const char *hay, size_t n);
+size_t      sf_replace_size(const char *src, size_t n, const char *find, size_t m, size_t r);
+ssize_t     sf_replace(char *dst, size_t cap, const char *src, size_t n,
+                       const char *find, size_t m, const char *repl, size_t r);
+
+void    sf_utf8_init(sf_utf8_t *st);
+void    sf_utf8_feed(sf_utf8_t *st, const char *p, size_t n);
+int     sf_utf8_finish(sf_utf8_t *st);
+int     sf_utf8_valid(const char *p, size_t n);
+size_t  sf_utf8_chars(const char *p, size_t n);
+
+#endif
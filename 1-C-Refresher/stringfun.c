@@ -1,21 +1,57 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libstringfun.h"
 
 
 #define BUFFER_SZ 50
+#define STREAM_CHUNK (1 << 20)  //bytes read at a time by the -C/-R/-W modes
+#define PAR_MIN_SLICE (1 << 20) //smallest slice worth its own thread in -P
+#define PAR_MAX_THREADS 256
+#define FREQ_DEFAULT_TOP 10     //words listed by -F when N is not given
+#define FREQ_ARENA_BLOCK (1 << 20)
+#define FREQ_INIT_SLOTS 4096    //power of 2
+#define FREQ_MEM_LIMIT (256LL << 20)    //table + arena, see freq_add()
+#define UTF8_INVALID SF_ERR_UTF8       //returned by the streaming u modes
 
 //prototypes
 void usage(char *);
 void print_buff(char *, int);
 int  setup_buff(char *, char *, int);
+int  setup_buff_scalar(char *, char *, int);
 
 //prototypes for functions to handle required functionality
 int  count_words(char *, int, int);
 //add additional prototypes here
+int  replace_words(char **, int, int, char *, char *);
+void reverse_string_utf8(char *, int);
+void print_words_utf8(char *, int, int);
+int  stream_open(char *);
+long long stream_count_words(int, char *, int, int);
+int  stream_print_words(int, char *, int, int);
+int  stream_reverse(int, char *, int, int);
+int  stream_replace(int, char *, int, char *, char *);
+int  stream_main(char, int, char *, char *, char *);
+int  freq_main(char *, int);
+long long par_count_words(const char *, size_t, int);
+int  par_main(char, char *, int);
 
 
 int setup_buff(char *buff, char *user_str, int len){
+    return sf_setup_buff(buff, len, user_str, strlen(user_str)) < 0 ? -1 : len;
+}
+
+//the byte at a time version, the reference for sf_setup_buff()
+int setup_buff_scalar(char *buff, char *user_str, int len){
     int user_str_len = 0; 
     char *src = user_str; 
     char *dst = buff;    
@@ -66,74 +102,916 @@ void print_buff(char *buff, int len){
 
 void usage(char *exename){
     printf("usage: %s [-h|c|r|w|x] \"string\" [other args]\n", exename);
+    printf("       %s [-C|R|W] file    (streaming count/reverse/print, - for stdin)\n", exename);
+    printf("       a u after c, r, w, C, R or W (-ru) works in UTF-8 characters\n");
+    printf("       %s -X file find replace   (streaming replace all)\n", exename);
+    printf("       %s -F file [N]            (N most frequent words, default %d)\n", exename, FREQ_DEFAULT_TOP);
+    printf("       %s -P file [threads]      (parallel count, default one per cpu)\n", exename);
+    printf("       %s -S file [max_threads]  (parallel count scaling report)\n", exename);
 
 }
 
 int count_words(char *buff, int len, int str_len) {
-    int count = 0;
     int in_word = 0;
 
-    for (int i = 0; i < str_len; i++) {
-        if (*(buff + i) != ' ' && *(buff + i) != '.') { // Only check for spaces and dots
-            if (!in_word) {
-                count++; 
-                in_word = 1; 
-            }
-        } else {
-            in_word = 0; 
-        }
+    if (str_len < 0 || str_len > len) {
+        return -1;
     }
-    return count; 
+    return (int)sf_count_words(buff, str_len, SF_SEP_DOT, &in_word);
 }
 
 //ADD OTHER HELPER FUNCTIONS HERE FOR OTHER REQUIRED PROGRAM OPTIONS
 
+//the padding dots are not part of the string
+static int trim_dots(char *buff, int str_len) {
+    while (str_len > 0 && buff[str_len - 1] == '.') {
+        str_len--;
+    }
+    return str_len;
+}
+
 void reverse_string(char *buff, int str_len) {
-    char temp;
-    int start = 0;
-    int end = str_len - 1;
+    sf_reverse(buff, trim_dots(buff, str_len));
+}
+
+static void print_words_mode(char *buff, int str_len, int utf8) {
+    printf("Word Print\n");
+    printf("----------\n");
+    
+    int word_count = 0;
+    size_t start = 0;
+    size_t n;
+    
+    while ((n = sf_next_word(buff, str_len, SF_SEP_DOT, &start)) > 0) {
+        printf("%d. %.*s(%d)\n", ++word_count, (int)n, buff + start,
+               (int)(utf8 ? sf_utf8_chars(buff + start, n) : n));
+        start += n;
+    }
+
+    printf("\nNumber of words returned: %d\n", word_count);
+}
+
+void print_words(char *buff, int len, int str_len) {
+    (void)len;      //the words end at str_len
+    print_words_mode(buff, str_len, 0);
+}
+
+//same as print_words(), but word lengths are in characters
+void print_words_utf8(char *buff, int len, int str_len) {
+    (void)len;
+    print_words_mode(buff, str_len, 1);
+}
 
-    // Find the last non-dot character
-    while (end >= 0 && buff[end] == '.') {
-        end--;
+
+//buff must hold valid UTF-8, main() checks it before -ru
+void reverse_string_utf8(char *buff, int str_len) {
+    sf_reverse_utf8(buff, trim_dots(buff, str_len));
+}
+
+
+//Replaces every occurrence of find in the first str_len bytes of *buff.
+//If the result does not fit in len bytes *buff is reallocated to hold it,
+//otherwise the rest is filled with dots again.  Returns the new length of
+//the buffer (len or more), or -1 on error.
+int replace_words(char **buff, int len, int str_len, char *find, char *repl) {
+    size_t m = strlen(find);
+    size_t r = strlen(repl);
+
+    if (m == 0 || str_len < 0 || str_len > len) {
+        return -1;
     }
+    str_len = trim_dots(*buff, str_len);
 
-    // Reverse the string in place
-    while (start < end) {
-        temp = buff[start];
-        buff[start] = buff[end];
-        buff[end] = temp;
-        start++;
-        end--;
+    size_t new_len = sf_replace_size(*buff, str_len, find, m, r);
+    size_t out_len = new_len > (size_t)len ? new_len : (size_t)len;
+    if (out_len > INT_MAX) {
+        return -1;
     }
+    char *out = malloc(out_len);
+    if (out == NULL) {
+        return -1;
+    }
+
+    sf_replace(out, out_len, *buff, str_len, find, m, repl, r);
+    memset(out + new_len, '.', out_len - new_len);
+
+    free(*buff);
+    *buff = out;
+    return (int)out_len;
 }
 
 
-void print_words(char *buff, int len, int str_len) {
+//STREAMING MODES
+//
+//-C, -R and -W do what -c, -r and -w do, but over a file or stdin of any
+//size.  Input is read STREAM_CHUNK bytes at a time and whatever state a
+//word is in at the end of a chunk is carried into the next one, so memory
+//use does not depend on the input size.  Runs of whitespace (including
+//newlines) count as one space, and '.' separates words as it does in the
+//buffer versions.
+
+static int is_word_sep(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+           c == '\v' || c == '\f' || c == '.';
+}
+
+static int is_space(char c) {
+    return c != '.' && is_word_sep(c);
+}
+
+int stream_open(char *path) {
+    if (strcmp(path, "-") == 0) {
+        return STDIN_FILENO;
+    }
+    return open(path, O_RDONLY);
+}
+
+long long stream_count_words(int fd, char *chunk, int len, int utf8) {
+    sf_utf8_t u;
+    long long count = 0;
+    int in_word = 0;
+    ssize_t n;
+
+    sf_utf8_init(&u);
+    while ((n = read(fd, chunk, len)) > 0) {
+        count += sf_count_words(chunk, n, SF_SEP_WS, &in_word);
+        if (utf8) {
+            sf_utf8_feed(&u, chunk, n);
+        }
+    }
+    if (n < 0) {
+        return -1;
+    }
+    return utf8 && sf_utf8_finish(&u) != 0 ? UTF8_INVALID : count;
+}
+
+//with utf8 set word lengths are in characters, and invalid input is
+//reported once everything has been printed
+int stream_print_words(int fd, char *chunk, int len, int utf8) {
+    sf_utf8_t u;
+    long long word_count = 0;
+    long long word_len = 0;
+    int in_word = 0;
+    ssize_t n;
+
     printf("Word Print\n");
     printf("----------\n");
-    
-    int word_count = 0;
-    char *word_start = buff;
-    
-    for (int i = 0; i < str_len; i++) {
-        if (*(buff + i) == ' ' || *(buff + i) == '.') {
-            if (word_start != (buff + i)) {
-                printf("%d. %.*s(%d)\n", ++word_count, (int)(buff + i - word_start), word_start, (int)(buff + i - word_start));
+
+    sf_utf8_init(&u);
+    while ((n = read(fd, chunk, len)) > 0) {
+        ssize_t start = 0;      //first byte of the word part in this chunk
+
+        if (utf8) {
+            sf_utf8_feed(&u, chunk, n);
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (is_word_sep(chunk[i])) {
+                if (in_word) {
+                    fwrite(chunk + start, 1, i - start, stdout);
+                    printf("(%lld)\n", word_len);
+                    word_len = 0;
+                    in_word = 0;
+                }
+                continue;
+            }
+            if (!in_word) {
+                printf("%lld. ", ++word_count);
+                start = i;
+                in_word = 1;
+            }
+            word_len += !utf8 || !sf_utf8_is_cont(chunk[i]);
+        }
+
+        //the word runs into the next chunk, print what we have of it
+        if (in_word) {
+            fwrite(chunk + start, 1, n - start, stdout);
+        }
+    }
+    if (n < 0) {
+        return -1;
+    }
+    if (in_word) {
+        printf("(%lld)\n", word_len);
+    }
+
+    printf("\nNumber of words returned: %lld\n", word_count);
+    return utf8 && sf_utf8_finish(&u) != 0 ? UTF8_INVALID : 0;
+}
+
+//Reverses the input by reading it back to front, stdin is spooled to a
+//temporary file first since it can not be read backwards.  Whitespace is
+//collapsed and trimmed the way setup_buff() does it.  With utf8 set the
+//input is validated front to back first, then reversed by character.
+int stream_reverse(int fd, char *chunk, int len, int utf8) {
+    struct stat st;
+    FILE *spool = NULL;
+    long long emitted = 0;
+    int pending_space = 0;
+    ssize_t n;
+
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        spool = tmpfile();
+        if (spool == NULL) {
+            return -1;
+        }
+        while ((n = read(fd, chunk, len)) > 0) {
+            if (fwrite(chunk, 1, n, spool) != (size_t)n) {
+                fclose(spool);
+                return -1;
+            }
+        }
+        if (n < 0 || fflush(spool) != 0) {
+            fclose(spool);
+            return -1;
+        }
+        fd = fileno(spool);
+        if (fstat(fd, &st) != 0) {
+            fclose(spool);
+            return -1;
+        }
+    }
+
+    int rc = 0;
+    if (utf8) {
+        sf_utf8_t u;
+
+        sf_utf8_init(&u);
+        for (off_t at = 0; rc == 0 && at < st.st_size; at += n) {
+            n = pread(fd, chunk, len, at);
+            if (n <= 0) {
+                rc = -1;
+            } else {
+                sf_utf8_feed(&u, chunk, n);
             }
-            word_start = buff + i + 1;
+        }
+        if (rc == 0 && sf_utf8_finish(&u) != 0) {
+            rc = UTF8_INVALID;
         }
     }
 
-    if (word_start < buff + str_len) {
-        printf("%d. %s(%d)\n", ++word_count, word_start, (int)(buff + str_len - word_start));
+    //each chunk is reversed into out, which can grow by at most one
+    //pending space
+    char *out = rc == 0 ? malloc(len + 1) : NULL;
+    if (out == NULL) {
+        if (spool != NULL) {
+            fclose(spool);
+        }
+        return rc == 0 ? -1 : rc;
     }
 
-    printf("\nNumber of words returned: %d\n", word_count);
+    off_t end = st.st_size;
+    while (end > 0) {
+        ssize_t want = end < len ? end : len;
+        off_t pos = end - want;
+        ssize_t out_len = 0;
+        ssize_t first = 0;
+
+        n = pread(fd, chunk, want, pos);
+        if (n != want) {
+            rc = -1;
+            break;
+        }
+
+        //a character cut by the start of the window goes in the next one
+        while (utf8 && pos > 0 && first < 3 && first < n - 1 && sf_utf8_is_cont(chunk[first])) {
+            first++;
+        }
+
+        for (ssize_t i = n - 1; i >= first; i--) {
+            if (is_space(chunk[i])) {
+                pending_space = emitted > 0;
+                continue;
+            }
+            if (pending_space) {
+                out[out_len++] = ' ';
+                pending_space = 0;
+            }
+
+            ssize_t lead = i;
+            while (utf8 && lead > first && sf_utf8_is_cont(chunk[lead])) {
+                lead--;
+            }
+            memcpy(out + out_len, chunk + lead, i - lead + 1);
+            out_len += i - lead + 1;
+            i = lead;
+            emitted++;
+        }
+        fwrite(out, 1, out_len, stdout);
+        end = pos + first;
+    }
+    putchar('\n');
+
+    free(out);
+    if (spool != NULL) {
+        fclose(spool);
+    }
+    return rc;
+}
+
+//Writes the input to stdout with every occurrence of find replaced.  The
+//bytes are passed through as they are, whitespace included.  The last
+//strlen(find) - 1 bytes of a chunk could be the start of a match that
+//ends in the next one, so they are held back and searched again with it.
+int stream_replace(int fd, char *chunk, int len, char *find, char *repl) {
+    sf_finder_t f;
+    size_t m = strlen(find);
+    size_t r = strlen(repl);
+    size_t keep = 0;    //bytes held back at the front of win
+    ssize_t n;
+
+    if (m == 0) {
+        return -1;
+    }
+    sf_finder_init(&f, find, m);
+
+    char *win = malloc(len + m);
+    if (win == NULL) {
+        return -1;
+    }
+
+    while ((n = read(fd, chunk, len)) >= 0) {
+        memcpy(win + keep, chunk, n);
+
+        size_t total = keep + n;
+        const char *p = win;
+        const char *end = win + total;
+        const char *hit;
+        while ((hit = sf_find(&f, p, end - p)) != NULL) {
+            fwrite(p, 1, hit - p, stdout);
+            fwrite(repl, 1, r, stdout);
+            p = hit + m;
+        }
+
+        if (n == 0) {
+            fwrite(p, 1, end - p, stdout);
+            break;
+        }
+
+        //no match starts before end - (m - 1), so only those can be
+        //completed by the next chunk
+        const char *hold = total >= m - 1 ? end - (m - 1) : win;
+        if (hold < p) {
+            hold = p;
+        }
+        fwrite(p, 1, hold - p, stdout);
+        keep = end - hold;
+        memmove(win, hold, keep);
+    }
+
+    free(win);
+    return n < 0 ? -1 : 0;
+}
+
+//runs one of the streaming modes, returns the exit code.  utf8 is set by
+//the u modes, find and repl are only used by -X.
+int stream_main(char opt, int utf8, char *path, char *find, char *repl) {
+    int fd = stream_open(path);
+    if (fd < 0) {
+        printf("Error: could not open %s\n", path);
+        return 2;
+    }
+
+    char *chunk = malloc(STREAM_CHUNK);
+    if (chunk == NULL) {
+        printf("Error: Memory Allocation Failed.\n");
+        return 99;
+    }
+
+    long long rc = 0;
+    switch (opt) {
+        case 'C':
+            rc = stream_count_words(fd, chunk, STREAM_CHUNK, utf8);
+            if (rc >= 0) {
+                printf("Word Count: %lld\n", rc);
+            }
+            break;
+        case 'R':
+            rc = stream_reverse(fd, chunk, STREAM_CHUNK, utf8);
+            break;
+        case 'W':
+            rc = stream_print_words(fd, chunk, STREAM_CHUNK, utf8);
+            break;
+        case 'X':
+            rc = stream_replace(fd, chunk, STREAM_CHUNK, find, repl);
+            break;
+    }
+
+    free(chunk);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (rc == UTF8_INVALID) {
+        printf("Error: %s is not valid UTF-8\n", path);
+        return 2;
+    }
+    if (rc < 0) {
+        printf("Error reading %s\n", path);
+        return 2;
+    }
+    return 0;
+}
+
+
+//WORD FREQUENCY
+//
+//-F counts how often each word of a file occurs and prints the N most
+//frequent ones.  Each distinct word is copied once, into an arena of
+//FREQ_ARENA_BLOCK sized blocks rather than a malloc() of its own, and the
+//table is a single array of slots probed linearly.  Once the table and
+//the arena reach FREQ_MEM_LIMIT new words are only counted as untracked,
+//words already in the table keep counting, so memory stays bounded
+//whatever the input.  The top N are picked with a size N min-heap, so only
+//they are ever sorted.
+//
+//A slot is 16 bytes, the count lives in the arena in front of the word:
+//probing past other words only compares hashes, and a word that is found
+//has its bytes compared next to the count anyway.
+
+typedef struct freq_entry {
+    char     *rec;          //count, then the word; NULL for an empty slot
+    uint32_t  hash;
+    uint32_t  len;
+} freq_entry_t;
+
+#define FREQ_COUNT(e) (*(long long *)(e)->rec)
+#define FREQ_WORD(e)  ((e)->rec + sizeof(long long))
+
+typedef struct freq_block {
+    struct freq_block *next;
+    size_t             used;
+    size_t             size;
+    _Alignas(8) char   data[];
+} freq_block_t;
+
+typedef struct freq_table {
+    freq_entry_t *slots;
+    size_t        nslots;       //power of 2
+    size_t        used;
+    freq_block_t *arena;        //block being filled, older ones behind it
+    size_t        arena_bytes;
+    long long     total;
+    long long     untracked;
+} freq_table_t;
+
+static uint32_t freq_hash(const char *word, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;     //FNV-1a
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)word[i]) * 0x100000001b3ULL;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static size_t freq_mem(const freq_table_t *t) {
+    return t->nslots * sizeof(freq_entry_t) + t->arena_bytes;
+}
+
+static int freq_init(freq_table_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->slots = calloc(FREQ_INIT_SLOTS, sizeof(freq_entry_t));
+    if (t->slots == NULL) {
+        return -1;
+    }
+    t->nslots = FREQ_INIT_SLOTS;
+    return 0;
+}
+
+static void freq_free(freq_table_t *t) {
+    while (t->arena != NULL) {
+        freq_block_t *next = t->arena->next;
+        free(t->arena);
+        t->arena = next;
+    }
+    free(t->slots);
+}
+
+//copies word into the arena behind a count of 1, padded so the next
+//count is aligned
+static char *freq_intern(freq_table_t *t, const char *word, size_t len) {
+    freq_block_t *b = t->arena;
+    size_t need = (sizeof(long long) + len + 7) & ~(size_t)7;
+
+    if (b == NULL || b->size - b->used < need) {
+        size_t size = need > FREQ_ARENA_BLOCK ? need : FREQ_ARENA_BLOCK;
+
+        b = malloc(sizeof(freq_block_t) + size);
+        if (b == NULL) {
+            return NULL;
+        }
+        b->next = t->arena;
+        b->used = 0;
+        b->size = size;
+        t->arena = b;
+        t->arena_bytes += sizeof(freq_block_t) + size;
+    }
+
+    char *rec = b->data + b->used;
+    *(long long *)rec = 1;
+    memcpy(rec + sizeof(long long), word, len);
+    b->used += need;
+    return rec;
+}
+
+static int freq_grow(freq_table_t *t) {
+    size_t nslots = t->nslots * 2;
+    freq_entry_t *slots = calloc(nslots, sizeof(freq_entry_t));
+
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < t->nslots; i++) {
+        if (t->slots[i].rec == NULL) {
+            continue;
+        }
+        size_t j = t->slots[i].hash & (nslots - 1);
+        while (slots[j].rec != NULL) {
+            j = (j + 1) & (nslots - 1);
+        }
+        slots[j] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->nslots = nslots;
+    return 0;
+}
+
+//counts one occurrence of word, returns -1 if memory ran out
+static int freq_add(freq_table_t *t, const char *word, size_t len) {
+    uint32_t h = freq_hash(word, len);
+    size_t i = h & (t->nslots - 1);
+
+    t->total++;
+    for (; t->slots[i].rec != NULL; i = (i + 1) & (t->nslots - 1)) {
+        freq_entry_t *e = &t->slots[i];
+        if (e->hash == h && e->len == len && memcmp(FREQ_WORD(e), word, len) == 0) {
+            FREQ_COUNT(e)++;
+            return 0;
+        }
+    }
+
+    //a new word, keep the load under 3/4
+    int full = (t->used + 1) * 4 > t->nslots * 3;
+    size_t need = len + (full ? t->nslots * sizeof(freq_entry_t) * 2 : 0);
+    if (len > UINT32_MAX || freq_mem(t) + need > FREQ_MEM_LIMIT) {
+        t->untracked++;
+        return 0;
+    }
+    if (full) {
+        if (freq_grow(t) != 0) {
+            return -1;
+        }
+        for (i = h & (t->nslots - 1); t->slots[i].rec != NULL;
+             i = (i + 1) & (t->nslots - 1)) {
+        }
+    }
+
+    char *rec = freq_intern(t, word, len);
+    if (rec == NULL) {
+        return -1;
+    }
+    t->slots[i] = (freq_entry_t){ rec, h, (uint32_t)len };
+    t->used++;
+    return 0;
+}
+
+//more frequent first, ties in byte order so the output is stable
+static int freq_cmp(const freq_entry_t *a, const freq_entry_t *b) {
+    if (FREQ_COUNT(a) != FREQ_COUNT(b)) {
+        return FREQ_COUNT(a) > FREQ_COUNT(b) ? -1 : 1;
+    }
+
+    size_t n = a->len < b->len ? a->len : b->len;
+    int rc = memcmp(FREQ_WORD(a), FREQ_WORD(b), n);
+    if (rc != 0) {
+        return rc;
+    }
+    return a->len < b->len ? -1 : (a->len > b->len);
+}
+
+static int freq_qsort_cmp(const void *a, const void *b) {
+    return freq_cmp(*(freq_entry_t * const *)a, *(freq_entry_t * const *)b);
+}
+
+//heap[0] is the entry that ranks last, the first to be pushed out
+static void freq_sift_down(freq_entry_t **heap, int n, int i) {
+    for (;;) {
+        int worst = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+
+        if (l < n && freq_cmp(heap[l], heap[worst]) > 0) {
+            worst = l;
+        }
+        if (r < n && freq_cmp(heap[r], heap[worst]) > 0) {
+            worst = r;
+        }
+        if (worst == i) {
+            return;
+        }
+        freq_entry_t *tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+//fills top with the n most frequent entries in rank order, returns how
+//many there are
+static int freq_top(freq_table_t *t, freq_entry_t **top, int n) {
+    int count = 0;
+
+    for (size_t i = 0; i < t->nslots; i++) {
+        freq_entry_t *e = &t->slots[i];
+
+        if (e->rec == NULL) {
+            continue;
+        }
+        if (count < n) {
+            //sift up
+            int j = count++;
+            top[j] = e;
+            while (j > 0 && freq_cmp(top[j], top[(j - 1) / 2]) > 0) {
+                freq_entry_t *tmp = top[j];
+                top[j] = top[(j - 1) / 2];
+                top[(j - 1) / 2] = tmp;
+                j = (j - 1) / 2;
+            }
+        } else if (freq_cmp(e, top[0]) < 0) {
+            top[0] = e;
+            freq_sift_down(top, count, 0);
+        }
+    }
+
+    qsort(top, count, sizeof(top[0]), freq_qsort_cmp);
+    return count;
+}
+
+//reads fd in chunks, a word cut by the end of a chunk is gathered in
+//*pend before it is counted.  *pend only grows into what is left of
+//FREQ_MEM_LIMIT; a word longer than that could never be stored anyway, so
+//it is counted as untracked and the rest of it skipped
+static int freq_scan(freq_table_t *t, int fd, char *chunk, int len,
+                     char **pend, size_t *pend_cap) {
+    size_t pend_len = 0;
+    int pend_over = 0;      //the pending word outgrew the limit
+    ssize_t n;
+
+    while ((n = read(fd, chunk, len)) > 0) {
+        ssize_t start = 0;
+
+        for (ssize_t i = 0; i <= n; i++) {
+            if (i < n && !is_word_sep(chunk[i])) {
+                continue;
+            }
+
+            size_t piece = i - start;
+            if (i == n || pend_len > 0 || pend_over) {
+                //gather the piece, the word may go on in the next chunk
+                size_t mem = freq_mem(t);
+                size_t room = mem < FREQ_MEM_LIMIT ? FREQ_MEM_LIMIT - mem : 0;
+                if (!pend_over && pend_len + piece > room) {
+                    pend_over = 1;
+                    pend_len = 0;
+                }
+                if (!pend_over && pend_len + piece > *pend_cap) {
+                    size_t cap = (pend_len + piece) * 2;
+                    char *grown = realloc(*pend, cap < room ? cap : room);
+                    if (grown == NULL) {
+                        return -1;
+                    }
+                    *pend = grown;
+                    *pend_cap = cap < room ? cap : room;
+                }
+                if (!pend_over) {
+                    memcpy(*pend + pend_len, chunk + start, piece);
+                    pend_len += piece;
+                }
+                if (i == n) {
+                    break;
+                }
+                if (pend_over) {
+                    t->total++;
+                    t->untracked++;
+                    pend_over = 0;
+                } else if (freq_add(t, *pend, pend_len) != 0) {
+                    return -1;
+                }
+                pend_len = 0;
+            } else if (piece > 0 && freq_add(t, chunk + start, piece) != 0) {
+                return -1;
+            }
+            start = i + 1;
+        }
+    }
+    if (n < 0) {
+        return -1;
+    }
+    if (pend_over) {
+        t->total++;
+        t->untracked++;
+    } else if (pend_len > 0 && freq_add(t, *pend, pend_len) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+//runs -F, returns the exit code
+int freq_main(char *path, int top_n) {
+    freq_table_t t;
+    char *pend = NULL;
+    size_t pend_cap = 0;
+
+    int fd = stream_open(path);
+    if (fd < 0) {
+        printf("Error: could not open %s\n", path);
+        return 2;
+    }
+
+    char *chunk = malloc(STREAM_CHUNK);
+    freq_entry_t **top = malloc(top_n * sizeof(freq_entry_t *));
+    if (chunk == NULL || top == NULL || freq_init(&t) != 0) {
+        printf("Error: Memory Allocation Failed.\n");
+        return 99;
+    }
+
+    int rc = freq_scan(&t, fd, chunk, STREAM_CHUNK, &pend, &pend_cap);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (rc != 0) {
+        printf("Error reading %s\n", path);
+        return 2;
+    }
+
+    int n = freq_top(&t, top, top_n);
+    printf("Word Frequency\n");
+    printf("--------------\n");
+    for (int i = 0; i < n; i++) {
+        printf("%d. %.*s: %lld\n", i + 1, (int)top[i]->len, FREQ_WORD(top[i]), FREQ_COUNT(top[i]));
+    }
+
+    printf("\nWords: %lld, distinct: %zu", t.total, t.used);
+    if (t.untracked > 0) {
+        printf(", untracked: %lld (memory limit reached, counts may be incomplete)",
+               t.untracked);
+    }
+    printf("\nMemory: %.1f MB (table %zu slots %.1f MB, arena %.1f MB, limit %lld MB)\n",
+           (freq_mem(&t) + pend_cap) / 1048576.0, t.nslots,
+           t.nslots * sizeof(freq_entry_t) / 1048576.0,
+           t.arena_bytes / 1048576.0, FREQ_MEM_LIMIT >> 20);
+
+    freq_free(&t);
+    free(pend);
+    free(top);
+    free(chunk);
+    return 0;
+}
+
+
+//PARALLEL COUNT
+//
+//-P maps the file and gives each thread one slice of it to count with
+//sf_count_words().  A word cut in two by a slice boundary must only be
+//counted once, so each slice starts with in_word set from the last byte
+//of the slice before it: the part of the word after the cut is then not a
+//word start, and the total matches a single threaded count exactly.
+
+typedef struct par_slice {
+    const char *start;
+    size_t      len;
+    int         in_word;    //is the byte before start inside a word
+    long long   count;
+} par_slice_t;
+
+static void *par_count_slice(void *arg) {
+    par_slice_t *slice = arg;
+
+    slice->count = sf_count_words(slice->start, slice->len, SF_SEP_WS, &slice->in_word);
+    return NULL;
 }
 
+static int par_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
 
+    return n < 1 ? 1 : (n > PAR_MAX_THREADS ? PAR_MAX_THREADS : (int)n);
+}
+
+static double par_now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+//counts the words in p[0..n) with up to threads threads, a slice that
+//can not get a thread is counted on the calling one
+long long par_count_words(const char *p, size_t n, int threads) {
+    par_slice_t slices[PAR_MAX_THREADS];
+    pthread_t tids[PAR_MAX_THREADS];
+    int started[PAR_MAX_THREADS];
+    long long count = 0;
+
+    if (threads > PAR_MAX_THREADS) {
+        threads = PAR_MAX_THREADS;
+    }
+    if ((size_t)threads > n / PAR_MIN_SLICE) {
+        threads = n / PAR_MIN_SLICE;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    sf_count_words(p, 0, SF_SEP_WS, &(int){0});    //pick the kernel before the threads do
+
+    size_t per = n / threads;
+    for (int t = 0; t < threads; t++) {
+        size_t off = per * t;
+
+        slices[t].start = p + off;
+        slices[t].len = t == threads - 1 ? n - off : per;
+        slices[t].in_word = off > 0 && !is_word_sep(p[off - 1]);
+        started[t] = t > 0 &&
+            pthread_create(&tids[t], NULL, par_count_slice, &slices[t]) == 0;
+    }
+
+    for (int t = 0; t < threads; t++) {
+        if (started[t]) {
+            pthread_join(tids[t], NULL);
+        } else {
+            par_count_slice(&slices[t]);
+        }
+        count += slices[t].count;
+    }
+    return count;
+}
 
+//runs -P or -S, returns the exit code.  Input that can not be mapped,
+//like stdin, falls back to the streaming count.
+int par_main(char opt, char *path, int threads) {
+    struct stat st;
+    int fd = stream_open(path);
+
+    if (fd < 0) {
+        printf("Error: could not open %s\n", path);
+        return 2;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return stream_main('C', 0, path, NULL, NULL);
+    }
+    if (threads < 1) {
+        threads = par_default_threads();
+    }
+
+    size_t n = st.st_size;
+    char *p = mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return stream_main('C', 0, path, NULL, NULL);
+    }
+    madvise(p, n, MADV_SEQUENTIAL);
+
+    if (opt == 'P') {
+        printf("Word Count: %lld\n", par_count_words(p, n, threads));
+        munmap(p, n);
+        return 0;
+    }
+
+    //scaling report: 1, 2, 4, ... threads up to the maximum, after one
+    //untimed run so every run sees the file already mapped in
+    long long words = par_count_words(p, n, threads);
+    double base = 0;
+
+    printf("Scaling report for %s (%zu bytes, %lld words, %d cpu)\n",
+           path, n, words, par_default_threads());
+    printf("%-8s %10s %10s %8s\n", "Threads", "Time(ms)", "MB/s", "Speedup");
+    for (int t = 1; ; t = t * 2 > threads && t < threads ? threads : t * 2) {
+        double start = par_now_ms();
+        long long got = par_count_words(p, n, t);
+        double ms = par_now_ms() - start;
+
+        if (t == 1) {
+            base = ms;
+        }
+        printf("%-8d %10.1f %10.0f %7.2fx%s\n", t, ms, n / 1e3 / ms,
+               base / ms, got == words ? "" : "  MISMATCH");
+        if (t >= threads) {
+            break;
+        }
+    }
+
+    munmap(p, n);
+    return 0;
+}
+
+
+//bench/sfbench.c includes this file to get at the kernels, without main()
+#ifndef STRINGFUN_NO_MAIN
 int main(int argc, char *argv[]){
 
     char *buff;             //placehoder for the internal buffer
@@ -141,6 +1019,8 @@ int main(int argc, char *argv[]){
     char opt;               //used to capture user option from cmd line
     int  rc;                //used for return codes
     int  user_str_len;      //length of user supplied string
+    int  buff_len = BUFFER_SZ;  //grows if -x makes the string longer
+    int  utf8;              //set by a u after the option, as in -ru
 
     //TODO:  #1. WHY IS THIS SAFE, aka what if arv[1] does not exist?
     //      This is safe because the way that the conditional is that it first
@@ -155,6 +1035,7 @@ int main(int argc, char *argv[]){
     }
 
     opt = (char)*(argv[1]+1);   //get the option flag
+    utf8 = opt != '\0' && *(argv[1]+2) == 'u';
 
     //handle the help flag and then exit normally
     if (opt == 'h'){
@@ -178,6 +1059,30 @@ int main(int argc, char *argv[]){
 
     input_string = argv[2]; //capture the user input string
 
+    //the streaming modes take a file instead of a string and do not use
+    //the fixed size buffer at all
+    if (opt == 'C' || opt == 'R' || opt == 'W'){
+        exit(stream_main(opt, utf8, input_string, NULL, NULL));
+    }
+    if (opt == 'X'){
+        if (argc != 5 || *argv[3] == '\0') {
+            usage(argv[0]);
+            exit(1);
+        }
+        exit(stream_main(opt, 0, input_string, argv[3], argv[4]));
+    }
+    if (opt == 'F'){
+        int top_n = argc > 3 ? atoi(argv[3]) : FREQ_DEFAULT_TOP;
+        if (top_n < 1) {
+            usage(argv[0]);
+            exit(1);
+        }
+        exit(freq_main(input_string, top_n));
+    }
+    if (opt == 'P' || opt == 'S'){
+        exit(par_main(opt, input_string, argc > 3 ? atoi(argv[3]) : 0));
+    }
+
     //TODO:  #3 Allocate space for the buffer using malloc and
     //          handle error if malloc fails by exiting with a 
     //          return code of 99
@@ -199,6 +1104,11 @@ int main(int argc, char *argv[]){
         exit(2);
     }
 
+    if (utf8 && !sf_utf8_valid(buff, user_str_len)){
+        printf("Error: input is not valid UTF-8\n");
+        exit(2);
+    }
+
     switch (opt){
         case 'c':
             rc = count_words(buff, BUFFER_SZ, user_str_len);  //you need to implement
@@ -213,20 +1123,32 @@ int main(int argc, char *argv[]){
         //       the case statement options
 
         case 'r':
-            reverse_string(buff, user_str_len); 
+            if (utf8) {
+                reverse_string_utf8(buff, user_str_len);
+            } else {
+                reverse_string(buff, user_str_len); 
+            }
             break;
 
         case 'w':
-            print_words(buff, BUFFER_SZ, user_str_len);
+            if (utf8) {
+                print_words_utf8(buff, BUFFER_SZ, user_str_len);
+            } else {
+                print_words(buff, BUFFER_SZ, user_str_len);
+            }
             break;
 
         case 'x':
-            if (argc != 5) { 
+            if (argc != 5 || *argv[3] == '\0') { 
                 usage(argv[0]);
                 exit(1);
             }
-            printf("Not Implemented!\n");
-            exit(3); 
+            buff_len = replace_words(&buff, BUFFER_SZ, user_str_len, argv[3], argv[4]);
+            if (buff_len < 0){
+                printf("Error replacing string, rc = %d", buff_len);
+                exit(2);
+            }
+            break;
 
 
                 default:
@@ -235,10 +1157,11 @@ int main(int argc, char *argv[]){
             }
 
         //TODO:  #6 Dont forget to free your buffer before exiting
-        print_buff(buff,BUFFER_SZ);
+        print_buff(buff,buff_len);
         free(buff);
         exit(0);
 }
+#endif
 
 //TODO:  #7  Notice all of the helper functions provided in the 
 //          starter take both the buffer as well as the length.  Why
@@ -0,0 +1,104 @@
+#!/usr/bin/env bats
+
+# The UTF-8 modes are checked with the scalar validator and with the
+# vector one the CPU picks by default, both must reject the same input.
+LEVELS="scalar default"
+
+# run stringfun with the SIMD level capped, "default" leaves it alone
+run_level() {
+    local level=$1
+    shift
+    if [ "$level" = "default" ]; then
+        run env -u STRINGFUN_SIMD ./stringfun "$@"
+    else
+        run env STRINGFUN_SIMD="$level" ./stringfun "$@"
+    fi
+}
+
+# invalid sequences: overlong '/' in two and three bytes, a surrogate,
+# U+110000, a lead byte that can not start anything, a stray continuation
+# byte and a character cut short at the end of the text
+INVALID=$'\xc0\xaf \xe0\x80\xaf \xed\xa0\x80 \xf4\x90\x80\x80 \xf5\x80\x80\x80 \x80 \xe2\x82'
+
+@test "Valid UTF-8 is accepted by -Cu and -ru" {
+    tmp="$(mktemp)"
+    printf 'h\303\251llo w\303\266rld \360\237\230\200\n' > "$tmp"
+    for level in $LEVELS; do
+        run_level $level -Cu "$tmp"
+        [ "$status" -eq 0 ]
+        [ "${lines[0]}" = "Word Count: 3" ] || {
+            echo "$level: $output"
+            return 1
+        }
+
+        run_level $level -ru "$(printf 'h\303\251llo\360\237\230\200')"
+        [ "$status" -eq 0 ]
+        [[ "${lines[0]}" == "Buffer:  [$(printf '\360\237\230\200oll\303\251h').."* ]] || {
+            echo "$level: $output"
+            return 1
+        }
+    done
+    rm -f "$tmp"
+}
+
+@test "Invalid UTF-8 is rejected by -Cu" {
+    tmp="$(mktemp)"
+    for seq in $INVALID; do
+        # 15 bytes first, so the sequence also crosses a 16 byte block
+        for prefix in "" "abcdefghijklmno"; do
+            printf '%s%s' "$prefix" "$seq" > "$tmp"
+            for level in $LEVELS; do
+                run_level $level -Cu "$tmp"
+                [ "$status" -eq 2 ]
+                [ "${lines[0]}" = "Error: $tmp is not valid UTF-8" ] || {
+                    echo "$level $(printf '%s' "$seq" | od -An -tx1): $output"
+                    return 1
+                }
+            done
+        done
+    done
+    rm -f "$tmp"
+}
+
+@test "Invalid UTF-8 is rejected by -ru" {
+    for seq in $INVALID; do
+        for prefix in "" "abcdefghijklmno"; do
+            for level in $LEVELS; do
+                run_level $level -ru "$prefix$seq"
+                [ "$status" -eq 2 ]
+                [ "${lines[0]}" = "Error: input is not valid UTF-8" ] || {
+                    echo "$level $(printf '%s' "$seq" | od -An -tx1): $output"
+                    return 1
+                }
+            done
+        done
+    done
+}
+
+@test "A character split by the -Cu read chunk" {
+    tmp="$(mktemp)"
+    # 1 MB reads, the last byte of the first one starts a 2 byte character
+    head -c $(( (1 << 20) - 1 )) /dev/zero | tr '\0' a > "$tmp"
+    printf '\303\251 b\n' >> "$tmp"
+    for level in $LEVELS; do
+        run_level $level -Cu "$tmp"
+        [ "$status" -eq 0 ]
+        [ "${lines[0]}" = "Word Count: 2" ] || {
+            echo "$level: $output"
+            return 1
+        }
+    done
+
+    # the same lead byte, but the next read starts with ASCII
+    head -c $(( (1 << 20) - 1 )) /dev/zero | tr '\0' a > "$tmp"
+    printf '\303 b\n' >> "$tmp"
+    for level in $LEVELS; do
+        run_level $level -Cu "$tmp"
+        [ "$status" -eq 2 ]
+        [ "${lines[0]}" = "Error: $tmp is not valid UTF-8" ] || {
+            echo "$level: $output"
+            return 1
+        }
+    done
+    rm -f "$tmp"
+}
@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+
+// database include files
+#include "../db.h"
+#include "../sdbsc.h"
+#include "../sdbshard.h"
+#include "../sdbstats.h"
+#include "../sdbcache.h"
+#include "../sdblsm.h"
+
+/*
+ *  sdbbench - synthetic workload generator for the sdbsc storage engine
+ *
+ *  Builds a database with a configurable fraction of the id space
+ *  1..MAX_STD_ID populated, then runs a mix of reads (get_student),
+ *  writes (add_student), deletes (del_student) and scans (print_db) with
+ *  uniform or zipfian id selection.  The engine functions are called
+ *  directly, so the numbers measure the storage code and not process
+ *  startup.  Latencies come from the sdbstats histograms.
+ *
+ *  The engine functions print their normal messages, so stdout is sent to
+ *  /dev/null while the workload runs and restored for the report.
+ *
+ *  With -L the database is built in FILE.lsm and the workload runs on the
+ *  LSM engine (lsm_get_student() and friends) instead, the building
+ *  batched the way sdbsc -l does it.  A write only mix (-m 0:100:0:0)
+ *  compares the two engines on ingest.
+ *
+ *  With -c the workload is replaced by a page cache footprint report:
+ *  scans, exports and point lookups are each run from a cold cache with
+ *  the sdbcache hints off and on, and mincore() tells how much of the
+ *  database they left resident.
+ */
+
+#define BENCH_DEF_FILE      "bench_student.db"
+#define BENCH_DEF_OPS       20000
+#define BENCH_DEF_DENSITY   0.10
+#define BENCH_DEF_MIX       "80:10:9:1"
+
+#define OP_READ     0
+#define OP_WRITE    1
+#define OP_DELETE   2
+#define OP_SCAN     3
+#define OP_TYPES    4
+
+static const char *op_names[OP_TYPES] = {
+    "get_student", "add_student", "del_student", "print_db"
+};
+
+typedef struct bench_args{
+    char   *file;
+    double  density;
+    long    ops;
+    int     mix[OP_TYPES];      //percent of ops of each type
+    double  theta;              //0 means uniform, else zipfian skew
+    uint64_t seed;
+    int     shards;             //>1 benchmarks the sharded layout
+    bool    lsm;                //the LSM engine instead of the shards
+    bool    json;
+    bool    cache;              //page cache footprint report instead
+} bench_args_t;
+
+//xorshift64* - small, fast and good enough for picking ids
+static uint64_t rng_state;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static double rng_unit(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ *  Zipfian id generator from Gray et al. "Quickly Generating Billion-Record
+ *  Synthetic Databases" (the same one YCSB uses).  Rank 0 is the hottest.
+ *  Ranks are scrambled into ids with a multiplication that is a bijection
+ *  mod MAX_STD_ID so the hot records are spread through the file instead
+ *  of all sitting at the front of it.
+ */
+typedef struct zipf{
+    long   n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} zipf_t;
+
+static double zeta(long n, double theta)
+{
+    double sum = 0;
+
+    for (long i = 1; i <= n; i++)
+        sum += 1.0 / pow((double)i, theta);
+    return sum;
+}
+
+static void zipf_init(zipf_t *z, long n, double theta)
+{
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = zeta(n, theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / z->zetan);
+}
+
+static long zipf_next(zipf_t *z)
+{
+    double u = rng_unit();
+    double uz = u * z->zetan;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+        return 1;
+    return (long)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+}
+
+static int pick_id(zipf_t *z)
+{
+    long rank;
+
+    if (z == NULL)
+        rank = (long)(rng_next() % MAX_STD_ID);
+    else
+        rank = zipf_next(z) % MAX_STD_ID;
+
+    return (int)((rank * 2654435761ull) % MAX_STD_ID) + MIN_STD_ID;
+}
+
+/*
+ *  build_db
+ *      map:      open, truncated database
+ *      density:  fraction of MIN_STD_ID..MAX_STD_ID to populate
+ *
+ *  Writes records straight to their slots with pwrite().  The ids are
+ *  chosen with a fixed stride pattern so the layout is reproducible,
+ *  untouched slots stay holes just like they would with sdbsc -a.
+ *
+ *  returns:  number of records written, or ERR_DB_FILE
+ */
+static int build_db(shard_map_t *map, double density)
+{
+    student_t s = EMPTY_STUDENT_RECORD;
+    int written = 0;
+    double acc = 0;
+
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID; id++) {
+        acc += density;
+        if (acc < 1.0)
+            continue;
+        acc -= 1.0;
+
+        s.id = id;
+        snprintf(s.fname, sizeof(s.fname), "first%d", id);
+        snprintf(s.lname, sizeof(s.lname), "last%d", id);
+        s.gpa = id % (MAX_STD_GPA + 1);
+        if (pwrite(shard_fd(map, id), &s, sizeof(s), (off_t)id * sizeof(s)) != sizeof(s))
+            return ERR_DB_FILE;
+        written++;
+    }
+    return written;
+}
+
+/*
+ *  build_lsm
+ *      db:       open, truncated LSM database
+ *      density:  fraction of MIN_STD_ID..MAX_STD_ID to populate
+ *
+ *  build_db() for the LSM engine, the same records appended to the log
+ *  LSM_WAL_BATCH at a time like a bulk load.
+ *
+ *  returns:  number of records written, or ERR_DB_FILE
+ */
+static int build_lsm(lsm_db_t *db, double density)
+{
+    student_t s = EMPTY_STUDENT_RECORD;
+    int written = 0;
+    double acc = 0;
+
+    db->batching = true;
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID; id++) {
+        acc += density;
+        if (acc < 1.0)
+            continue;
+        acc -= 1.0;
+
+        s.id = id;
+        snprintf(s.fname, sizeof(s.fname), "first%d", id);
+        snprintf(s.lname, sizeof(s.lname), "last%d", id);
+        s.gpa = id % (MAX_STD_GPA + 1);
+        if (lsm_put_student(db, &s) != NO_ERROR)
+            return ERR_DB_FILE;
+        written++;
+    }
+    db->batching = false;
+    return lsm_sync_wal(db) == NO_ERROR ? written : ERR_DB_FILE;
+}
+
+/*
+ *  remove_shards
+ *      dir:  sharded database directory left over from an earlier run
+ *
+ *  The benchmark always starts from a fresh database, and a leftover shard
+ *  directory with a different shard count would be refused by
+ *  shard_open_db(), so it is removed first.
+ */
+static void remove_shards(const char *dir)
+{
+    char path[512];
+
+    for (int i = 0; i < SHARD_MAX; i++) {
+        snprintf(path, sizeof(path), SHARD_FILE_FMT, dir, i);
+        if (unlink(path) != 0)
+            break;
+    }
+    rmdir(dir);
+}
+
+static int parse_mix(const char *str, int mix[OP_TYPES])
+{
+    int total = 0;
+
+    if (sscanf(str, "%d:%d:%d:%d", &mix[0], &mix[1], &mix[2], &mix[3]) != OP_TYPES)
+        return -1;
+    for (int i = 0; i < OP_TYPES; i++) {
+        if (mix[i] < 0)
+            return -1;
+        total += mix[i];
+    }
+    return total == 100 ? 0 : -1;
+}
+
+static void bench_usage(const char *progname)
+{
+    printf("Usage: %s [-f FILE] [-d DENSITY] [-n OPS] [-m R:W:D:S] [-z THETA] [-s SEED] [-S SHARDS] [-L] [-c] [-j]\n", progname);
+    printf("  -f FILE     database file to create (default %s)\n", BENCH_DEF_FILE);
+    printf("  -d DENSITY  fraction of ids %d..%d populated, 0 < d <= 1 (default %.2f)\n",
+           MIN_STD_ID, MAX_STD_ID, BENCH_DEF_DENSITY);
+    printf("  -n OPS      number of operations to run (default %d)\n", BENCH_DEF_OPS);
+    printf("  -m R:W:D:S  percent read/write/delete/scan, sums to 100 (default %s)\n", BENCH_DEF_MIX);
+    printf("  -z THETA    zipfian skew 0 < theta < 1, 0 for uniform ids (default 0)\n");
+    printf("  -s SEED     random seed\n");
+    printf("  -S SHARDS   split the database over SHARDS files in FILE.d (default 1)\n");
+    printf("  -L          use the LSM engine, in FILE.lsm (not with -S or -c)\n");
+    printf("  -c          report page cache footprint with and without hints\n");
+    printf("  -j          print the results as JSON\n");
+    exit(EXIT_FAIL_ARGS);
+}
+
+static void parse_args(int argc, char *argv[], bench_args_t *args)
+{
+    int opt;
+
+    memset(args, 0, sizeof(*args));
+    args->file = BENCH_DEF_FILE;
+    args->density = BENCH_DEF_DENSITY;
+    args->ops = BENCH_DEF_OPS;
+    args->seed = 0x5db5c;
+    args->shards = 1;
+    parse_mix(BENCH_DEF_MIX, args->mix);
+
+    while ((opt = getopt(argc, argv, "f:d:n:m:z:s:S:Lcjh")) != -1) {
+        switch (opt) {
+            case 'f':
+                args->file = optarg;
+                break;
+            case 'd':
+                args->density = atof(optarg);
+                if (args->density <= 0 || args->density > 1)
+                    bench_usage(argv[0]);
+                break;
+            case 'n':
+                args->ops = atol(optarg);
+                if (args->ops <= 0)
+                    bench_usage(argv[0]);
+                break;
+            case 'm':
+                if (parse_mix(optarg, args->mix) < 0)
+                    bench_usage(argv[0]);
+                break;
+            case 'z':
+                args->theta = atof(optarg);
+                if (args->theta < 0 || args->theta >= 1)
+                    bench_usage(argv[0]);
+                break;
+            case 's':
+                args->seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'S':
+                args->shards = atoi(optarg);
+                if (args->shards < 1 || args->shards > SHARD_MAX)
+                    bench_usage(argv[0]);
+                break;
+            case 'L':
+                args->lsm = true;
+                break;
+            case 'c':
+                args->cache = true;
+                break;
+            case 'j':
+                args->json = true;
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if (args->lsm && (args->shards > 1 || args->cache))
+        bench_usage(argv[0]);
+    if (args->seed == 0)
+        args->seed = 1;
+}
+
+static void print_report(bench_args_t *args, int records, long counts[OP_TYPES],
+                         uint64_t elapsed_ns)
+{
+    double secs = elapsed_ns / 1e9;
+
+    if (args->json) {
+        printf("{\"engine\":\"%s\",\"shards\":%d,\"density\":%.4f,\"records\":%d,\"dist\":\"%s\",\"theta\":%.2f,"
+               "\"ops\":%ld,\"elapsed_ns\":%llu,\"ops_per_sec\":%.1f,\"by_op\":[",
+               args->lsm ? "lsm" : "file", args->shards, args->density, records,
+               args->theta > 0 ? "zipfian" : "uniform",
+               args->theta, args->ops, (unsigned long long)elapsed_ns, args->ops / secs);
+        for (int i = 0, first = 1; i < OP_TYPES; i++) {
+            const op_stats_t *st = stats_lookup(op_names[i]);
+            if (st == NULL)
+                continue;
+            printf("%s{\"op\":\"%s\",\"count\":%ld,\"ops_per_sec\":%.1f,"
+                   "\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}",
+                   first ? "" : ",", op_names[i], counts[i],
+                   st->total_ns ? st->calls / (st->total_ns / 1e9) : 0.0,
+                   (unsigned long long)stats_percentile(st, 50.0),
+                   (unsigned long long)stats_percentile(st, 99.0),
+                   (unsigned long long)st->max_ns);
+            first = 0;
+        }
+        printf("]}\n");
+        return;
+    }
+
+    printf("%s, shards %d, density %.4f (%d records), %s ids (theta %.2f), %ld ops in %.3fs = %.1f ops/sec\n",
+           args->lsm ? "lsm" : "file", args->shards, args->density, records, args->theta > 0 ? "zipfian" : "uniform",
+           args->theta, args->ops, secs, args->ops / secs);
+    printf("%-12s %8s %12s %12s %12s %12s\n",
+           "OP", "COUNT", "OPS/SEC", "P50_NS", "P99_NS", "MAX_NS");
+    for (int i = 0; i < OP_TYPES; i++) {
+        const op_stats_t *st = stats_lookup(op_names[i]);
+        if (st == NULL)
+            continue;
+        printf("%-12s %8ld %12.1f %12llu %12llu %12llu\n",
+               op_names[i], counts[i],
+               st->total_ns ? st->calls / (st->total_ns / 1e9) : 0.0,
+               (unsigned long long)stats_percentile(st, 50.0),
+               (unsigned long long)stats_percentile(st, 99.0),
+               (unsigned long long)st->max_ns);
+    }
+}
+
+/*
+ *  quiet_begin / quiet_end
+ *
+ *  The engine reports every operation on stdout, send it to /dev/null
+ *  while something is being measured.
+ */
+static int quiet_begin(void)
+{
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || devnull < 0) {
+        perror("bench stdout");
+        exit(EXIT_FAIL_DB);
+    }
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    return saved_stdout;
+}
+
+static void quiet_end(int saved_stdout)
+{
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+#define CACHE_TEST_SCAN     0
+#define CACHE_TEST_EXPORT   1
+#define CACHE_TEST_LOOKUP   2
+
+static const char *cache_test_names[] = { "print_db", "export_db", "get_student" };
+
+/*
+ *  cache_run
+ *      map:     benchmark database
+ *      args:    benchmark options
+ *      test:    CACHE_TEST_*
+ *      policy:  0 no hints, 1 hints, 2 hints and O_DIRECT (export only)
+ *
+ *  Evicts the database from the page cache, runs the test and prints how
+ *  long it took and how much of the database is resident afterwards.
+ */
+static void cache_run(shard_map_t *map, bench_args_t *args, int test, int policy)
+{
+    static const char *policy_names[] = { "none", "hints", "direct" };
+    static bool first = true;
+    char export_file[300];
+    long resident = 0;
+    long pages = 0;
+    student_t student;
+
+    cache_set_hints(policy > 0);
+    for (int i = 0; i < map->nshards; i++)
+        cache_evict(map->fds[i]);
+    snprintf(export_file, sizeof(export_file), "%s.export", args->file);
+
+    int saved_stdout = quiet_begin();
+    uint64_t start = stats_now_ns();
+    switch (test) {
+        case CACHE_TEST_SCAN:
+            shard_print_db(map);
+            break;
+        case CACHE_TEST_EXPORT:
+            shard_export_db(map, export_file, policy == 2);
+            break;
+        case CACHE_TEST_LOOKUP:
+            for (int i = 0; i < map->nshards; i++)
+                cache_point_lookups(map->fds[i]);
+            for (long i = 0; i < args->ops; i++) {
+                int id = pick_id(NULL);
+                get_student(shard_fd(map, id), id, &student);
+            }
+            break;
+    }
+    uint64_t elapsed = stats_now_ns() - start;
+    quiet_end(saved_stdout);
+    unlink(export_file);
+
+    for (int i = 0; i < map->nshards; i++) {
+        long total;
+        long r = cache_resident_pages(map->fds[i], 0, 0, &total);
+        resident += r > 0 ? r : 0;
+        pages += total;
+    }
+
+    long kb = sysconf(_SC_PAGESIZE) / 1024;
+    if (args->json) {
+        printf("%s{\"test\":\"%s\",\"policy\":\"%s\",\"elapsed_ns\":%llu,"
+               "\"resident_kb\":%ld,\"db_kb\":%ld}",
+               first ? "[" : ",", cache_test_names[test], policy_names[policy],
+               (unsigned long long)elapsed, resident * kb, pages * kb);
+    } else {
+        if (first)
+            printf("%-12s %-8s %10s %12s %12s\n", "TEST", "HINTS", "MS", "RESIDENT_KB", "DB_KB");
+        printf("%-12s %-8s %10.2f %12ld %12ld\n", cache_test_names[test],
+               policy_names[policy], elapsed / 1e6, resident * kb, pages * kb);
+    }
+    first = false;
+}
+
+static void cache_report(shard_map_t *map, bench_args_t *args)
+{
+    for (int policy = 0; policy < 2; policy++)
+        cache_run(map, args, CACHE_TEST_SCAN, policy);
+    for (int policy = 0; policy < 3; policy++)
+        cache_run(map, args, CACHE_TEST_EXPORT, policy);
+    for (int policy = 0; policy < 2; policy++)
+        cache_run(map, args, CACHE_TEST_LOOKUP, policy);
+    if (args->json)
+        printf("]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bench_args_t args;
+    zipf_t zipf;
+    zipf_t *zp = NULL;
+    shard_map_t map;
+    lsm_db_t *lsm = NULL;
+    char shard_dir[256];
+    char lsm_dir[256];
+    long counts[OP_TYPES] = {0};
+    student_t student;
+
+    parse_args(argc, argv, &args);
+    rng_state = args.seed;
+    if (args.theta > 0) {
+        zipf_init(&zipf, MAX_STD_ID, args.theta);
+        zp = &zipf;
+    }
+
+    // the shard map falls back to the single file when SDB_SHARDS is 1
+    char shards[16];
+    snprintf(shards, sizeof(shards), "%d", args.shards);
+    setenv(SHARD_ENV, shards, 1);
+    snprintf(shard_dir, sizeof(shard_dir), "%s.d", args.file);
+    remove_shards(shard_dir);
+    if (shard_open_db(&map, args.file, shard_dir, true) < 0)
+        exit(EXIT_FAIL_DB);
+
+    int records;
+    if (args.lsm) {
+        // too big for the stack, it holds the whole memtable
+        lsm = malloc(sizeof(*lsm));
+        snprintf(lsm_dir, sizeof(lsm_dir), "%s.lsm", args.file);
+        if (lsm == NULL || lsm_open_db(lsm, lsm_dir, true) < 0)
+            exit(EXIT_FAIL_DB);
+        records = build_lsm(lsm, args.density);
+    } else {
+        records = build_db(&map, args.density);
+    }
+    if (records < 0) {
+        printf(M_ERR_DB_WRITE);
+        shard_close_db(&map);
+        exit(EXIT_FAIL_DB);
+    }
+
+    if (args.cache) {
+        cache_report(&map, &args);
+        shard_close_db(&map);
+        return EXIT_OK;
+    }
+
+    int saved_stdout = quiet_begin();
+
+    setenv("SDB_STATS", "text", 0);
+    stats_init();
+
+    uint64_t start = stats_now_ns();
+    for (long i = 0; i < args.ops; i++) {
+        int roll = (int)(rng_next() % 100);
+        int op = 0;
+        while (op < OP_TYPES - 1 && roll >= args.mix[op]) {
+            roll -= args.mix[op];
+            op++;
+        }
+
+        int id = pick_id(zp);
+        stats_begin(op_names[op]);
+        switch (op) {
+            case OP_READ:
+                if (lsm)
+                    lsm_get_student(lsm, id, &student);
+                else
+                    get_student(shard_fd(&map, id), id, &student);
+                break;
+            case OP_WRITE:
+                if (lsm)
+                    lsm_add_student(lsm, id, "bench", "writer", id % (MAX_STD_GPA + 1));
+                else
+                    add_student(shard_fd(&map, id), id, "bench", "writer", id % (MAX_STD_GPA + 1));
+                break;
+            case OP_DELETE:
+                if (lsm)
+                    lsm_del_student(lsm, id);
+                else
+                    del_student(shard_fd(&map, id), id);
+                break;
+            case OP_SCAN:
+                if (lsm)
+                    lsm_print_db(lsm);
+                else
+                    shard_print_db(&map);
+                break;
+        }
+        stats_end();
+        counts[op]++;
+    }
+    uint64_t elapsed = stats_now_ns() - start;
+
+    quiet_end(saved_stdout);
+
+    print_report(&args, records, counts, elapsed);
+    if (lsm) {
+        lsm_close_db(lsm);
+        free(lsm);
+    }
+    shard_close_db(&map);
+    return EXIT_OK;
+}
@@ -0,0 +1,532 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbbackup.h"
+#include "sdbstats.h"
+
+typedef struct backup_totals{
+    int       chunks;
+    int       changed;
+    long long written;
+} backup_totals_t;
+
+/*
+ *  chunk_sum
+ *
+ *  64 bit FNV-1a over 8 byte words, plenty to notice a changed chunk and
+ *  cheap compared to reading it.
+ */
+static uint64_t chunk_sum(const char *buf, size_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, buf + i, sizeof(w));
+        h = (h ^ w) * 1099511628211ull;
+    }
+    for (; i < len; i++)
+        h = (h ^ (unsigned char)buf[i]) * 1099511628211ull;
+    return h;
+}
+
+static int file_add_chunk(backup_file_t *f, off_t off, uint32_t len, uint64_t sum)
+{
+    if (f->n == f->cap) {
+        int cap = f->cap ? f->cap * 2 : 256;
+        backup_chunk_t *chunks = realloc(f->chunks, cap * sizeof(backup_chunk_t));
+        if (chunks == NULL)
+            return ERR_DB_OP;
+        f->chunks = chunks;
+        f->cap = cap;
+    }
+    f->chunks[f->n++] = (backup_chunk_t){ off, len, sum };
+    return NO_ERROR;
+}
+
+static backup_chunk_t *file_find_chunk(backup_file_t *f, off_t off)
+{
+    int lo = 0;
+    int hi = f == NULL ? 0 : f->n;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (f->chunks[mid].off < off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (f != NULL && lo < f->n && f->chunks[lo].off == off) ? &f->chunks[lo] : NULL;
+}
+
+static void manifest_free(backup_manifest_t *m)
+{
+    for (int i = 0; i < m->nfiles; i++)
+        free(m->files[i].chunks);
+    m->nfiles = 0;
+}
+
+/*
+ *  manifest_read
+ *      backupDir:  backup directory
+ *      m:          filled in with the manifest
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND if there is no manifest yet, or
+ *            ERR_DB_FILE if it could not be parsed
+ */
+static int manifest_read(char *backupDir, backup_manifest_t *m)
+{
+    char path[512];
+    char line[512];
+    int rc = NO_ERROR;
+
+    memset(m, 0, sizeof(*m));
+    snprintf(path, sizeof(path), BACKUP_MANIFEST, backupDir);
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+        return errno == ENOENT ? SRCH_NOT_FOUND : ERR_DB_FILE;
+
+    if (fgets(line, sizeof(line), in) == NULL ||
+        strncmp(line, BACKUP_MAGIC, strlen(BACKUP_MAGIC)) != 0)
+        rc = ERR_DB_FILE;
+
+    while (rc == NO_ERROR && fgets(line, sizeof(line), in) != NULL) {
+        backup_file_t *f = &m->files[m->nfiles];
+        long long size;
+        unsigned long long mtime;
+        int nchunks;
+
+        if (m->nfiles == SHARD_MAX ||
+            sscanf(line, "file %511s %lld %llu %d", f->path, &size, &mtime, &nchunks) != 4) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        f->size = size;
+        f->mtime_ns = mtime;
+        m->nfiles++;
+
+        for (int i = 0; i < nchunks && rc == NO_ERROR; i++) {
+            long long off;
+            unsigned int len;
+            unsigned long long sum;
+
+            if (fgets(line, sizeof(line), in) == NULL ||
+                sscanf(line, "%lld %u %llx", &off, &len, &sum) != 3)
+                rc = ERR_DB_FILE;
+            else
+                rc = file_add_chunk(f, off, len, sum);
+        }
+    }
+    fclose(in);
+
+    if (rc != NO_ERROR)
+        manifest_free(m);
+    return rc;
+}
+
+/*
+ *  manifest_write
+ *
+ *  Writes the manifest under a temporary name and renames it into place,
+ *  after the images it describes have been synced.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int manifest_write(char *backupDir, backup_manifest_t *m)
+{
+    char tmp[512];
+    char path[512];
+
+    snprintf(tmp, sizeof(tmp), BACKUP_TMP_MANIFEST, backupDir);
+    snprintf(path, sizeof(path), BACKUP_MANIFEST, backupDir);
+
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL)
+        return ERR_DB_FILE;
+
+    fprintf(out, "%s\n", BACKUP_MAGIC);
+    for (int i = 0; i < m->nfiles; i++) {
+        backup_file_t *f = &m->files[i];
+        fprintf(out, "file %s %lld %llu %d\n", f->path, (long long)f->size,
+                (unsigned long long)f->mtime_ns, f->n);
+        for (int c = 0; c < f->n; c++)
+            fprintf(out, "%lld %u %016llx\n", (long long)f->chunks[c].off,
+                    f->chunks[c].len, (unsigned long long)f->chunks[c].sum);
+    }
+
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0) {
+        fclose(out);
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+static void image_path(char *buf, size_t len, char *backupDir, const char *dbPath)
+{
+    char name[256];
+
+    strncpy(name, dbPath, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    snprintf(buf, len, BACKUP_IMAGE, backupDir, basename(name));
+}
+
+/*
+ *  backup_file
+ *      backupDir:  backup directory
+ *      fd:         database file to back up
+ *      old:        this file in the previous manifest, or NULL
+ *      f:          this file in the new manifest, path already set
+ *      buf:        BACKUP_CHUNK byte buffer
+ *      tot:        running totals for the report
+ *
+ *  Brings the image of one database file up to date.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE or ERR_DB_OP
+ */
+static int backup_file(char *backupDir, int fd, backup_file_t *old, backup_file_t *f,
+                       char *buf, backup_totals_t *tot)
+{
+    char path[512];
+    struct stat st;
+    int rc = NO_ERROR;
+
+    if (fstat(fd, &st) != 0)
+        return ERR_DB_FILE;
+    f->size = st.st_size;
+    f->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+
+    image_path(path, sizeof(path), backupDir, f->path);
+
+    // untouched since the last backup, carry its chunks over unread
+    if (old != NULL && old->size == f->size && old->mtime_ns == f->mtime_ns &&
+        access(path, F_OK) == 0) {
+        for (int i = 0; i < old->n && rc == NO_ERROR; i++)
+            rc = file_add_chunk(f, old->chunks[i].off, old->chunks[i].len, old->chunks[i].sum);
+        tot->chunks += f->n;
+        return rc;
+    }
+
+    int img = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (img < 0)
+        return ERR_DB_FILE;
+    // no manifest entry, whatever the image held before is unaccounted for
+    if ((old == NULL && ftruncate(img, 0) != 0) || ftruncate(img, f->size) != 0) {
+        close(img);
+        return ERR_DB_FILE;
+    }
+
+    off_t pos = 0;
+    off_t next_chunk = 0;
+    while (rc == NO_ERROR && pos < f->size) {
+        off_t data = stats_lseek(fd, pos, SEEK_DATA);
+        off_t hole;
+
+        if (data == (off_t)-1) {
+            if (errno == ENXIO)
+                break;
+            // no SEEK_DATA support, treat the rest of the file as data
+            data = pos;
+            hole = f->size;
+        } else {
+            hole = stats_lseek(fd, data, SEEK_HOLE);
+            if (hole == (off_t)-1)
+                hole = f->size;
+        }
+
+        off_t c = data & ~(off_t)(BACKUP_CHUNK - 1);
+        if (c < next_chunk)
+            c = next_chunk;
+        for (; rc == NO_ERROR && c < hole; c += BACKUP_CHUNK) {
+            size_t len = f->size - c < BACKUP_CHUNK ? (size_t)(f->size - c) : BACKUP_CHUNK;
+            ssize_t n = stats_pread(fd, buf, len, c);
+            if (n != (ssize_t)len) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+
+            uint64_t sum = chunk_sum(buf, len);
+            backup_chunk_t *prev = file_find_chunk(old, c);
+            if (prev == NULL || prev->sum != sum || prev->len != len) {
+                if (stats_pwrite(img, buf, len, c) != (ssize_t)len) {
+                    rc = ERR_DB_FILE;
+                    break;
+                }
+                tot->changed++;
+                tot->written += len;
+            }
+            rc = file_add_chunk(f, c, len, sum);
+            tot->chunks++;
+        }
+        next_chunk = c;
+        pos = hole;
+    }
+
+    // chunks that turned into holes (-x, -z) become holes in the image too
+    for (int i = 0; rc == NO_ERROR && old != NULL && i < old->n; i++) {
+        backup_chunk_t *gone = &old->chunks[i];
+        if (gone->off < f->size && file_find_chunk(f, gone->off) == NULL) {
+            off_t len = f->size - gone->off < BACKUP_CHUNK ? f->size - gone->off : BACKUP_CHUNK;
+            fallocate(img, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, gone->off, len);
+        }
+    }
+
+    if (fsync(img) != 0 && rc == NO_ERROR)
+        rc = ERR_DB_FILE;
+    close(img);
+    return rc;
+}
+
+/*
+ *  backup_db
+ *      map:        open database
+ *      dbFile:     name of the single file database
+ *      backupDir:  backup directory, created if needed
+ *
+ *  Backs up every database file into backupDir, writing only the chunks
+ *  that changed since the manifest already there.
+ *
+ *  returns:  NO_ERROR       backup written
+ *            ERR_DB_FILE    database or backup I/O issue
+ *            ERR_DB_OP      out of memory
+ *
+ *  console:  M_BACKUP_OK    on success
+ *            M_ERR_BACKUP   on error
+ */
+int backup_db(shard_map_t *map, char *dbFile, char *backupDir)
+{
+    backup_manifest_t old;
+    backup_manifest_t cur;
+    backup_totals_t tot = {0};
+    struct stat st;
+    int rc;
+
+    if (mkdir(backupDir, S_IRWXU | S_IRWXG) != 0 &&
+        (stat(backupDir, &st) != 0 || !S_ISDIR(st.st_mode))) {
+        printf(M_ERR_BACKUP, backupDir);
+        return ERR_DB_FILE;
+    }
+
+    // an unreadable manifest just means everything is copied again
+    if (manifest_read(backupDir, &old) != NO_ERROR)
+        old.nfiles = 0;
+
+    char *buf = malloc(BACKUP_CHUNK);
+    if (buf == NULL) {
+        manifest_free(&old);
+        return ERR_DB_OP;
+    }
+
+    memset(&cur, 0, sizeof(cur));
+    rc = NO_ERROR;
+    for (int i = 0; i < map->nshards && rc == NO_ERROR; i++) {
+        backup_file_t *f = &cur.files[cur.nfiles++];
+        backup_file_t *prev = NULL;
+
+        if (map->dir[0] != '\0')
+            snprintf(f->path, sizeof(f->path), SHARD_FILE_FMT, map->dir, i);
+        else
+            snprintf(f->path, sizeof(f->path), "%s", dbFile);
+        for (int j = 0; j < old.nfiles; j++) {
+            if (strcmp(old.files[j].path, f->path) == 0)
+                prev = &old.files[j];
+        }
+        rc = backup_file(backupDir, map->fds[i], prev, f, buf, &tot);
+    }
+    free(buf);
+
+    if (rc == NO_ERROR)
+        rc = manifest_write(backupDir, &cur);
+
+    if (rc == NO_ERROR)
+        printf(M_BACKUP_OK, cur.nfiles, backupDir, tot.chunks, tot.changed, tot.written);
+    else
+        printf(M_ERR_BACKUP, backupDir);
+    manifest_free(&old);
+    manifest_free(&cur);
+    return rc;
+}
+
+/*
+ *  manifest_layout_ok
+ *
+ *  A manifest may only name the files of one of the two layouts backup_db()
+ *  writes: dbFile alone, or shards 0..n-1 of shardDir in order.  Anything
+ *  else, like an absolute path or one with "..", is refused so restoring a
+ *  backup can never write outside the database.
+ */
+static bool manifest_layout_ok(backup_manifest_t *m, char *dbFile, char *shardDir)
+{
+    char path[512];
+
+    if (m->nfiles == 1 && strcmp(m->files[0].path, dbFile) == 0)
+        return true;
+    for (int i = 0; i < m->nfiles; i++) {
+        snprintf(path, sizeof(path), SHARD_FILE_FMT, shardDir, i);
+        if (strcmp(m->files[i].path, path) != 0)
+            return false;
+    }
+    return m->nfiles > 0;
+}
+
+/*
+ *  remove_other_layout
+ *
+ *  Removes the database files that are not in the restored manifest, so
+ *  the next open sees exactly the restored layout: the whole shard
+ *  directory after restoring a single file backup, or dbFile and the
+ *  shards past the restored ones after restoring a sharded backup.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int remove_other_layout(backup_manifest_t *m, char *dbFile, char *shardDir)
+{
+    char path[512];
+    bool sharded = strcmp(m->files[0].path, dbFile) != 0;
+
+    for (int i = sharded ? m->nfiles : 0; i < SHARD_MAX; i++) {
+        snprintf(path, sizeof(path), SHARD_FILE_FMT, shardDir, i);
+        if (unlink(path) != 0 && errno != ENOENT)
+            return ERR_DB_FILE;
+    }
+    if (sharded) {
+        if (unlink(dbFile) != 0 && errno != ENOENT)
+            return ERR_DB_FILE;
+    } else if (rmdir(shardDir) != 0 && errno != ENOENT) {
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  restore_db
+ *      dbFile:     name of the single file database
+ *      shardDir:   name of the sharded database directory
+ *      backupDir:  backup directory written by backup_db()
+ *
+ *  Recreates every database file listed in the manifest, same size and
+ *  same holes, copying only the data chunks and checking each against its
+ *  checksum.  The files are written under temporary names and only
+ *  renamed over the database once all of them checked out, so a corrupt
+ *  backup leaves the database alone.  Database files of any other layout
+ *  are then removed, a 4 shard backup restored over 8 shards leaves 4.
+ *  The database must not be open.
+ *
+ *  returns:  NO_ERROR       database restored
+ *            ERR_DB_FILE    backup missing, corrupt, or an I/O issue
+ *            ERR_DB_OP      out of memory
+ *
+ *  console:  M_RESTORE_OK       on success
+ *            M_ERR_MANIFEST     the manifest is missing or unreadable
+ *            M_ERR_MANIFEST_DB  it names files that are not database files
+ *            M_ERR_CHUNK_SUM    a chunk failed its checksum
+ *            M_ERR_DB_WRITE     error writing a database file
+ */
+int restore_db(char *dbFile, char *shardDir, char *backupDir)
+{
+    backup_manifest_t m;
+    char path[512];
+    char tmp[600];
+    long long restored = 0;
+    int rc;
+
+    if (manifest_read(backupDir, &m) != NO_ERROR) {
+        printf(M_ERR_MANIFEST, backupDir);
+        return ERR_DB_FILE;
+    }
+    if (!manifest_layout_ok(&m, dbFile, shardDir)) {
+        printf(M_ERR_MANIFEST_DB, backupDir);
+        manifest_free(&m);
+        return ERR_DB_FILE;
+    }
+
+    char *buf = malloc(BACKUP_CHUNK);
+    if (buf == NULL) {
+        manifest_free(&m);
+        return ERR_DB_OP;
+    }
+
+    rc = NO_ERROR;
+    for (int i = 0; i < m.nfiles && rc == NO_ERROR; i++) {
+        backup_file_t *f = &m.files[i];
+
+        // shard files live in a directory that may not exist yet
+        char dir[256];
+        strncpy(dir, f->path, sizeof(dir) - 1);
+        dir[sizeof(dir) - 1] = '\0';
+        if (strchr(dir, '/') != NULL)
+            mkdir(dirname(dir), S_IRWXU | S_IRWXG);
+
+        image_path(path, sizeof(path), backupDir, f->path);
+        snprintf(tmp, sizeof(tmp), BACKUP_RESTORE_TMP, f->path);
+        int img = open(path, O_RDONLY);
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (img < 0 || fd < 0 || ftruncate(fd, f->size) != 0) {
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+        }
+
+        for (int c = 0; c < f->n && rc == NO_ERROR; c++) {
+            backup_chunk_t *ch = &f->chunks[c];
+            if (ch->len > BACKUP_CHUNK ||
+                stats_pread(img, buf, ch->len, ch->off) != (ssize_t)ch->len ||
+                chunk_sum(buf, ch->len) != ch->sum) {
+                printf(M_ERR_CHUNK_SUM, (long long)ch->off, f->path);
+                rc = ERR_DB_FILE;
+                break;
+            }
+            if (stats_pwrite(fd, buf, ch->len, ch->off) != (ssize_t)ch->len) {
+                printf(M_ERR_DB_WRITE);
+                rc = ERR_DB_FILE;
+                break;
+            }
+            restored += ch->len;
+        }
+
+        if (fd >= 0 && fsync(fd) != 0 && rc == NO_ERROR) {
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+        }
+        if (img >= 0)
+            close(img);
+        if (fd >= 0)
+            close(fd);
+    }
+    free(buf);
+
+    // every file checked out, only now replace the database
+    for (int i = 0; i < m.nfiles; i++) {
+        snprintf(tmp, sizeof(tmp), BACKUP_RESTORE_TMP, m.files[i].path);
+        if (rc != NO_ERROR) {
+            unlink(tmp);
+        } else if (rename(tmp, m.files[i].path) != 0) {
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+        }
+    }
+    if (rc == NO_ERROR && remove_other_layout(&m, dbFile, shardDir) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+    }
+
+    if (rc == NO_ERROR)
+        printf(M_RESTORE_OK, m.nfiles, backupDir, restored);
+    manifest_free(&m);
+    return rc;
+}
@@ -0,0 +1,61 @@
+#ifndef __SDB_BACKUP_H__
+    #define __SDB_BACKUP_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "sdbshard.h"
+
+//Incremental backup of the sparse database files.  cp and tar either
+//expand the holes or copy everything every time, a backup directory here
+//holds a sparse mirror image of every database file plus a MANIFEST:
+//
+//  SDBBACKUP1
+//  file <path> <size> <mtime_ns> <nchunks>
+//  <offset> <length> <checksum>            one line per chunk with data
+//  ...
+//
+//Only the data extents of a file are walked (SEEK_DATA / SEEK_HOLE), in
+//BACKUP_CHUNK sized, aligned chunks.  A chunk whose checksum matches the
+//previous manifest is not written again, and a file whose size and mtime
+//match it is not even read, so a backup writes only what changed.
+
+#define BACKUP_MANIFEST     "%s/MANIFEST"
+#define BACKUP_TMP_MANIFEST "%s/.tmp_MANIFEST"
+#define BACKUP_IMAGE        "%s/%s.img"
+#define BACKUP_RESTORE_TMP  "%s.restore"
+#define BACKUP_MAGIC        "SDBBACKUP1"
+#define BACKUP_CHUNK        (64 * 1024)     //power of 2
+
+typedef struct backup_chunk{
+    off_t    off;
+    uint32_t len;
+    uint64_t sum;
+} backup_chunk_t;
+
+typedef struct backup_file{
+    char            path[512];
+    off_t           size;
+    uint64_t        mtime_ns;
+    int             n;
+    int             cap;
+    backup_chunk_t *chunks;         //sorted by offset
+} backup_file_t;
+
+typedef struct backup_manifest{
+    int           nfiles;
+    backup_file_t files[SHARD_MAX];
+} backup_manifest_t;
+
+//prototypes
+int backup_db(shard_map_t *map, char *dbFile, char *backupDir);
+int restore_db(char *dbFile, char *shardDir, char *backupDir);
+
+#define M_BACKUP_OK       "Backup of %d file(s) to %s: %d chunk(s), %d changed, %lld byte(s) written.\n"
+#define M_RESTORE_OK      "Restored %d file(s) from %s, %lld byte(s) of data.\n"
+#define M_ERR_BACKUP      "Error writing backup to %s\n"
+#define M_ERR_MANIFEST    "Error reading backup manifest in %s\n"
+#define M_ERR_MANIFEST_DB "Backup manifest in %s names files that are not database files\n"
+#define M_ERR_CHUNK_SUM   "Backup chunk at offset %lld of %s is corrupt\n"
+
+#endif
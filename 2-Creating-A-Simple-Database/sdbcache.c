@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "sdbcache.h"
+
+static int hints = -1;     //-1 until SDB_CACHE has been looked at
+
+bool cache_hints_enabled(void)
+{
+    if (hints < 0) {
+        const char *env = getenv(CACHE_ENV);
+        hints = !(env != NULL && strcmp(env, "off") == 0);
+    }
+    return hints;
+}
+
+void cache_set_hints(bool on)
+{
+    hints = on;
+}
+
+static long page_size(void)
+{
+    static long sz;
+
+    if (sz == 0)
+        sz = sysconf(_SC_PAGESIZE);
+    return sz;
+}
+
+static off_t file_size(int fd)
+{
+    struct stat st;
+
+    return fstat(fd, &st) == 0 ? st.st_size : 0;
+}
+
+/*
+ *  cache_point_lookups
+ *      fd:  database file about to be used for single record operations
+ *
+ *  A lookup reads 64 bytes, turn off readahead so it does not drag in
+ *  the pages around it.
+ */
+void cache_point_lookups(int fd)
+{
+    if (cache_hints_enabled())
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+}
+
+/*
+ *  cache_resident_pages
+ *      fd:     file to check
+ *      start:  first byte of the range
+ *      end:    end of the range, 0 means end of file
+ *      total:  set to the number of pages in the range, may be NULL
+ *
+ *  returns:  the number of pages in the range that are in the page cache,
+ *            or -1 if it could not be determined
+ */
+long cache_resident_pages(int fd, off_t start, off_t end, long *total)
+{
+    long pg = page_size();
+    long resident = 0;
+
+    if (end == 0)
+        end = file_size(fd);
+    start &= ~(off_t)(pg - 1);
+    if (total != NULL)
+        *total = 0;
+    if (end <= start)
+        return 0;
+
+    size_t len = end - start;
+    size_t npages = (len + pg - 1) / pg;
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, start);
+    if (map == MAP_FAILED)
+        return -1;
+
+    unsigned char *vec = malloc(npages);
+    if (vec == NULL || mincore(map, len, vec) != 0) {
+        free(vec);
+        munmap(map, len);
+        return -1;
+    }
+    for (size_t i = 0; i < npages; i++)
+        resident += vec[i] & 1;
+
+    free(vec);
+    munmap(map, len);
+    if (total != NULL)
+        *total = npages;
+    return resident;
+}
+
+/*
+ *  cache_evict
+ *      fd:  file to drop from the page cache
+ *
+ *  Writes back and drops every cached page of the file, used by the
+ *  benchmark to start each measurement cold.
+ *
+ *  returns:  0 on success, -1 on error
+ */
+int cache_evict(int fd)
+{
+    if (fdatasync(fd) != 0)
+        return -1;
+    return posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0 ? 0 : -1;
+}
+
+/*
+ *  cache_scan_begin
+ *      cs:     scan state to fill in
+ *      fd:     file about to be scanned
+ *      start:  offset the scan starts at
+ *      end:    offset the scan stops at, 0 means end of file
+ *
+ *  Tells the kernel the range will be read once, front to back, and
+ *  starts reading the first CACHE_READAHEAD bytes.  Whether the scan
+ *  gives its pages back afterwards depends on how much of the range was
+ *  cached to begin with: a hot file is being used by someone and is left
+ *  alone.
+ */
+void cache_scan_begin(cache_scan_t *cs, int fd, off_t start, off_t end)
+{
+    long total;
+
+    memset(cs, 0, sizeof(*cs));
+    cs->fd = -1;
+    if (!cache_hints_enabled())
+        return;
+
+    if (end == 0)
+        end = file_size(fd);
+    if (end <= start)
+        return;
+
+    long resident = cache_resident_pages(fd, start, end, &total);
+    cs->fd = fd;
+    cs->end = end;
+    cs->drop = resident >= 0 && total > 0 && resident * 100 < total * CACHE_HOT_PCT;
+    cs->dropped = start & ~(off_t)(page_size() - 1);
+
+    posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, start, end - start, POSIX_FADV_NOREUSE);
+    readahead(fd, start, CACHE_READAHEAD);
+    cs->ahead = start + CACHE_READAHEAD;
+}
+
+/*
+ *  cache_scan_advance
+ *      cs:   scan state
+ *      pos:  offset the scan has consumed up to
+ *
+ *  Keeps the readahead one window ahead of the scan and, for a cold file,
+ *  releases the pages behind it.  Cheap enough to call for every record.
+ */
+void cache_scan_advance(cache_scan_t *cs, off_t pos)
+{
+    if (cs->fd < 0)
+        return;
+
+    // the caller may have skipped a hole, never read ahead behind it
+    if (cs->ahead < pos)
+        cs->ahead = pos;
+    if (cs->ahead < cs->end && pos + CACHE_READAHEAD / 2 >= cs->ahead) {
+        readahead(cs->fd, cs->ahead, CACHE_READAHEAD);
+        cs->ahead += CACHE_READAHEAD;
+    }
+    if (cs->drop && pos - cs->dropped >= CACHE_READAHEAD) {
+        off_t upto = pos & ~(off_t)(page_size() - 1);
+        posix_fadvise(cs->fd, cs->dropped, upto - cs->dropped, POSIX_FADV_DONTNEED);
+        cs->dropped = upto;
+    }
+}
+
+/*
+ *  cache_scan_end
+ *      cs:  scan state
+ *
+ *  Releases the rest of a cold file and puts the file back to the default
+ *  access pattern.
+ */
+void cache_scan_end(cache_scan_t *cs)
+{
+    if (cs->fd < 0)
+        return;
+
+    if (cs->drop)
+        posix_fadvise(cs->fd, cs->dropped, cs->end - cs->dropped, POSIX_FADV_DONTNEED);
+    posix_fadvise(cs->fd, 0, 0, POSIX_FADV_NORMAL);
+    cs->fd = -1;
+}
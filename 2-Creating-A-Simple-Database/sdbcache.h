@@ -0,0 +1,45 @@
+#ifndef __SDB_CACHE_H__
+    #define __SDB_CACHE_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+//Page cache hints.  By default the kernel guesses the access pattern, so a
+//full scan of a large sparse student.db pushes everything else out of the
+//page cache and a single get_student() pulls in a readahead window it will
+//never use.  The helpers below tell it what sdbsc is about to do:
+//
+//  scans          POSIX_FADV_SEQUENTIAL + NOREUSE, explicit readahead() of
+//                 the next CACHE_READAHEAD bytes, and if the file was cold
+//                 when the scan started the pages already consumed are
+//                 dropped (DONTNEED) so the scan leaves the cache as it was
+//  point lookups  POSIX_FADV_RANDOM, no readahead
+//
+//SDB_CACHE=off turns every hint into a no-op, which is how the benchmark
+//measures the difference.
+
+#define CACHE_ENV           "SDB_CACHE"
+#define CACHE_READAHEAD     (1 << 20)   //bytes read ahead of a scan
+#define CACHE_HOT_PCT       50          //resident % above which a scan keeps pages
+#define CACHE_DIRECT_ALIGN  4096        //O_DIRECT buffer and offset alignment
+#define CACHE_DIRECT_CHUNK  (1 << 20)   //bytes per O_DIRECT read
+
+typedef struct cache_scan{
+    int   fd;           //-1 when hints are off
+    off_t end;
+    off_t ahead;        //readahead has been issued up to here
+    off_t dropped;      //pages before here have been released
+    bool  drop;         //file was cold, release pages behind the scan
+} cache_scan_t;
+
+//prototypes
+bool cache_hints_enabled(void);
+void cache_set_hints(bool on);
+void cache_point_lookups(int fd);
+void cache_scan_begin(cache_scan_t *cs, int fd, off_t start, off_t end);
+void cache_scan_advance(cache_scan_t *cs, off_t pos);
+void cache_scan_end(cache_scan_t *cs);
+long cache_resident_pages(int fd, off_t start, off_t end, long *total);
+int  cache_evict(int fd);
+
+#endif
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbcol.h"
+#include "sdbstats.h"
+#include "sdbcache.h"
+
+//records read per pread() when building the side file
+#define COL_SCAN_RECORDS    256
+
+/*
+ *  col_source_sig
+ *      map:  shard map of the row files
+ *      hdr:  header whose src_size and src_mtime_ns are filled in
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if a row file could not be stat()ed
+ */
+static int col_source_sig(shard_map_t *map, col_header_t *hdr)
+{
+    struct stat st;
+
+    hdr->src_size = 0;
+    hdr->src_mtime_ns = 0;
+    for (int i = 0; i < map->nshards; i++) {
+        if (fstat(map->fds[i], &st) != 0)
+            return ERR_DB_FILE;
+
+        uint64_t mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+        hdr->src_size += st.st_size;
+        if (mtime > hdr->src_mtime_ns)
+            hdr->src_mtime_ns = mtime;
+    }
+    return NO_ERROR;
+}
+
+typedef struct col_build{
+    uint32_t   n;
+    uint32_t   cap;
+    int32_t   *id;
+    int32_t   *gpa;
+    char     (*fname)[sizeof(((student_t *)0)->fname)];
+    char     (*lname)[sizeof(((student_t *)0)->lname)];
+} col_build_t;
+
+static int col_build_add(col_build_t *b, student_t *s)
+{
+    if (b->n == b->cap) {
+        uint32_t cap = b->cap ? b->cap * 2 : 4096;
+        void *id = realloc(b->id, cap * sizeof(*b->id));
+        if (id) b->id = id;
+        void *gpa = realloc(b->gpa, cap * sizeof(*b->gpa));
+        if (gpa) b->gpa = gpa;
+        void *fname = realloc(b->fname, cap * sizeof(*b->fname));
+        if (fname) b->fname = fname;
+        void *lname = realloc(b->lname, cap * sizeof(*b->lname));
+        if (lname) b->lname = lname;
+        if (!id || !gpa || !fname || !lname)
+            return ERR_DB_OP;
+        b->cap = cap;
+    }
+
+    b->id[b->n] = s->id;
+    b->gpa[b->n] = s->gpa;
+    memcpy(b->fname[b->n], s->fname, sizeof(s->fname));
+    memcpy(b->lname[b->n], s->lname, sizeof(s->lname));
+    b->n++;
+    return NO_ERROR;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = stats_write(fd, p, len);
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  col_rebuild
+ *      map:  shard map of the row files
+ *
+ *  Scans every live record out of the row files, in id order, and writes
+ *  the columnar side file.  The file is written under COL_TMP_FILE and then
+ *  renamed over COL_FILE so a reader never sees a half written one.
+ *
+ *  returns:  NO_ERROR       side file rebuilt
+ *            ERR_DB_FILE    database or side file I/O issue
+ *            ERR_DB_OP      out of memory
+ *
+ *  console:  M_ERR_DB_READ    error reading the row files
+ *            M_ERR_DB_WRITE   error writing the side file
+ */
+int col_rebuild(shard_map_t *map)
+{
+    col_build_t b = {0};
+    col_header_t hdr = {0};
+    student_t block[COL_SCAN_RECORDS];
+    int rc = NO_ERROR;
+
+    memcpy(hdr.magic, COL_MAGIC, sizeof(hdr.magic));
+    if (col_source_sig(map, &hdr) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    for (int s = 0; s < map->nshards && rc == NO_ERROR; s++) {
+        int id = shard_first_id(map, s);
+        int last = id + map->ids_per_shard - 1;
+        cache_scan_t cs;
+
+        cache_scan_begin(&cs, map->fds[s], (off_t)id * sizeof(student_t), 0);
+        while (rc == NO_ERROR && id <= last) {
+            int want = last - id + 1 < COL_SCAN_RECORDS ? last - id + 1 : COL_SCAN_RECORDS;
+            ssize_t n = stats_pread(map->fds[s], block, want * sizeof(student_t),
+                                    (off_t)id * sizeof(student_t));
+            if (n < 0 || n % sizeof(student_t) != 0) {
+                printf(M_ERR_DB_READ);
+                rc = ERR_DB_FILE;
+                break;
+            }
+            if (n == 0)
+                break;
+
+            int got = n / sizeof(student_t);
+            cache_scan_advance(&cs, (off_t)(id + got) * sizeof(student_t));
+            for (int i = 0; i < got && rc == NO_ERROR; i++) {
+                if (memcmp(&block[i], &EMPTY_STUDENT_RECORD, sizeof(student_t)) == 0)
+                    stats_hole(1);
+                else
+                    rc = col_build_add(&b, &block[i]);
+            }
+            id += got;
+        }
+        cache_scan_end(&cs);
+    }
+
+    if (rc == NO_ERROR) {
+        hdr.nrecords = b.n;
+        int fd = open(COL_TMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (fd < 0 ||
+            write_all(fd, &hdr, sizeof(hdr)) != NO_ERROR ||
+            write_all(fd, b.id, b.n * sizeof(*b.id)) != NO_ERROR ||
+            write_all(fd, b.gpa, b.n * sizeof(*b.gpa)) != NO_ERROR ||
+            write_all(fd, b.fname, b.n * sizeof(*b.fname)) != NO_ERROR ||
+            write_all(fd, b.lname, b.n * sizeof(*b.lname)) != NO_ERROR ||
+            close(fd) != 0 ||
+            rename(COL_TMP_FILE, COL_FILE) != 0) {
+            printf(M_ERR_DB_WRITE);
+            if (fd >= 0)
+                unlink(COL_TMP_FILE);
+            rc = ERR_DB_FILE;
+        }
+    }
+
+    free(b.id);
+    free(b.gpa);
+    free(b.fname);
+    free(b.lname);
+    return rc;
+}
+
+/*
+ *  col_try_open
+ *
+ *  Maps COL_FILE if it exists and was built from row files with the
+ *  signature in want.
+ *
+ *  returns:  NO_ERROR if col is usable, SRCH_NOT_FOUND if the side file is
+ *            missing or stale
+ */
+static int col_try_open(col_header_t *want, col_db_t *col)
+{
+    struct stat st;
+    col_header_t *hdr;
+
+    int fd = open(COL_FILE, O_RDONLY);
+    if (fd < 0)
+        return SRCH_NOT_FOUND;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(col_header_t)) {
+        close(fd);
+        return SRCH_NOT_FOUND;
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return SRCH_NOT_FOUND;
+
+    hdr = p;
+    size_t need = sizeof(col_header_t) + (size_t)hdr->nrecords *
+                  (sizeof(int32_t) * 2 + sizeof(*col->fname) + sizeof(*col->lname));
+    if (memcmp(hdr->magic, COL_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->src_size != want->src_size ||
+        hdr->src_mtime_ns != want->src_mtime_ns ||
+        (size_t)st.st_size != need) {
+        munmap(p, st.st_size);
+        return SRCH_NOT_FOUND;
+    }
+
+    col->map = p;
+    col->map_len = st.st_size;
+    col->n = hdr->nrecords;
+    col->id = (const int32_t *)(hdr + 1);
+    col->gpa = col->id + col->n;
+    col->fname = (const void *)(col->gpa + col->n);
+    col->lname = (const void *)(col->fname + col->n);
+
+    // the columns are streamed front to back
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    return NO_ERROR;
+}
+
+/*
+ *  col_open
+ *      map:  shard map of the row files
+ *      col:  columnar view to fill in
+ *
+ *  Opens the columnar side file, rebuilding it first if it is missing or
+ *  older than the row files.
+ *
+ *  returns:  NO_ERROR       col is ready, release it with col_close()
+ *            ERR_DB_FILE    database or side file I/O issue
+ *
+ *  console:  see col_rebuild()
+ */
+int col_open(shard_map_t *map, col_db_t *col)
+{
+    col_header_t want = {0};
+    int rc;
+
+    memset(col, 0, sizeof(*col));
+    if (col_source_sig(map, &want) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (col_try_open(&want, col) == NO_ERROR)
+        return NO_ERROR;
+
+    rc = col_rebuild(map);
+    if (rc != NO_ERROR)
+        return rc;
+    if (col_try_open(&want, col) != NO_ERROR) {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+void col_close(col_db_t *col)
+{
+    if (col->map != NULL)
+        munmap(col->map, col->map_len);
+    memset(col, 0, sizeof(*col));
+}
+
+/*
+ *  col_gpa_stats
+ *      map:  shard map of the row files
+ *
+ *  Prints the number of students and the min, max and average GPA.  Only
+ *  the gpa column is read.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or side file I/O issue
+ *
+ *  console:  M_COL_GPA_STATS  on success
+ *            M_DB_EMPTY       if there are no students
+ */
+int col_gpa_stats(shard_map_t *map)
+{
+    col_db_t col;
+    int64_t sum = 0;
+    int32_t min = MAX_STD_GPA;
+    int32_t max = MIN_STD_GPA;
+
+    int rc = col_open(map, &col);
+    if (rc != NO_ERROR)
+        return rc;
+
+    if (col.n == 0) {
+        printf(M_DB_EMPTY);
+        col_close(&col);
+        return NO_ERROR;
+    }
+
+    for (uint32_t i = 0; i < col.n; i++) {
+        int32_t g = col.gpa[i];
+        sum += g;
+        min = g < min ? g : min;
+        max = g > max ? g : max;
+    }
+
+    printf(M_COL_GPA_STATS, col.n, min / 100.0, max / 100.0, (double)sum / col.n / 100.0);
+    col_close(&col);
+    return NO_ERROR;
+}
+
+/*
+ *  col_gpa_filter
+ *      map:      shard map of the row files
+ *      min_gpa:  lowest gpa to print, as an int like -a takes
+ *      max_gpa:  highest gpa to print
+ *
+ *  Prints every student whose gpa is in [min_gpa, max_gpa] in the same
+ *  format as print_db().  The gpa column is scanned and the id and name
+ *  columns are only touched for rows that matched.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or side file I/O issue
+ *
+ *  console:  matching students, or M_COL_NO_MATCH
+ */
+int col_gpa_filter(shard_map_t *map, int min_gpa, int max_gpa)
+{
+    col_db_t col;
+    bool hasPrintedHeader = false;
+
+    int rc = col_open(map, &col);
+    if (rc != NO_ERROR)
+        return rc;
+
+    for (uint32_t i = 0; i < col.n; i++) {
+        if (col.gpa[i] < min_gpa || col.gpa[i] > max_gpa)
+            continue;
+
+        if (!hasPrintedHeader) {
+            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+            hasPrintedHeader = true;
+        }
+        printf(STUDENT_PRINT_FMT_STRING, col.id[i], col.fname[i], col.lname[i], col.gpa[i] / 100.0);
+    }
+
+    if (!hasPrintedHeader)
+        printf(M_COL_NO_MATCH, min_gpa / 100.0, max_gpa / 100.0);
+
+    col_close(&col);
+    return NO_ERROR;
+}
@@ -0,0 +1,53 @@
+#ifndef __SDB_COL_H__
+    #define __SDB_COL_H__
+
+#include <stdint.h>
+
+#include "db.h"
+#include "sdbshard.h"
+
+//Columnar side file for read mostly analytics.  student.db stores 64 byte
+//rows, which is right for point lookups but means an aggregate over gpa
+//drags 60 bytes it does not need through memory for every 4 it uses.  The
+//side file holds the live records split into columns:
+//
+//  col_header_t | int32 id[n] | int32 gpa[n] | char fname[n][24] | char lname[n][32]
+//
+//so a gpa scan touches 4 bytes per student and only looks at the name
+//columns for rows that matched.  The header remembers the size and mtime
+//of the row files it was built from, the side file is rebuilt on demand
+//whenever they no longer match.
+
+#define COL_FILE        ".student.col"
+#define COL_TMP_FILE    ".tmp_student.col"
+#define COL_MAGIC       "SDBCOL1"
+
+typedef struct col_header{
+    char     magic[8];
+    uint32_t nrecords;
+    uint32_t reserved;
+    uint64_t src_size;      //total size of the row files
+    uint64_t src_mtime_ns;  //newest mtime of the row files
+} col_header_t;
+
+typedef struct col_db{
+    void          *map;     //whole side file, mmap()ed read only
+    size_t         map_len;
+    uint32_t       n;
+    const int32_t *id;
+    const int32_t *gpa;
+    const char   (*fname)[sizeof(((student_t *)0)->fname)];
+    const char   (*lname)[sizeof(((student_t *)0)->lname)];
+} col_db_t;
+
+//prototypes
+int  col_open(shard_map_t *map, col_db_t *col);
+void col_close(col_db_t *col);
+int  col_rebuild(shard_map_t *map);
+int  col_gpa_stats(shard_map_t *map);
+int  col_gpa_filter(shard_map_t *map, int min_gpa, int max_gpa);
+
+#define M_COL_GPA_STATS   "GPA stats: count=%u min=%.2f max=%.2f avg=%.2f\n"
+#define M_COL_NO_MATCH    "No students with GPA between %.2f and %.2f.\n"
+
+#endif
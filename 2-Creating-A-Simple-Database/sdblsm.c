@@ -0,0 +1,879 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbshard.h"
+#include "sdblsm.h"
+#include "sdbstats.h"
+
+//records buffered per write() when writing a run
+#define LSM_WRITE_RECORDS   256
+
+/*
+ *  lsm_wanted
+ *      lsmDir:  name of the LSM database directory
+ *
+ *  returns:  true if the LSM engine should be used, either because lsmDir
+ *            already exists or because SDB_ENGINE=lsm
+ */
+bool lsm_wanted(char *lsmDir)
+{
+    struct stat st;
+    const char *engine = getenv(LSM_ENGINE_ENV);
+
+    if (engine != NULL && strcmp(engine, "lsm") == 0)
+        return true;
+    return stat(lsmDir, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool is_tombstone(const student_t *s)
+{
+    return s->gpa == LSM_TOMBSTONE;
+}
+
+static int cmp_student_id(const void *a, const void *b)
+{
+    const student_t *sa = a;
+    const student_t *sb = b;
+
+    return (sa->id > sb->id) - (sa->id < sb->id);
+}
+
+static int cmp_seq_desc(const void *a, const void *b)
+{
+    uint32_t sa = *(const uint32_t *)a;
+    uint32_t sb = *(const uint32_t *)b;
+
+    return (sa < sb) - (sa > sb);
+}
+
+/*
+ *  The memtable keeps one record per id, the newest one.  mem_index is an
+ *  open addressing hash from id to slot + 1 (0 means empty) so lookups and
+ *  overwrites do not have to walk the memtable.
+ */
+static int *mem_find(lsm_db_t *db, int id)
+{
+    uint32_t h = ((uint32_t)id * 2654435761u) & (LSM_MEM_HASH - 1);
+
+    while (db->mem_index[h] != 0 && db->mem[db->mem_index[h] - 1].id != id)
+        h = (h + 1) & (LSM_MEM_HASH - 1);
+    return &db->mem_index[h];
+}
+
+static void mem_apply(lsm_db_t *db, const student_t *s)
+{
+    int *slot = mem_find(db, s->id);
+
+    if (*slot == 0) {
+        db->mem[db->mem_n] = *s;
+        *slot = ++db->mem_n;
+    } else {
+        db->mem[*slot - 1] = *s;
+    }
+}
+
+static void mem_reset(lsm_db_t *db)
+{
+    db->mem_n = 0;
+    memset(db->mem_index, 0, sizeof(db->mem_index));
+}
+
+static void mem_reindex(lsm_db_t *db)
+{
+    memset(db->mem_index, 0, sizeof(db->mem_index));
+    for (int i = 0; i < db->mem_n; i++)
+        *mem_find(db, db->mem[i].id) = i + 1;
+}
+
+static int wal_replay(lsm_db_t *db)
+{
+    student_t block[LSM_WRITE_RECORDS];
+    ssize_t n;
+
+    if (stats_lseek(db->wal_fd, 0, SEEK_SET) == (off_t)-1)
+        return ERR_DB_FILE;
+
+    // a torn record at the end of the log was never acknowledged, drop it
+    while ((n = stats_read(db->wal_fd, block, sizeof(block))) > 0) {
+        for (size_t i = 0; i < n / sizeof(student_t); i++) {
+            // lsm_put_student() flushes before the memtable overflows
+            if (db->mem_n >= LSM_MEMTABLE_MAX && *mem_find(db, block[i].id) == 0)
+                return ERR_DB_FILE;
+            mem_apply(db, &block[i]);
+        }
+    }
+    return n < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  list_runs
+ *      dir:   LSM directory
+ *      seqs:  filled in with the run sequence numbers, newest first
+ *      max:   size of seqs
+ *
+ *  returns:  the number of runs found, or ERR_DB_FILE
+ */
+static int list_runs(char *dir, uint32_t *seqs, int max)
+{
+    struct dirent *de;
+    unsigned int seq;
+    char extra;
+    int n = 0;
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return ERR_DB_FILE;
+    while ((de = readdir(d)) != NULL && n < max) {
+        if (sscanf(de->d_name, "run-%u.ss%c", &seq, &extra) == 2 && extra == 't')
+            seqs[n++] = seq;
+    }
+    closedir(d);
+
+    qsort(seqs, n, sizeof(uint32_t), cmp_seq_desc);
+    return n;
+}
+
+static int map_run(lsm_db_t *db, uint32_t seq, lsm_run_t *run)
+{
+    char path[512];
+    struct stat st;
+
+    memset(run, 0, sizeof(*run));
+    run->seq = seq;
+    snprintf(path, sizeof(path), LSM_RUN_FILE, db->dir, seq);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return ERR_DB_FILE;
+    }
+
+    run->n = st.st_size / sizeof(student_t);
+    if (run->n > 0) {
+        run->recs = mmap(NULL, run->n * sizeof(student_t), PROT_READ, MAP_SHARED, fd, 0);
+        if (run->recs == MAP_FAILED) {
+            run->recs = NULL;
+            close(fd);
+            return ERR_DB_FILE;
+        }
+    }
+    close(fd);
+    return NO_ERROR;
+}
+
+static void unmap_runs(lsm_db_t *db)
+{
+    for (int i = 0; i < db->nruns; i++) {
+        if (db->runs[i].recs != NULL)
+            munmap(db->runs[i].recs, db->runs[i].n * sizeof(student_t));
+    }
+    db->nruns = 0;
+}
+
+static int load_runs(lsm_db_t *db)
+{
+    uint32_t seqs[LSM_RUNS_OPEN_MAX];
+
+    unmap_runs(db);
+    int n = list_runs(db->dir, seqs, LSM_RUNS_OPEN_MAX);
+    if (n < 0)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < n; i++) {
+        if (map_run(db, seqs[i], &db->runs[db->nruns]) != NO_ERROR) {
+            unmap_runs(db);
+            return ERR_DB_FILE;
+        }
+        db->nruns++;
+        if (seqs[i] >= db->next_seq)
+            db->next_seq = seqs[i] + 1;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  sync_dir
+ *      db:  LSM state, used for the directory name
+ *
+ *  A rename() or unlink() is only durable once the directory is synced.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int sync_dir(lsm_db_t *db)
+{
+    int fd = open(db->dir, O_RDONLY | O_DIRECTORY);
+
+    if (fd < 0)
+        return ERR_DB_FILE;
+    int rc = fsync(fd) == 0 ? NO_ERROR : ERR_DB_FILE;
+    close(fd);
+    return rc;
+}
+
+static void remove_all(lsm_db_t *db)
+{
+    uint32_t seqs[1024];
+    char path[512];
+
+    int n = list_runs(db->dir, seqs, 1024);
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), LSM_RUN_FILE, db->dir, seqs[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), LSM_WAL_FILE, db->dir);
+    unlink(path);
+}
+
+/*
+ *  lsm_open_db
+ *      db:               LSM state to fill in
+ *      lsmDir:           name of the LSM database directory
+ *      should_truncate:  remove every record before opening
+ *
+ *  Creates lsmDir if needed, takes an exclusive lock on it so only one
+ *  sdbsc process works on the database at a time, replays the write ahead
+ *  log into the memtable and maps the runs.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_OPEN on error
+ */
+int lsm_open_db(lsm_db_t *db, char *lsmDir, bool should_truncate)
+{
+    char path[512];
+
+    memset(db, 0, sizeof(*db));
+    db->wal_fd = -1;
+    db->lock_fd = -1;
+    db->next_seq = 1;
+    strncpy(db->dir, lsmDir, sizeof(db->dir) - 1);
+
+    if (mkdir(db->dir, S_IRWXU | S_IRWXG) != 0 && !lsm_wanted(db->dir)) {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    snprintf(path, sizeof(path), LSM_LOCK_FILE, db->dir);
+    db->lock_fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (db->lock_fd < 0 || flock(db->lock_fd, LOCK_EX) != 0) {
+        printf(M_ERR_DB_OPEN);
+        lsm_close_db(db);
+        return ERR_DB_FILE;
+    }
+
+    if (should_truncate)
+        remove_all(db);
+
+    snprintf(path, sizeof(path), LSM_WAL_FILE, db->dir);
+    db->wal_fd = open(path, O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (db->wal_fd < 0 || load_runs(db) != NO_ERROR || wal_replay(db) != NO_ERROR) {
+        printf(M_ERR_DB_OPEN);
+        lsm_close_db(db);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  Merge iteration over the memtable and every run.  Source 0 is a sorted
+ *  copy of the memtable, then the runs newest first, so for an id that
+ *  shows up in several sources the lowest numbered source wins.
+ */
+typedef int (*lsm_visit_fn)(const student_t *s, void *ctx);
+
+typedef struct lsm_source{
+    const student_t *recs;
+    size_t           n;
+    size_t           pos;
+} lsm_source_t;
+
+static int lsm_merge(lsm_db_t *db, lsm_run_t *runs, int nruns, bool with_mem,
+                     lsm_visit_fn visit, void *ctx)
+{
+    lsm_source_t src[LSM_RUNS_OPEN_MAX + 1];
+    student_t *mem_sorted = NULL;
+    int nsrc = 0;
+    int rc = NO_ERROR;
+
+    if (with_mem && db->mem_n > 0) {
+        mem_sorted = malloc(db->mem_n * sizeof(student_t));
+        if (mem_sorted == NULL)
+            return ERR_DB_OP;
+        memcpy(mem_sorted, db->mem, db->mem_n * sizeof(student_t));
+        qsort(mem_sorted, db->mem_n, sizeof(student_t), cmp_student_id);
+        src[nsrc++] = (lsm_source_t){ mem_sorted, db->mem_n, 0 };
+    }
+    for (int i = 0; i < nruns; i++)
+        src[nsrc++] = (lsm_source_t){ runs[i].recs, runs[i].n, 0 };
+
+    while (rc == NO_ERROR) {
+        int winner = -1;
+
+        for (int i = 0; i < nsrc; i++) {
+            if (src[i].pos < src[i].n &&
+                (winner < 0 || src[i].recs[src[i].pos].id < src[winner].recs[src[winner].pos].id))
+                winner = i;
+        }
+        if (winner < 0)
+            break;
+
+        const student_t *s = &src[winner].recs[src[winner].pos];
+        int id = s->id;
+        for (int i = 0; i < nsrc; i++) {
+            if (src[i].pos < src[i].n && src[i].recs[src[i].pos].id == id)
+                src[i].pos++;
+        }
+
+        if (is_tombstone(s))
+            stats_hole(1);
+        else
+            rc = visit(s, ctx);
+    }
+
+    free(mem_sorted);
+    return rc;
+}
+
+/*
+ *  Buffered writer for run files.
+ */
+typedef struct run_writer{
+    int       fd;
+    int       n;
+    size_t    total;
+    student_t buf[LSM_WRITE_RECORDS];
+} run_writer_t;
+
+static int run_writer_flush(run_writer_t *w)
+{
+    size_t len = w->n * sizeof(student_t);
+
+    if (len > 0 && stats_write(w->fd, w->buf, len) != (ssize_t)len)
+        return ERR_DB_FILE;
+    w->n = 0;
+    return NO_ERROR;
+}
+
+static int run_writer_add(const student_t *s, void *ctx)
+{
+    run_writer_t *w = ctx;
+
+    w->buf[w->n++] = *s;
+    w->total++;
+    if (w->n == LSM_WRITE_RECORDS)
+        return run_writer_flush(w);
+    return NO_ERROR;
+}
+
+/*
+ *  lsm_flush
+ *      db:  LSM state
+ *
+ *  Writes the memtable out as a new sorted run and empties the write
+ *  ahead log.  The run is written to a temporary name and renamed so a
+ *  crash never leaves a partial run behind, and the log is only truncated
+ *  after the run and its directory entry are durable.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int lsm_flush(lsm_db_t *db)
+{
+    char tmp[512];
+    char path[512];
+    run_writer_t *w;
+    int rc = NO_ERROR;
+
+    if (db->mem_n == 0)
+        return NO_ERROR;
+
+    w = malloc(sizeof(*w));
+    if (w == NULL)
+        return ERR_DB_OP;
+
+    uint32_t seq = db->next_seq++;
+    snprintf(tmp, sizeof(tmp), LSM_TMP_RUN_FILE, db->dir, seq);
+    snprintf(path, sizeof(path), LSM_RUN_FILE, db->dir, seq);
+
+    qsort(db->mem, db->mem_n, sizeof(student_t), cmp_student_id);
+    w->n = 0;
+    w->total = 0;
+    w->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (w->fd < 0) {
+        mem_reindex(db);
+        free(w);
+        return ERR_DB_FILE;
+    }
+    for (int i = 0; i < db->mem_n && rc == NO_ERROR; i++)
+        rc = run_writer_add(&db->mem[i], w);
+    if (rc == NO_ERROR)
+        rc = run_writer_flush(w);
+    if (rc == NO_ERROR && (fsync(w->fd) != 0 || rename(tmp, path) != 0 ||
+                           sync_dir(db) != NO_ERROR))
+        rc = ERR_DB_FILE;
+    close(w->fd);
+    free(w);
+
+    // the sort moved every memtable slot
+    if (rc != NO_ERROR) {
+        mem_reindex(db);
+        unlink(tmp);
+        return rc;
+    }
+
+    // anything still buffered for the log is in the run now
+    db->wal_n = 0;
+    if (ftruncate(db->wal_fd, 0) != 0)
+        return ERR_DB_FILE;
+    mem_reset(db);
+
+    if (load_runs(db) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (db->nruns >= LSM_RUNS_OPEN_MAX)
+        return lsm_compact(db);
+    return NO_ERROR;
+}
+
+/*
+ *  compact_runs
+ *      db:     LSM state, used for the directory name
+ *      runs:   the runs to merge, newest first
+ *      nruns:  number of runs
+ *      lock:   take the database lock before swapping files in.  The
+ *              foreground compaction already holds it.
+ *
+ *  Merges the runs into one, replacing the newest of them.  The merge
+ *  covers every run that existed when it started, including the oldest,
+ *  so tombstones have nothing left to hide and are dropped.  Runs flushed
+ *  while a background merge is running have higher sequence numbers and
+ *  are left alone.  The directory is synced once the newest run has been
+ *  replaced, before the older ones are removed, so a crash can not leave
+ *  the old records without the tombstones or updates that hid them.
+ *
+ *  returns:  number of records in the merged run, or ERR_DB_FILE
+ */
+static int compact_runs(lsm_db_t *db, lsm_run_t *runs, int nruns, bool lock)
+{
+    char tmp[512];
+    char path[512];
+    struct stat st;
+    run_writer_t *w;
+    int lock_fd = -1;
+    int rc;
+
+    if (nruns == 0)
+        return 0;
+
+    w = malloc(sizeof(*w));
+    if (w == NULL)
+        return ERR_DB_OP;
+
+    uint32_t seq = runs[0].seq;
+    snprintf(tmp, sizeof(tmp), LSM_TMP_RUN_FILE, db->dir, seq);
+    w->n = 0;
+    w->total = 0;
+    w->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (w->fd < 0) {
+        free(w);
+        return ERR_DB_FILE;
+    }
+
+    rc = lsm_merge(db, runs, nruns, false, run_writer_add, w);
+    if (rc == NO_ERROR)
+        rc = run_writer_flush(w);
+    if (rc == NO_ERROR && fsync(w->fd) != 0)
+        rc = ERR_DB_FILE;
+    close(w->fd);
+    size_t total = w->total;
+    free(w);
+
+    if (rc == NO_ERROR && lock) {
+        snprintf(path, sizeof(path), LSM_LOCK_FILE, db->dir);
+        lock_fd = open(path, O_RDWR);
+        if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0)
+            rc = ERR_DB_FILE;
+    }
+
+    // somebody else may have compacted or zeroed the db while we merged
+    for (int i = 0; rc == NO_ERROR && i < nruns; i++) {
+        snprintf(path, sizeof(path), LSM_RUN_FILE, db->dir, runs[i].seq);
+        if (stat(path, &st) != 0)
+            rc = ERR_DB_FILE;
+    }
+
+    if (rc == NO_ERROR) {
+        snprintf(path, sizeof(path), LSM_RUN_FILE, db->dir, seq);
+        if (total == 0 ? unlink(path) != 0 : rename(tmp, path) != 0)
+            rc = ERR_DB_FILE;
+        if (rc == NO_ERROR)
+            rc = sync_dir(db);
+        for (int i = 1; rc == NO_ERROR && i < nruns; i++) {
+            snprintf(path, sizeof(path), LSM_RUN_FILE, db->dir, runs[i].seq);
+            unlink(path);
+        }
+    }
+    unlink(tmp);
+
+    if (lock_fd >= 0)
+        close(lock_fd);
+    return rc == NO_ERROR ? (int)total : rc;
+}
+
+/*
+ *  compact_background
+ *      db:  LSM state
+ *
+ *  Starts a compaction of the current runs in a detached process so the
+ *  caller does not wait for it.  The process forks twice so the
+ *  compactor is adopted by init and never left as a zombie, and only one
+ *  compactor runs at a time, guarded by the COMPACT lock file.  The runs
+ *  are immutable and stay mapped in the child, so it can merge them
+ *  while this process keeps going, and only takes the database lock to
+ *  swap the result in.
+ */
+static void compact_background(lsm_db_t *db)
+{
+    char path[512];
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return;
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    if (fork() != 0)
+        _exit(0);
+
+    // drop the inherited database lock, it belongs to the parent
+    close(db->lock_fd);
+    close(db->wal_fd);
+
+    snprintf(path, sizeof(path), LSM_COMPACT_FILE, db->dir);
+    int compact_fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (compact_fd < 0 || flock(compact_fd, LOCK_EX | LOCK_NB) != 0)
+        _exit(0);
+
+    compact_runs(db, db->runs, db->nruns, true);
+    _exit(0);
+}
+
+/*
+ *  lsm_compact
+ *      db:  LSM state
+ *
+ *  Foreground compaction: flushes the memtable and merges every run into
+ *  one.  Used by sdbsc -x and when too many runs pile up.
+ *
+ *  returns:  number of runs left (0 or 1), or ERR_DB_FILE
+ */
+int lsm_compact(lsm_db_t *db)
+{
+    int rc;
+
+    if (db->mem_n > 0 && (rc = lsm_flush(db)) != NO_ERROR)
+        return rc;
+
+    rc = compact_runs(db, db->runs, db->nruns, false);
+    if (rc < 0)
+        return rc;
+    if (load_runs(db) != NO_ERROR)
+        return ERR_DB_FILE;
+    return db->nruns;
+}
+
+/*
+ *  lsm_close_db
+ *      db:  LSM state
+ *
+ *  Kicks off a background compaction if there are more than LSM_MAX_RUNS
+ *  runs, then releases everything.  The memtable does not need flushing,
+ *  it is already in the write ahead log.
+ */
+void lsm_close_db(lsm_db_t *db)
+{
+    if (db->wal_fd >= 0)
+        lsm_sync_wal(db);
+    if (db->nruns > LSM_MAX_RUNS && db->lock_fd >= 0)
+        compact_background(db);
+
+    unmap_runs(db);
+    if (db->wal_fd >= 0)
+        close(db->wal_fd);
+    if (db->lock_fd >= 0)
+        close(db->lock_fd);
+    db->wal_fd = -1;
+    db->lock_fd = -1;
+}
+
+static const student_t *run_find(lsm_run_t *run, int id)
+{
+    size_t lo = 0;
+    size_t hi = run->n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (run->recs[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < run->n && run->recs[lo].id == id) ? &run->recs[lo] : NULL;
+}
+
+/*
+ *  lsm_get_student
+ *      db:  LSM state
+ *      id:  the student id we are looking for
+ *      *s:  where the student is copied if found
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            SRCH_NOT_FOUND student was not located, or was deleted
+ *
+ *  console:  Does not produce any console I/O
+ */
+int lsm_get_student(lsm_db_t *db, int id, student_t *s)
+{
+    const student_t *found = NULL;
+    int slot = *mem_find(db, id);
+
+    if (slot != 0)
+        found = &db->mem[slot - 1];
+    for (int i = 0; found == NULL && i < db->nruns; i++)
+        found = run_find(&db->runs[i], id);
+
+    if (found == NULL || is_tombstone(found))
+        return SRCH_NOT_FOUND;
+    *s = *found;
+    return NO_ERROR;
+}
+
+/*
+ *  lsm_sync_wal
+ *      db:  LSM state
+ *
+ *  Writes the log records buffered while batching with one write().
+ *  The log is not fsync()ed, see LSM_DIR in sdblsm.h.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int lsm_sync_wal(lsm_db_t *db)
+{
+    size_t len = db->wal_n * sizeof(student_t);
+
+    if (len > 0 && stats_write(db->wal_fd, db->wal_buf, len) != (ssize_t)len)
+        return ERR_DB_FILE;
+    db->wal_n = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  lsm_put_student
+ *      db:  LSM state
+ *      *s:  record to store, a tombstone deletes s->id
+ *
+ *  Appends the record to the write ahead log and applies it to the
+ *  memtable, flushing the memtable to a run if it is full.  While
+ *  db->batching is set the log append is buffered until LSM_WAL_BATCH
+ *  records are pending or lsm_sync_wal() is called.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int lsm_put_student(lsm_db_t *db, student_t *s)
+{
+    if (db->mem_n >= LSM_MEMTABLE_MAX && *mem_find(db, s->id) == 0) {
+        int rc = lsm_flush(db);
+        if (rc != NO_ERROR)
+            return rc;
+    }
+
+    db->wal_buf[db->wal_n++] = *s;
+    mem_apply(db, s);
+    if (!db->batching || db->wal_n == LSM_WAL_BATCH)
+        return lsm_sync_wal(db);
+    return NO_ERROR;
+}
+
+/*
+ *  lsm_add_student
+ *
+ *  LSM version of add_student(), same arguments, return codes and console
+ *  output.
+ */
+int lsm_add_student(lsm_db_t *db, int id, char *fname, char *lname, int gpa)
+{
+    student_t cur;
+
+    if (lsm_get_student(db, id, &cur) == NO_ERROR) {
+        printf(M_ERR_DB_ADD_DUP, id);
+        return ERR_DB_OP;
+    }
+
+    student_t s = { .id = id, .gpa = gpa };
+    strncpy(s.fname, fname, sizeof(s.fname) - 1);
+    strncpy(s.lname, lname, sizeof(s.lname) - 1);
+
+    if (lsm_put_student(db, &s) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    printf(M_STD_ADDED, id);
+    return NO_ERROR;
+}
+
+/*
+ *  lsm_del_student
+ *
+ *  LSM version of del_student(), same arguments, return codes and console
+ *  output.  Writes a tombstone for the id.
+ */
+int lsm_del_student(lsm_db_t *db, int id)
+{
+    student_t cur;
+
+    if (lsm_get_student(db, id, &cur) != NO_ERROR) {
+        printf(M_STD_NOT_FND_MSG, id);
+        return ERR_DB_OP;
+    }
+
+    student_t tomb = { .id = id, .gpa = LSM_TOMBSTONE };
+    if (lsm_put_student(db, &tomb) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    printf(M_STD_DEL_MSG, id);
+    return NO_ERROR;
+}
+
+static int count_visit(const student_t *s, void *ctx)
+{
+    (void)s;
+    (*(int *)ctx)++;
+    return NO_ERROR;
+}
+
+static int print_visit(const student_t *s, void *ctx)
+{
+    bool *hasPrintedHeader = ctx;
+
+    if (!*hasPrintedHeader) {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        *hasPrintedHeader = true;
+    }
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0);
+    return NO_ERROR;
+}
+
+/*
+ *  lsm_count_db_records
+ *
+ *  LSM version of count_db_records(), same return codes and console
+ *  output.
+ */
+int lsm_count_db_records(lsm_db_t *db)
+{
+    int count = 0;
+
+    if (lsm_merge(db, db->runs, db->nruns, true, count_visit, &count) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (count == 0)
+        printf(M_DB_EMPTY);
+    else
+        printf(M_DB_RECORD_CNT, count);
+    return count;
+}
+
+/*
+ *  lsm_print_db
+ *
+ *  LSM version of print_db(), same return codes and console output.
+ */
+int lsm_print_db(lsm_db_t *db)
+{
+    bool hasPrintedHeader = false;
+
+    if (lsm_merge(db, db->runs, db->nruns, true, print_visit, &hasPrintedHeader) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (!hasPrintedHeader)
+        printf(M_DB_EMPTY);
+    return NO_ERROR;
+}
+
+/*
+ *  lsm_load_db
+ *      db:        LSM state
+ *      loadFile:  text file with one "id first_name last_name gpa" per line
+ *
+ *  LSM version of shard_load_db(), same file format and console output.
+ *  This is the ingest path the engine is built for, every record is a
+ *  sequential append to the log, written LSM_WAL_BATCH records at a time.
+ */
+int lsm_load_db(lsm_db_t *db, char *loadFile)
+{
+    char line[256];
+    int lineno = 0;
+    int loaded = 0;
+    int dups = 0;
+    student_t cur;
+
+    FILE *in = fopen(loadFile, "r");
+    if (in == NULL) {
+        printf(M_ERR_LOAD_OPEN, loadFile);
+        return ERR_DB_FILE;
+    }
+    db->batching = true;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        student_t s = EMPTY_STUDENT_RECORD;
+
+        lineno++;
+        if (sscanf(line, "%d %23s %31s %d", &s.id, s.fname, s.lname, &s.gpa) != 4 ||
+            validate_range(s.id, s.gpa) != NO_ERROR) {
+            printf(M_ERR_LOAD_LINE, lineno);
+            continue;
+        }
+        if (lsm_get_student(db, s.id, &cur) == NO_ERROR) {
+            dups++;
+            continue;
+        }
+        if (lsm_put_student(db, &s) != NO_ERROR) {
+            db->batching = false;
+            fclose(in);
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+        loaded++;
+    }
+    fclose(in);
+
+    db->batching = false;
+    if (lsm_sync_wal(db) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_LOADED, loaded, dups);
+    return NO_ERROR;
+}
@@ -0,0 +1,85 @@
+#ifndef __SDB_LSM_H__
+    #define __SDB_LSM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "db.h"
+
+//Log structured (LSM) engine for write heavy ingest.  Instead of writing
+//every student into its slot of a large sparse file, changes are appended
+//to a write ahead log and collected in an in memory memtable.  When the
+//memtable fills up it is sorted and written out as an immutable run, and
+//when there are too many runs they are merged by a background compaction.
+//Every write is sequential.
+//
+//  LSM_DIR/wal.log          memtable contents, replayed at open
+//  LSM_DIR/run-NNNNNN.sst   sorted student_t records, higher NNNNNN is newer
+//  LSM_DIR/LOCK             flock()ed by every sdbsc process using the db
+//
+//A delete is a tombstone record (gpa == LSM_TOMBSTONE) rather than an
+//EMPTY_STUDENT_RECORD.  Reads check the memtable, then the runs newest
+//first, and the first record found for an id wins.
+//
+//The log is written on every change but not fsync()ed, the same promise
+//the student.db engine makes: a change survives sdbsc crashing, not the
+//machine.  Runs are fsync()ed, and the directory after they are renamed
+//in, before the log they replace is truncated or older runs are removed.
+//
+//The engine is used when LSM_DIR exists or SDB_ENGINE=lsm.
+
+#define LSM_DIR             "student.lsm"
+#define LSM_ENGINE_ENV      "SDB_ENGINE"
+#define LSM_WAL_FILE        "%s/wal.log"
+#define LSM_RUN_FILE        "%s/run-%06u.sst"
+#define LSM_TMP_RUN_FILE    "%s/.tmp-run-%06u.sst"
+#define LSM_LOCK_FILE       "%s/LOCK"
+#define LSM_COMPACT_FILE    "%s/COMPACT"
+
+#define LSM_TOMBSTONE       -1
+#define LSM_MEMTABLE_MAX    4096    //records, 256K of student_t
+#define LSM_MEM_HASH        8192    //power of 2, > LSM_MEMTABLE_MAX
+#define LSM_MAX_RUNS        4       //compact when there are more runs
+#define LSM_RUNS_OPEN_MAX   64      //compact in the foreground past this
+#define LSM_WAL_BATCH       256     //log records per write() while loading
+
+typedef struct lsm_run{
+    uint32_t   seq;
+    student_t *recs;        //mmap()ed run file
+    size_t     n;
+} lsm_run_t;
+
+typedef struct lsm_db{
+    char       dir[256];
+    int        wal_fd;
+    int        lock_fd;
+    bool       batching;                    //buffer log appends, see lsm_load_db()
+    int        wal_n;
+    student_t  wal_buf[LSM_WAL_BATCH];
+    student_t  mem[LSM_MEMTABLE_MAX];
+    int        mem_n;
+    int        mem_index[LSM_MEM_HASH];     //id hash -> mem slot + 1
+    lsm_run_t  runs[LSM_RUNS_OPEN_MAX];     //newest first
+    int        nruns;
+    uint32_t   next_seq;
+} lsm_db_t;
+
+//prototypes
+bool lsm_wanted(char *lsmDir);
+int  lsm_open_db(lsm_db_t *db, char *lsmDir, bool should_truncate);
+void lsm_close_db(lsm_db_t *db);
+int  lsm_get_student(lsm_db_t *db, int id, student_t *s);
+int  lsm_put_student(lsm_db_t *db, student_t *s);
+int  lsm_add_student(lsm_db_t *db, int id, char *fname, char *lname, int gpa);
+int  lsm_del_student(lsm_db_t *db, int id);
+int  lsm_count_db_records(lsm_db_t *db);
+int  lsm_print_db(lsm_db_t *db);
+int  lsm_sync_wal(lsm_db_t *db);
+int  lsm_flush(lsm_db_t *db);
+int  lsm_compact(lsm_db_t *db);
+int  lsm_load_db(lsm_db_t *db, char *loadFile);
+
+#define M_LSM_COMPACTED_OK  "Database successfully compacted into %d run(s)!\n"
+
+#endif
@@ -0,0 +1,663 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbmem.h"
+#include "sdbstats.h"
+
+static uint32_t hash_id(int id)
+{
+    return (uint32_t)id * 2654435761u;
+}
+
+static uint32_t hash_name(const char *s)
+{
+    uint32_t h = 2166136261u;       //FNV-1a
+
+    while (*s != '\0')
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+/*
+ *  mem_source_sig
+ *      map:  shard map of the database files
+ *      hdr:  header whose src_size and src_mtime_ns are filled in
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if a file could not be stat()ed
+ */
+static int mem_source_sig(shard_map_t *map, mem_header_t *hdr)
+{
+    struct stat st;
+
+    hdr->src_size = 0;
+    hdr->src_mtime_ns = 0;
+    for (int i = 0; i < map->nshards; i++) {
+        if (fstat(map->fds[i], &st) != 0)
+            return ERR_DB_FILE;
+
+        uint64_t mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+        hdr->src_size += st.st_size;
+        if (mtime > hdr->src_mtime_ns)
+            hdr->src_mtime_ns = mtime;
+    }
+    return NO_ERROR;
+}
+
+static bool owned(mem_db_t *mem, void *p)
+{
+    char *b = mem->block;
+
+    return b == NULL || (char *)p < b || (char *)p >= b + mem->block_len;
+}
+
+/*
+ *  Name interning.  Every distinct name is stored once in the arena and
+ *  records hold its offset.  The arena starts with an empty string so
+ *  offset 0 is always valid.
+ */
+static int arena_reserve(mem_db_t *mem, size_t len)
+{
+    if (mem->arena_len + len <= mem->arena_cap)
+        return NO_ERROR;
+
+    uint32_t cap = mem->arena_cap ? mem->arena_cap : MEM_MIN_ARENA;
+    while (cap < mem->arena_len + len)
+        cap *= 2;
+
+    char *arena = owned(mem, mem->arena) ? realloc(mem->arena, cap) : malloc(cap);
+    if (arena == NULL)
+        return ERR_DB_OP;
+    if (!owned(mem, mem->arena))
+        memcpy(arena, mem->arena, mem->arena_len);
+    mem->arena = arena;
+    mem->arena_cap = cap;
+    return NO_ERROR;
+}
+
+static int names_grow(mem_db_t *mem)
+{
+    uint32_t nslots = mem->names_slots ? mem->names_slots * 2 : MEM_MIN_SLOTS;
+    uint32_t *names = calloc(nslots, sizeof(uint32_t));
+
+    if (names == NULL)
+        return ERR_DB_OP;
+    for (uint32_t i = 0; i < mem->names_slots; i++) {
+        uint32_t off = mem->names[i];
+        if (off == 0)
+            continue;
+        uint32_t h = hash_name(mem->arena + off - 1) & (nslots - 1);
+        while (names[h] != 0)
+            h = (h + 1) & (nslots - 1);
+        names[h] = off;
+    }
+    free(mem->names);
+    mem->names = names;
+    mem->names_slots = nslots;
+    return NO_ERROR;
+}
+
+static int intern(mem_db_t *mem, const char *name, size_t max, uint32_t *off)
+{
+    char buf[64];
+    size_t len = strnlen(name, max);
+
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+
+    if ((mem->names_n + 1) * 2 > mem->names_slots && names_grow(mem) != NO_ERROR)
+        return ERR_DB_OP;
+
+    uint32_t h = hash_name(buf) & (mem->names_slots - 1);
+    while (mem->names[h] != 0) {
+        if (strcmp(mem->arena + mem->names[h] - 1, buf) == 0) {
+            *off = mem->names[h] - 1;
+            return NO_ERROR;
+        }
+        h = (h + 1) & (mem->names_slots - 1);
+    }
+
+    if (arena_reserve(mem, len + 1) != NO_ERROR)
+        return ERR_DB_OP;
+    *off = mem->arena_len;
+    memcpy(mem->arena + mem->arena_len, buf, len + 1);
+    mem->arena_len += len + 1;
+    mem->names[h] = *off + 1;
+    mem->names_n++;
+    return NO_ERROR;
+}
+
+// rebuild the intern table from an arena read out of a snapshot
+static int intern_arena(mem_db_t *mem)
+{
+    uint32_t off = 0;
+
+    while (off < mem->arena_len) {
+        const char *s = mem->arena + off;
+        size_t len = strnlen(s, mem->arena_len - off);
+
+        if ((mem->names_n + 1) * 2 > mem->names_slots && names_grow(mem) != NO_ERROR)
+            return ERR_DB_OP;
+        uint32_t h = hash_name(s) & (mem->names_slots - 1);
+        while (mem->names[h] != 0)
+            h = (h + 1) & (mem->names_slots - 1);
+        mem->names[h] = off + 1;
+        mem->names_n++;
+        off += len + 1;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  The record table, linear probing with backward shift deletion so there
+ *  are no tombstones.
+ */
+static mem_entry_t *slot_find(mem_db_t *mem, int id)
+{
+    uint32_t mask = mem->nslots - 1;
+    uint32_t h = hash_id(id) & mask;
+
+    while (mem->slots[h].id != 0 && mem->slots[h].id != id)
+        h = (h + 1) & mask;
+    return &mem->slots[h];
+}
+
+static int slots_grow(mem_db_t *mem)
+{
+    mem_entry_t *old = mem->slots;
+    uint32_t old_n = mem->nslots;
+    uint32_t nslots = old_n ? old_n * 2 : MEM_MIN_SLOTS;
+
+    mem_entry_t *slots = calloc(nslots, sizeof(mem_entry_t));
+    if (slots == NULL)
+        return ERR_DB_OP;
+
+    bool free_old = old != NULL && owned(mem, old);
+    mem->slots = slots;
+    mem->nslots = nslots;
+    for (uint32_t i = 0; i < old_n; i++) {
+        if (old[i].id != 0)
+            *slot_find(mem, old[i].id) = old[i];
+    }
+    if (free_old)
+        free(old);
+    return NO_ERROR;
+}
+
+static int mem_put(mem_db_t *mem, const student_t *s)
+{
+    mem_entry_t e = { .id = s->id, .gpa = s->gpa };
+
+    if ((mem->n + 1) * 2 > mem->nslots && slots_grow(mem) != NO_ERROR)
+        return ERR_DB_OP;
+    if (intern(mem, s->fname, sizeof(s->fname), &e.fname) != NO_ERROR ||
+        intern(mem, s->lname, sizeof(s->lname), &e.lname) != NO_ERROR)
+        return ERR_DB_OP;
+
+    mem_entry_t *slot = slot_find(mem, s->id);
+    if (slot->id == 0)
+        mem->n++;
+    *slot = e;
+    return NO_ERROR;
+}
+
+static void mem_remove(mem_db_t *mem, int id)
+{
+    uint32_t mask = mem->nslots - 1;
+    mem_entry_t *slot = slot_find(mem, id);
+
+    if (slot->id == 0)
+        return;
+
+    uint32_t i = slot - mem->slots;
+    uint32_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (mem->slots[j].id == 0)
+            break;
+        uint32_t k = hash_id(mem->slots[j].id) & mask;
+        // move j back into the hole unless its home lies cyclically in (i, j]
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            mem->slots[i] = mem->slots[j];
+            i = j;
+        }
+    }
+    mem->slots[i].id = 0;
+    mem->n--;
+}
+
+/*
+ *  mem_snapshot_valid
+ *
+ *  The slots and arena are used in place, so a damaged snapshot must not
+ *  get that far: every name offset has to land in the arena, the arena
+ *  has to end in '\0' so every name is terminated, and the table needs
+ *  free slots or a probe for a missing id would never end.
+ *
+ *  returns:  true if the table in hdr can be used
+ */
+static bool mem_snapshot_valid(mem_header_t *hdr)
+{
+    mem_entry_t *slots = (mem_entry_t *)(hdr + 1);
+    char *arena = (char *)(slots + hdr->nslots);
+    uint32_t live = 0;
+
+    if (hdr->arena_len == 0 || arena[hdr->arena_len - 1] != '\0' ||
+        hdr->nrecords > (uint64_t)hdr->nslots * 3 / 4)
+        return false;
+
+    for (uint32_t i = 0; i < hdr->nslots; i++) {
+        if (slots[i].id == 0)
+            continue;
+        if (slots[i].fname >= hdr->arena_len || slots[i].lname >= hdr->arena_len)
+            return false;
+        live++;
+    }
+    return live == hdr->nrecords;
+}
+
+/*
+ *  mem_load_snapshot
+ *
+ *  Reads MEM_SNAP_FILE with one read() if it matches the database files
+ *  described by want.  The slots and arena are used in place.
+ *
+ *  returns:  NO_ERROR if the snapshot was loaded, SRCH_NOT_FOUND if it is
+ *            missing, stale or damaged, ERR_DB_OP if out of memory
+ */
+static int mem_load_snapshot(mem_db_t *mem, mem_header_t *want)
+{
+    struct stat st;
+
+    int fd = open(MEM_SNAP_FILE, O_RDONLY);
+    if (fd < 0)
+        return SRCH_NOT_FOUND;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(mem_header_t)) {
+        close(fd);
+        return SRCH_NOT_FOUND;
+    }
+
+    void *block = malloc(st.st_size);
+    if (block == NULL) {
+        close(fd);
+        return ERR_DB_OP;
+    }
+    ssize_t n = stats_read(fd, block, st.st_size);
+    close(fd);
+    mem->load_reads++;
+
+    mem_header_t *hdr = block;
+    if (n != st.st_size ||
+        memcmp(hdr->magic, MEM_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->src_size != want->src_size ||
+        hdr->src_mtime_ns != want->src_mtime_ns ||
+        hdr->nslots == 0 || (hdr->nslots & (hdr->nslots - 1)) != 0 ||
+        (size_t)st.st_size != sizeof(mem_header_t) +
+                              (size_t)hdr->nslots * sizeof(mem_entry_t) + hdr->arena_len ||
+        !mem_snapshot_valid(hdr)) {
+        free(block);
+        return SRCH_NOT_FOUND;
+    }
+
+    mem->block = block;
+    mem->block_len = st.st_size;
+    mem->nslots = hdr->nslots;
+    mem->n = hdr->nrecords;
+    mem->slots = (mem_entry_t *)(hdr + 1);
+    mem->arena = (char *)(mem->slots + mem->nslots);
+    mem->arena_len = hdr->arena_len;
+    mem->arena_cap = hdr->arena_len;
+    mem->from_snapshot = true;
+    return intern_arena(mem);
+}
+
+/*
+ *  mem_load_files
+ *
+ *  Reads every database file with a single read() into one buffer and
+ *  inserts the live records.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE or ERR_DB_OP
+ */
+static int mem_load_files(mem_db_t *mem)
+{
+    struct stat st;
+    char *buf = NULL;
+    uint32_t empty;
+    int rc = NO_ERROR;
+
+    if (slots_grow(mem) != NO_ERROR || intern(mem, "", 1, &empty) != NO_ERROR)
+        return ERR_DB_OP;
+
+    for (int i = 0; i < mem->map->nshards && rc == NO_ERROR; i++) {
+        int fd = mem->map->fds[i];
+        if (fstat(fd, &st) != 0)
+            return ERR_DB_FILE;
+        if (st.st_size == 0)
+            continue;
+
+        char *p = realloc(buf, st.st_size);
+        if (p == NULL) {
+            rc = ERR_DB_OP;
+            break;
+        }
+        buf = p;
+
+        ssize_t n = stats_pread(fd, buf, st.st_size, 0);
+        mem->load_reads++;
+        if (n < 0) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        student_t *recs = (student_t *)buf;
+        for (size_t r = 0; r < n / sizeof(student_t) && rc == NO_ERROR; r++) {
+            if (memcmp(&recs[r], &EMPTY_STUDENT_RECORD, sizeof(student_t)) == 0)
+                stats_hole(1);
+            else
+                rc = mem_put(mem, &recs[r]);
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+/*
+ *  mem_open_db
+ *      mem:  in-memory state to fill in
+ *      map:  open database, changes are written through to it
+ *
+ *  Loads the snapshot if it is current, otherwise loads the database
+ *  files and writes a new snapshot.
+ *
+ *  returns:  NO_ERROR       every live record is in memory
+ *            ERR_DB_FILE    database I/O issue
+ *            ERR_DB_OP      out of memory
+ *
+ *  console:  M_MEM_LOADED on success
+ *            M_ERR_DB_READ on error
+ */
+int mem_open_db(mem_db_t *mem, shard_map_t *map)
+{
+    mem_header_t want = {0};
+    uint64_t start = stats_now_ns();
+    int rc;
+
+    memset(mem, 0, sizeof(*mem));
+    mem->map = map;
+    if (mem_source_sig(map, &want) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = mem_load_snapshot(mem, &want);
+    if (rc == SRCH_NOT_FOUND) {
+        rc = mem_load_files(mem);
+        if (rc == NO_ERROR)
+            mem->dirty = 1;
+    }
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        mem_close_db(mem);
+        return rc;
+    }
+    mem->load_ns = stats_now_ns() - start;
+
+    printf(M_MEM_LOADED, mem->n, mem->from_snapshot ? MEM_SNAP_FILE : "the database",
+           mem->load_ns / 1e6, mem->load_reads);
+    if (mem->dirty)
+        mem_snapshot(mem);
+    return NO_ERROR;
+}
+
+/*
+ *  mem_close_db
+ *      mem:  in-memory state
+ *
+ *  Writes a final snapshot if anything changed since the last one and
+ *  frees the table.
+ */
+void mem_close_db(mem_db_t *mem)
+{
+    if (mem->dirty > 0 && mem->slots != NULL)
+        mem_snapshot(mem);
+
+    if (owned(mem, mem->slots))
+        free(mem->slots);
+    if (owned(mem, mem->arena))
+        free(mem->arena);
+    free(mem->names);
+    free(mem->block);
+    memset(mem, 0, sizeof(*mem));
+}
+
+/*
+ *  mem_snapshot
+ *      mem:  in-memory state
+ *
+ *  Writes header, slots and arena to MEM_SNAP_TMP_FILE with one writev()
+ *  and renames it over MEM_SNAP_FILE.  The header takes the signature of
+ *  the database files as they are now, every change has already been
+ *  written through to them.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_WRITE on error
+ */
+int mem_snapshot(mem_db_t *mem)
+{
+    mem_header_t hdr = {0};
+    struct iovec iov[3];
+
+    memcpy(hdr.magic, MEM_MAGIC, sizeof(hdr.magic));
+    hdr.nrecords = mem->n;
+    hdr.nslots = mem->nslots;
+    hdr.arena_len = mem->arena_len;
+    if (mem_source_sig(mem->map, &hdr) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    iov[0] = (struct iovec){ &hdr, sizeof(hdr) };
+    iov[1] = (struct iovec){ mem->slots, (size_t)mem->nslots * sizeof(mem_entry_t) };
+    iov[2] = (struct iovec){ mem->arena, mem->arena_len };
+    size_t total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+    int fd = open(MEM_SNAP_TMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd < 0 || writev(fd, iov, 3) != (ssize_t)total || close(fd) != 0 ||
+        rename(MEM_SNAP_TMP_FILE, MEM_SNAP_FILE) != 0) {
+        if (fd >= 0)
+            unlink(MEM_SNAP_TMP_FILE);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    mem->dirty = 0;
+    return NO_ERROR;
+}
+
+static int mem_changed(mem_db_t *mem)
+{
+    if (++mem->dirty >= MEM_SNAPSHOT_OPS)
+        return mem_snapshot(mem);
+    return NO_ERROR;
+}
+
+/*
+ *  mem_get_student
+ *
+ *  In-memory version of get_student(), same return codes.  Does not touch
+ *  the database files.
+ */
+int mem_get_student(mem_db_t *mem, int id, student_t *s)
+{
+    if (id == 0)
+        return SRCH_NOT_FOUND;
+
+    mem_entry_t *e = slot_find(mem, id);
+    if (e->id == 0)
+        return SRCH_NOT_FOUND;
+
+    memset(s, 0, sizeof(*s));
+    s->id = e->id;
+    s->gpa = e->gpa;
+    strncpy(s->fname, mem->arena + e->fname, sizeof(s->fname) - 1);
+    strncpy(s->lname, mem->arena + e->lname, sizeof(s->lname) - 1);
+    return NO_ERROR;
+}
+
+/*
+ *  mem_add_student
+ *
+ *  Same arguments, return codes and console output as add_student(), the
+ *  duplicate check is answered from memory and the record is written
+ *  through to the database file.
+ */
+int mem_add_student(mem_db_t *mem, int id, char *fname, char *lname, int gpa)
+{
+    student_t s;
+
+    if (mem_get_student(mem, id, &s) == NO_ERROR) {
+        printf(M_ERR_DB_ADD_DUP, id);
+        return ERR_DB_OP;
+    }
+
+    int rc = add_student(shard_fd(mem->map, id), id, fname, lname, gpa);
+    if (rc != NO_ERROR)
+        return rc;
+
+    memset(&s, 0, sizeof(s));
+    s.id = id;
+    s.gpa = gpa;
+    strncpy(s.fname, fname, sizeof(s.fname) - 1);
+    strncpy(s.lname, lname, sizeof(s.lname) - 1);
+    if (mem_put(mem, &s) != NO_ERROR)
+        return ERR_DB_OP;
+    return mem_changed(mem);
+}
+
+/*
+ *  mem_del_student
+ *
+ *  Same arguments, return codes and console output as del_student().
+ */
+int mem_del_student(mem_db_t *mem, int id)
+{
+    student_t s;
+
+    if (mem_get_student(mem, id, &s) != NO_ERROR) {
+        printf(M_STD_NOT_FND_MSG, id);
+        return ERR_DB_OP;
+    }
+
+    int rc = del_student(shard_fd(mem->map, id), id);
+    if (rc != NO_ERROR)
+        return rc;
+
+    mem_remove(mem, id);
+    return mem_changed(mem);
+}
+
+/*
+ *  mem_report
+ *      mem:  in-memory state
+ *
+ *  Prints how much memory the table takes next to what the same live
+ *  records take on disk.  Names of deleted students stay in the arena
+ *  until the next rebuild from the database files.
+ *
+ *  console:  M_MEM_REPORT
+ */
+void mem_report(mem_db_t *mem)
+{
+    struct stat st;
+    unsigned long long disk = 0;
+    size_t ram = (size_t)mem->nslots * sizeof(mem_entry_t) + mem->arena_cap +
+                 (size_t)mem->names_slots * sizeof(uint32_t);
+
+    for (int i = 0; i < mem->map->nshards; i++) {
+        if (fstat(mem->map->fds[i], &st) == 0)
+            disk += (unsigned long long)st.st_blocks * 512;
+    }
+
+    printf(M_MEM_REPORT, mem->n, ram, mem->n ? (double)ram / mem->n : 0.0,
+           disk, mem->n ? (double)disk / mem->n : 0.0);
+}
+
+/*
+ *  mem_serve
+ *      mem:  in-memory state
+ *      in:   command stream, one command per line
+ *
+ *  Runs lookup service commands until q or end of input:
+ *
+ *      f id                        find, like sdbsc -f
+ *      a id first last gpa         add, like sdbsc -a
+ *      d id                        delete, like sdbsc -d
+ *      c                           count the records
+ *      m                           memory report
+ *      s                           write a snapshot now
+ *      q                           quit
+ *
+ *  Output for each command is the same as the matching sdbsc option and
+ *  stdout is flushed after every command so a client can wait for it.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if a write through failed
+ */
+int mem_serve(mem_db_t *mem, FILE *in)
+{
+    char line[256];
+    char fname[64];
+    char lname[64];
+    student_t s;
+    int id;
+    int gpa;
+    int rc = NO_ERROR;
+
+    while (rc != ERR_DB_FILE && fgets(line, sizeof(line), in) != NULL) {
+        char cmd = line[0];
+
+        if (cmd == 'q')
+            break;
+        if (cmd == 'f' && sscanf(line + 1, "%d", &id) == 1) {
+            stats_begin("mem_get_student");
+            if (mem_get_student(mem, id, &s) == NO_ERROR)
+                print_student(&s);
+            else
+                printf(M_STD_NOT_FND_MSG, id);
+            stats_end();
+        } else if (cmd == 'a' && sscanf(line + 1, "%d %63s %63s %d", &id, fname, lname, &gpa) == 4) {
+            stats_begin("mem_add_student");
+            if (validate_range(id, gpa) != NO_ERROR)
+                printf(M_ERR_STD_RNG);
+            else
+                rc = mem_add_student(mem, id, fname, lname, gpa);
+            stats_end();
+        } else if (cmd == 'd' && sscanf(line + 1, "%d", &id) == 1) {
+            stats_begin("mem_del_student");
+            rc = mem_del_student(mem, id);
+            stats_end();
+        } else if (cmd == 'c') {
+            if (mem->n == 0)
+                printf(M_DB_EMPTY);
+            else
+                printf(M_DB_RECORD_CNT, mem->n);
+        } else if (cmd == 'm') {
+            mem_report(mem);
+        } else if (cmd == 's') {
+            if ((rc = mem_snapshot(mem)) == NO_ERROR)
+                printf(M_MEM_SNAPSHOT_OK, mem->n, MEM_SNAP_FILE);
+        } else if (cmd != '\n') {
+            printf(M_MEM_BAD_CMD);
+        }
+        fflush(stdout);
+    }
+    return rc == ERR_DB_FILE ? rc : NO_ERROR;
+}
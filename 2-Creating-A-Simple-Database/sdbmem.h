@@ -0,0 +1,86 @@
+#ifndef __SDB_MEM_H__
+    #define __SDB_MEM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "db.h"
+#include "sdbshard.h"
+
+//In-memory mode for read heavy lookup service use (sdbsc -s).  Every live
+//record is loaded into an open addressing hash table keyed by id, with the
+//names interned into one arena, so a record costs 16 bytes plus its share
+//of the names instead of a 64 byte slot, and lookups never touch the disk.
+//
+//Changes are written through to the normal database files with
+//add_student() / del_student(), and the whole table is saved to a binary
+//snapshot every MEM_SNAPSHOT_OPS changes and at exit:
+//
+//  mem_header_t | mem_entry_t slots[nslots] | char arena[arena_len]
+//
+//The header remembers the size and mtime of the database files it matches
+//(like the columnar side file), startup reads the snapshot with a single
+//read() when it is current and otherwise reads each database file with a
+//single read() and rebuilds it.
+
+#define MEM_SNAP_FILE       ".student.mem"
+#define MEM_SNAP_TMP_FILE   ".tmp_student.mem"
+#define MEM_MAGIC           "SDBMEM1"
+#define MEM_SNAPSHOT_OPS    1000    //changes between periodic snapshots
+#define MEM_MIN_SLOTS       1024    //power of 2
+#define MEM_MIN_ARENA       4096
+
+typedef struct mem_entry{
+    int32_t  id;            //0 is an empty slot, ids start at MIN_STD_ID
+    int32_t  gpa;
+    uint32_t fname;         //arena offsets
+    uint32_t lname;
+} mem_entry_t;
+
+typedef struct mem_header{
+    char     magic[8];
+    uint32_t nrecords;
+    uint32_t nslots;
+    uint32_t arena_len;
+    uint32_t reserved;
+    uint64_t src_size;      //total size of the database files
+    uint64_t src_mtime_ns;  //newest mtime of the database files
+} mem_header_t;
+
+typedef struct mem_db{
+    shard_map_t *map;
+    void        *block;         //snapshot buffer, slots and arena may point into it
+    size_t       block_len;
+    mem_entry_t *slots;
+    uint32_t     nslots;        //power of 2, kept at least twice n
+    uint32_t     n;
+    char        *arena;         //'\0' terminated names
+    uint32_t     arena_len;
+    uint32_t     arena_cap;
+    uint32_t    *names;         //intern table, arena offset + 1, 0 is empty
+    uint32_t     names_slots;
+    uint32_t     names_n;
+    uint32_t     dirty;         //changes since the last snapshot
+    bool         from_snapshot;
+    uint64_t     load_ns;
+    int          load_reads;
+} mem_db_t;
+
+//prototypes
+int  mem_open_db(mem_db_t *mem, shard_map_t *map);
+void mem_close_db(mem_db_t *mem);
+int  mem_get_student(mem_db_t *mem, int id, student_t *s);
+int  mem_add_student(mem_db_t *mem, int id, char *fname, char *lname, int gpa);
+int  mem_del_student(mem_db_t *mem, int id);
+int  mem_snapshot(mem_db_t *mem);
+void mem_report(mem_db_t *mem);
+int  mem_serve(mem_db_t *mem, FILE *in);
+
+#define M_MEM_LOADED      "Loaded %u student record(s) from %s in %.2fms with %d read(s).\n"
+#define M_MEM_REPORT      "Memory: %u live record(s), %zu bytes in RAM (%.1f/record), %llu bytes on disk (%.1f/record).\n"
+#define M_MEM_SNAPSHOT_OK "Snapshot of %u student record(s) written to %s.\n"
+#define M_MEM_BAD_CMD     "Unknown command, use f id | a id first last gpa | d id | c | m | s | q\n"
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbpipe.h"
+#include "sdbstats.h"
+#include "sdbcache.h"
+
+/*
+ *  Bounded queue of buffer pointers.  A NULL item marks the end of the
+ *  stream, so each queue has room for one more than PIPE_BUFFERS.
+ */
+static void queue_init(pipe_queue_t *q)
+{
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+}
+
+static void queue_destroy(pipe_queue_t *q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->changed);
+}
+
+static void queue_push(pipe_queue_t *q, void *item)
+{
+    const int cap = PIPE_BUFFERS + 1;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == cap)
+        pthread_cond_wait(&q->changed, &q->lock);
+    q->items[(q->head + q->count) % cap] = item;
+    q->count++;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *queue_pop(pipe_queue_t *q)
+{
+    const int cap = PIPE_BUFFERS + 1;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0)
+        pthread_cond_wait(&q->changed, &q->lock);
+    void *item = q->items[q->head];
+    q->head = (q->head + 1) % cap;
+    q->count--;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+typedef struct pipe_block{
+    int       n;
+    student_t recs[PIPE_BLOCK_RECORDS];
+} pipe_block_t;
+
+typedef struct pipe_out{
+    size_t len;
+    char   data[PIPE_OUT_SIZE];
+} pipe_out_t;
+
+typedef struct pipe_scan{
+    int           fd;
+    int           rows;
+    int           read_rc;
+    int           write_rc;
+    bool          stop;             //writer failed, reader can give up
+    pipe_queue_t  block_free;
+    pipe_queue_t  block_full;
+    pipe_queue_t  out_free;
+    pipe_queue_t  out_full;
+} pipe_scan_t;
+
+static void *pipe_reader(void *arg)
+{
+    pipe_scan_t *ps = arg;
+    off_t pos = 0;
+    cache_scan_t cs;
+
+    cache_scan_begin(&cs, ps->fd, 0, 0);
+    while (!__atomic_load_n(&ps->stop, __ATOMIC_RELAXED)) {
+        pipe_block_t *b = queue_pop(&ps->block_free);
+        ssize_t n = stats_pread(ps->fd, b->recs, sizeof(b->recs), pos);
+
+        if (n <= 0 || n % sizeof(student_t) != 0) {
+            if (n != 0)
+                ps->read_rc = ERR_DB_FILE;
+            queue_push(&ps->block_free, b);
+            break;
+        }
+        b->n = n / sizeof(student_t);
+        pos += n;
+        cache_scan_advance(&cs, pos);
+        queue_push(&ps->block_full, b);
+    }
+    cache_scan_end(&cs);
+    queue_push(&ps->block_full, NULL);
+    return NULL;
+}
+
+static void *pipe_writer(void *arg)
+{
+    pipe_scan_t *ps = arg;
+    pipe_out_t *o;
+
+    // keep draining after an error so the formatter never blocks
+    while ((o = queue_pop(&ps->out_full)) != NULL) {
+        size_t done = 0;
+        while (ps->write_rc == NO_ERROR && done < o->len) {
+            ssize_t n = write(STDOUT_FILENO, o->data + done, o->len - done);
+            if (n <= 0) {
+                ps->write_rc = ERR_DB_FILE;
+                __atomic_store_n(&ps->stop, true, __ATOMIC_RELAXED);
+                break;
+            }
+            done += n;
+        }
+        queue_push(&ps->out_free, o);
+    }
+    return NULL;
+}
+
+/*
+ *  pipe_format
+ *
+ *  The formatter stage, run on the calling thread.  Rows are formatted
+ *  exactly like print_db() does, the header goes in front of the first
+ *  one.
+ */
+static void pipe_format(pipe_scan_t *ps)
+{
+    pipe_block_t *b;
+    pipe_out_t *o = queue_pop(&ps->out_free);
+
+    o->len = 0;
+    while ((b = queue_pop(&ps->block_full)) != NULL) {
+        for (int i = 0; i < b->n; i++) {
+            student_t *s = &b->recs[i];
+
+            if (memcmp(s, &EMPTY_STUDENT_RECORD, sizeof(student_t)) == 0) {
+                stats_hole(1);
+                continue;
+            }
+            if (PIPE_OUT_SIZE - o->len < 2 * PIPE_ROW_MAX) {
+                queue_push(&ps->out_full, o);
+                o = queue_pop(&ps->out_free);
+                o->len = 0;
+            }
+            if (ps->rows++ == 0)
+                o->len += snprintf(o->data + o->len, PIPE_ROW_MAX, STUDENT_PRINT_HDR_STRING,
+                                   "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+            o->len += snprintf(o->data + o->len, PIPE_ROW_MAX, STUDENT_PRINT_FMT_STRING,
+                               s->id, s->fname, s->lname, s->gpa / 100.0);
+        }
+        queue_push(&ps->block_free, b);
+    }
+
+    if (o->len > 0)
+        queue_push(&ps->out_full, o);
+    else
+        queue_push(&ps->out_free, o);
+    queue_push(&ps->out_full, NULL);
+}
+
+/*
+ *  pipe_print_db
+ *      fd:  linux file descriptor
+ *
+ *  Pipelined version of print_db(), same output and return codes.  Falls
+ *  back to print_db() if the buffers or threads cannot be had.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue, or stdout failed
+ *
+ *  console:  same as print_db()
+ */
+int pipe_print_db(int fd)
+{
+    pipe_scan_t ps;
+    pipe_block_t *blocks;
+    pipe_out_t *outs;
+    pthread_t reader;
+    pthread_t writer;
+
+    blocks = malloc(PIPE_BUFFERS * sizeof(pipe_block_t));
+    outs = malloc(PIPE_BUFFERS * sizeof(pipe_out_t));
+    if (blocks == NULL || outs == NULL) {
+        free(blocks);
+        free(outs);
+        return print_db(fd);
+    }
+
+    memset(&ps, 0, sizeof(ps));
+    ps.fd = fd;
+    queue_init(&ps.block_free);
+    queue_init(&ps.block_full);
+    queue_init(&ps.out_free);
+    queue_init(&ps.out_full);
+    for (int i = 0; i < PIPE_BUFFERS; i++) {
+        queue_push(&ps.block_free, &blocks[i]);
+        queue_push(&ps.out_free, &outs[i]);
+    }
+
+    // the writer bypasses stdio, anything already printed goes first
+    fflush(stdout);
+
+    int rc = NO_ERROR;
+    if (pthread_create(&reader, NULL, pipe_reader, &ps) != 0) {
+        rc = print_db(fd);
+    } else if (pthread_create(&writer, NULL, pipe_writer, &ps) != 0) {
+        __atomic_store_n(&ps.stop, true, __ATOMIC_RELAXED);
+        pipe_block_t *b;
+        while ((b = queue_pop(&ps.block_full)) != NULL)
+            queue_push(&ps.block_free, b);
+        pthread_join(reader, NULL);
+        rc = print_db(fd);
+    } else {
+        pipe_format(&ps);
+        pthread_join(reader, NULL);
+        pthread_join(writer, NULL);
+
+        if (ps.read_rc != NO_ERROR || ps.write_rc != NO_ERROR) {
+            printf(M_ERR_DB_READ);
+            rc = ERR_DB_FILE;
+        } else if (ps.rows == 0) {
+            printf(M_DB_EMPTY);
+        }
+    }
+
+    queue_destroy(&ps.block_free);
+    queue_destroy(&ps.block_full);
+    queue_destroy(&ps.out_free);
+    queue_destroy(&ps.out_full);
+    free(blocks);
+    free(outs);
+    return rc;
+}
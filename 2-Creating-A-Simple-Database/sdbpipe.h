@@ -0,0 +1,38 @@
+#ifndef __SDB_PIPE_H__
+    #define __SDB_PIPE_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+//Pipelined print_db().  The plain version reads a record, printf()s it and
+//reads the next, so the disk is idle while rows are formatted and the CPU
+//is idle while it waits for the disk.  pipe_print_db() splits the scan
+//into three threads joined by bounded queues:
+//
+//  reader     pread()s PIPE_BLOCK_RECORDS records at a time into a ring of
+//             PIPE_BUFFERS blocks, as far ahead as there are free blocks
+//  formatter  turns a block into rows in an output buffer, hands the block
+//             back to the reader
+//  writer     write()s full output buffers to stdout
+//
+//Each queue holds at most PIPE_BUFFERS entries, so memory stays fixed at
+//PIPE_BUFFERS * (PIPE_BLOCK_RECORDS * 64 + PIPE_OUT_SIZE) bytes.
+
+#define PIPE_BUFFERS        4
+#define PIPE_BLOCK_RECORDS  4096        //256K per read
+#define PIPE_OUT_SIZE       (256 * 1024)
+#define PIPE_ROW_MAX        128         //longest formatted row
+
+typedef struct pipe_queue{
+    void           *items[PIPE_BUFFERS + 1];
+    int             head;
+    int             count;
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+} pipe_queue_t;
+
+//prototypes
+int pipe_print_db(int fd);
+
+#endif
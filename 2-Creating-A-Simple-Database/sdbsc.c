@@ -9,6 +9,8 @@
 // database include files
 #include "db.h"
 #include "sdbsc.h"
+#include "sdbstats.h"
+#include "sdbcache.h"
 
 /*
  *  open_db
@@ -66,13 +68,13 @@ int get_student(int fd, int id, student_t *s)
     off_t pos = id * sizeof(student_t);
 
     // Move the file offset to the calculated position
-    if (lseek(fd, pos, SEEK_SET) == (off_t)-1) {
+    if (stats_lseek(fd, pos, SEEK_SET) == (off_t)-1) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
     student_t student;
-    ssize_t read_size = read(fd, &student, sizeof(student_t));
+    ssize_t read_size = stats_read(fd, &student, sizeof(student_t));
     if (read_size != sizeof(student_t)) {
         if (read_size < 0) {
             printf(M_ERR_DB_READ);
@@ -136,12 +138,12 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
 
     // Calculate the position to write the new student record
     off_t pos = id * sizeof(student_t);
-    if (lseek(fd, pos, SEEK_SET) == (off_t)-1) {
+    if (stats_lseek(fd, pos, SEEK_SET) == (off_t)-1) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
 
-    if (write(fd, &newStudent, sizeof(student_t)) != sizeof(student_t)) {
+    if (stats_write(fd, &newStudent, sizeof(student_t)) != sizeof(student_t)) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
@@ -189,12 +191,12 @@ int del_student(int fd, int id)
 
     // Calculate the position of the student record in the file
     off_t pos = id * sizeof(student_t);
-    if (lseek(fd, pos, SEEK_SET) == (off_t)-1) {
+    if (stats_lseek(fd, pos, SEEK_SET) == (off_t)-1) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
 
-    if (write(fd, &EMPTY_STUDENT_RECORD, sizeof(student_t)) != sizeof(student_t)) {
+    if (stats_write(fd, &EMPTY_STUDENT_RECORD, sizeof(student_t)) != sizeof(student_t)) {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
@@ -229,7 +231,7 @@ int del_student(int fd, int id)
  */
 int count_db_records(int fd)
 {
-    if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
+    if (stats_lseek(fd, 0, SEEK_SET) == (off_t)-1) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
@@ -237,17 +239,26 @@ int count_db_records(int fd)
     int record_count = 0;
     student_t student;
     ssize_t read_size;
+    off_t pos = 0;
+    cache_scan_t cs;
 
-    while ((read_size = read(fd, &student, sizeof(student_t))) > 0) {
+    cache_scan_begin(&cs, fd, 0, 0);
+    while ((read_size = stats_read(fd, &student, sizeof(student_t))) > 0) {
         if (read_size != sizeof(student_t)) {
+            cache_scan_end(&cs);
             printf(M_ERR_DB_READ);
             return ERR_DB_FILE;
         }
+        pos += read_size;
+        cache_scan_advance(&cs, pos);
 
         if (memcmp(&student, &EMPTY_STUDENT_RECORD, sizeof(student_t)) != 0) {
             record_count++;
+        } else {
+            stats_hole(1);
         }
     }
+    cache_scan_end(&cs);
 
     if (read_size < 0) {
         printf(M_ERR_DB_READ);
@@ -299,7 +310,7 @@ int count_db_records(int fd)
 int print_db(int fd)
 {
     // Move the file offset to the beginning of the file
-    if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
+    if (stats_lseek(fd, 0, SEEK_SET) == (off_t)-1) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
@@ -307,13 +318,20 @@ int print_db(int fd)
     student_t student;
     bool hasPrintedHeader = false;
     ssize_t readBytes;
+    off_t pos = 0;
+    cache_scan_t cs;
 
-    // Read each student record until EOF
-    while ((readBytes = read(fd, &student, sizeof(student_t))) > 0) {
+    // Read each student record until EOF, telling the kernel this is a
+    // one pass sequential read
+    cache_scan_begin(&cs, fd, 0, 0);
+    while ((readBytes = stats_read(fd, &student, sizeof(student_t))) > 0) {
         if (readBytes != sizeof(student_t)) {
+            cache_scan_end(&cs);
             printf(M_ERR_DB_READ);
             return ERR_DB_FILE;
         }
+        pos += readBytes;
+        cache_scan_advance(&cs, pos);
 
         // Check if the record is not empty
         if (memcmp(&student, &EMPTY_STUDENT_RECORD, sizeof(student_t)) != 0) {
@@ -325,8 +343,11 @@ int print_db(int fd)
             // Calculate GPA as a float and print the student record
             float gpaValue = student.gpa / 100.0;
             printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, gpaValue);
+        } else {
+            stats_hole(1);
         }
     }
+    cache_scan_end(&cs);
 
     // Check for read error
     if (readBytes < 0) {
@@ -464,216 +485,3 @@ int validate_range(int id, int gpa)
 
     return NO_ERROR;
 }
-
-/*
- *  usage
- *      exename:  the name of the executable from argv[0]
- *
- *  Prints this programs expected usage
- *
- *  returns:    nothing, this is a void function
- *
- *  console:  This function prints the usage information
- *
- */
-void usage(char *exename)
-{
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
-    printf("\t-h:  prints help\n");
-    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
-    printf("\t-c:  counts the records in the database\n");
-    printf("\t-d id:  deletes a student\n");
-    printf("\t-f id:  finds and prints a student in the database\n");
-    printf("\t-p:  prints all records in the student database\n");
-    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
-    printf("\t-z:  zero db file (remove all records)\n");
-}
-
-// Welcome to main()
-int main(int argc, char *argv[])
-{
-    char opt;      // user selected option
-    int fd;        // file descriptor of database files
-    int rc;        // return code from various operations
-    int exit_code; // exit code to shell
-    int id;        // userid from argv[2]
-    int gpa;       // gpa from argv[5]
-
-    // space for a student structure which we will get back from
-    // some of the functions we will be writing such as get_student(),
-    // and print_student().
-    student_t student = {0};
-
-    // This function must have at least one arg, and the arg must start
-    // with a dash
-    if ((argc < 2) || (*argv[1] != '-'))
-    {
-        usage(argv[0]);
-        exit(1);
-    }
-
-    // The option is the first character after the dash for example
-    //-h -a -c -d -f -p -x -z
-    opt = (char)*(argv[1] + 1); // get the option flag
-
-    // handle the help flag and then exit normally
-    if (opt == 'h')
-    {
-        usage(argv[0]);
-        exit(EXIT_OK);
-    }
-
-    // now lets open the file and continue if there is no error
-    // note we are not truncating the file using the second
-    // parameter
-    fd = open_db(DB_FILE, false);
-    if (fd < 0)
-    {
-        exit(EXIT_FAIL_DB);
-    }
-
-    // set rc to the return code of the operation to ensure the program
-    // use that to determine the proper exit_code.  Look at the header
-    // sdbsc.h for expected values.
-
-    exit_code = EXIT_OK;
-    switch (opt)
-    {
-    case 'a':
-        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
-        // prog_name     -a      id  first_name last_name     gpa
-        //-------------------------------------------------------
-        // example:  prog_name -a 1 John Doe 341
-        if (argc != 6)
-        {
-            usage(argv[0]);
-            exit_code = EXIT_FAIL_ARGS;
-            break;
-        }
-
-        // convert id and gpa to ints from argv.  For this assignment assume
-        // they are valid numbers
-        id = atoi(argv[2]);
-        gpa = atoi(argv[5]);
-
-        exit_code = validate_range(id, gpa);
-        if (exit_code == EXIT_FAIL_ARGS)
-        {
-            printf(M_ERR_STD_RNG);
-            break;
-        }
-
-        rc = add_student(fd, id, argv[3], argv[4], gpa);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
-
-        break;
-
-    case 'c':
-        //    arv[0] arv[1]
-        // prog_name     -c
-        //-----------------
-        // example:  prog_name -c
-        rc = count_db_records(fd);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
-        break;
-
-    case 'd':
-        //   arv[0]  arv[1]  arv[2]
-        // prog_name     -d      id
-        //-------------------------
-        // example:  prog_name -d 100
-        if (argc != 3)
-        {
-            usage(argv[0]);
-            exit_code = EXIT_FAIL_ARGS;
-            break;
-        }
-        id = atoi(argv[2]);
-        rc = del_student(fd, id);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
-
-        break;
-
-    case 'f':
-        //    arv[0] arv[1]  arv[2]
-        // prog_name     -f      id
-        //-------------------------
-        // example:  prog_name -f 100
-        if (argc != 3)
-        {
-            usage(argv[0]);
-            exit_code = EXIT_FAIL_ARGS;
-            break;
-        }
-        id = atoi(argv[2]);
-        rc = get_student(fd, id, &student);
-
-        switch (rc)
-        {
-        case NO_ERROR:
-            print_student(&student);
-            break;
-        case SRCH_NOT_FOUND:
-            printf(M_STD_NOT_FND_MSG, id);
-            exit_code = EXIT_FAIL_DB;
-            break;
-        default:
-            printf(M_ERR_DB_READ);
-            exit_code = EXIT_FAIL_DB;
-            break;
-        }
-        break;
-
-    case 'p':
-        //    arv[0] arv[1]
-        // prog_name     -p
-        //-----------------
-        // example:  prog_name -p
-        rc = print_db(fd);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
-        break;
-
-    case 'x':
-        //    arv[0] arv[1]
-        // prog_name     -x
-        //-----------------
-        // example:  prog_name -x
-
-        // remember compress_db returns a fd of the compressed database.
-        // we close it after this switch statement
-        fd = compress_db(fd);
-        if (fd < 0)
-            exit_code = EXIT_FAIL_DB;
-        break;
-
-    case 'z':
-        //    arv[0] arv[1]
-        // prog_name     -x
-        //-----------------
-        // example:  prog_name -x
-        // HINT:  close the db file, we already have fd
-        //       and reopen db indicating truncate=true
-        close(fd);
-        fd = open_db(DB_FILE, true);
-        if (fd < 0)
-        {
-            exit_code = EXIT_FAIL_DB;
-            break;
-        }
-        printf(M_DB_ZERO_OK);
-        exit_code = EXIT_OK;
-        break;
-    default:
-        usage(argv[0]);
-        exit_code = EXIT_FAIL_ARGS;
-    }
-
-    // dont forget to close the file before exiting, and setting the
-    // proper exit code - see the header file for expected values
-    close(fd);
-    exit(exit_code);
-}
\ No newline at end of file
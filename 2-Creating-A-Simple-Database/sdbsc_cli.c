@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbshard.h"
+#include "sdbcol.h"
+#include "sdblsm.h"
+#include "sdbcache.h"
+#include "sdbmem.h"
+#include "sdbbackup.h"
+#include "sdbstats.h"
+
+/*
+ *  usage
+ *      exename:  the name of the executable from argv[0]
+ *
+ *  Prints this programs expected usage
+ *
+ *  returns:    nothing, this is a void function
+ *
+ *  console:  This function prints the usage information
+ *
+ */
+void usage(char *exename)
+{
+    printf("usage: %s -[h|a|B|c|d|e|E|f|g|l|p|q|R|s|z] options.  Where:\n", exename);
+    printf("\t-h:  prints help\n");
+    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-B dir:  incremental backup of the database into dir\n");
+    printf("\t-c:  counts the records in the database\n");
+    printf("\t-d id:  deletes a student\n");
+    printf("\t-e file:  exports every student to file in the -l format\n");
+    printf("\t-E file:  same as -e but reads the database with O_DIRECT\n");
+    printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-g:  prints GPA statistics from the columnar side file\n");
+    printf("\t-l file:  bulk loads \"id first_name last_name gpa\" lines from file\n");
+    printf("\t-p:  prints all records in the student database\n");
+    printf("\t-q min max:  prints students with min <= gpa <= max (as 3 digit ints)\n");
+    printf("\t-R dir:  restores the database from a backup in dir\n");
+    printf("\t-s:  loads every student into memory and serves f/a/d/c/m/s/q commands from stdin\n");
+    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+    printf("\t-z:  zero db file (remove all records)\n");
+    printf("\tset SDB_STATS=text|json to report syscall and latency stats on stderr\n");
+    printf("\tset SDB_SHARDS=n to create a database split over n files in %s\n", SHARD_DIR);
+    printf("\tset SDB_CACHE=off to disable page cache hints\n");
+    printf("\tset SDB_ENGINE=lsm to use the log structured engine in %s\n", LSM_DIR);
+}
+
+/*
+ *  stats_op_name
+ *      opt:  the option character from the command line
+ *
+ *  Maps a command line option to the name the stats module reports it
+ *  under.  These are the names of the functions that do the work so that
+ *  a regression in, say, print_db shows up under "print_db".
+ *
+ *  returns:    the operation name
+ *
+ *  console:  This function does not produce any output
+ */
+static const char *stats_op_name(char opt)
+{
+    switch (opt)
+    {
+    case 'a':
+        return "add_student";
+    case 'B':
+        return "backup_db";
+    case 'c':
+        return "count_db_records";
+    case 'd':
+        return "del_student";
+    case 'e':
+    case 'E':
+        return "export_db";
+    case 'f':
+        return "get_student";
+    case 'g':
+        return "col_gpa_stats";
+    case 'l':
+        return "load_db";
+    case 'p':
+        return "print_db";
+    case 'q':
+        return "col_gpa_filter";
+    case 'R':
+        return "restore_db";
+    case 's':
+        return "mem_serve";
+    case 'x':
+        return "compress_db";
+    case 'z':
+        return "zero_db";
+    default:
+        return "unknown";
+    }
+}
+
+// Welcome to main()
+int main(int argc, char *argv[])
+{
+    char opt;      // user selected option
+    int fd;        // file descriptor of database files
+    shard_map_t map; // every shard of the database, see sdbshard.h
+    static lsm_db_t lsm; // LSM engine state, see sdblsm.h
+    mem_db_t mem;  // in-memory table for -s, see sdbmem.h
+    bool use_lsm;  // SDB_ENGINE=lsm or student.lsm exists
+    int rc;        // return code from various operations
+    int exit_code; // exit code to shell
+    int id;        // userid from argv[2]
+    int gpa;       // gpa from argv[5]
+
+    // space for a student structure which we will get back from
+    // some of the functions we will be writing such as get_student(),
+    // and print_student().
+    student_t student = {0};
+
+    // This function must have at least one arg, and the arg must start
+    // with a dash
+    if ((argc < 2) || (*argv[1] != '-'))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    // The option is the first character after the dash for example
+    //-h -a -c -d -f -p -x -z
+    opt = (char)*(argv[1] + 1); // get the option flag
+
+    // handle the help flag and then exit normally
+    if (opt == 'h')
+    {
+        usage(argv[0]);
+        exit(EXIT_OK);
+    }
+
+    // turn on syscall/latency counters if SDB_STATS is set
+    stats_init();
+
+    // now lets open the file and continue if there is no error
+    // note we are not truncating the file using the second
+    // parameter.  Single record operations go to the shard that owns
+    // the id, with a plain student.db there is only one shard.  The
+    // LSM engine keeps everything in its own directory instead.
+    use_lsm = lsm_wanted(LSM_DIR);
+    map.nshards = 0;
+    fd = -1;
+    if (use_lsm)
+    {
+        if (lsm_open_db(&lsm, LSM_DIR, false) < 0)
+            exit(EXIT_FAIL_DB);
+    }
+    else
+    {
+        if (shard_open_db(&map, DB_FILE, SHARD_DIR, false) < 0)
+            exit(EXIT_FAIL_DB);
+        fd = map.fds[0];
+    }
+
+    // set rc to the return code of the operation to ensure the program
+    // use that to determine the proper exit_code.  Look at the header
+    // sdbsc.h for expected values.
+
+    exit_code = EXIT_OK;
+    stats_begin(stats_op_name(opt));
+    switch (opt)
+    {
+    case 'a':
+        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
+        // prog_name     -a      id  first_name last_name     gpa
+        //-------------------------------------------------------
+        // example:  prog_name -a 1 John Doe 341
+        if (argc != 6)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+
+        // convert id and gpa to ints from argv.  For this assignment assume
+        // they are valid numbers
+        id = atoi(argv[2]);
+        gpa = atoi(argv[5]);
+
+        exit_code = validate_range(id, gpa);
+        if (exit_code == EXIT_FAIL_ARGS)
+        {
+            printf(M_ERR_STD_RNG);
+            break;
+        }
+
+        if (use_lsm)
+        {
+            rc = lsm_add_student(&lsm, id, argv[3], argv[4], gpa);
+        }
+        else
+        {
+            cache_point_lookups(shard_fd(&map, id));
+            rc = add_student(shard_fd(&map, id), id, argv[3], argv[4], gpa);
+        }
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+
+        break;
+
+    case 'c':
+        //    arv[0] arv[1]
+        // prog_name     -c
+        //-----------------
+        // example:  prog_name -c
+        if (use_lsm)
+            rc = lsm_count_db_records(&lsm);
+        else
+            rc = shard_count_db_records(&map);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'd':
+        //   arv[0]  arv[1]  arv[2]
+        // prog_name     -d      id
+        //-------------------------
+        // example:  prog_name -d 100
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        if (use_lsm)
+        {
+            rc = lsm_del_student(&lsm, id);
+        }
+        else
+        {
+            cache_point_lookups(shard_fd(&map, id));
+            rc = del_student(shard_fd(&map, id), id);
+        }
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+
+        break;
+
+    case 'f':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -f      id
+        //-------------------------
+        // example:  prog_name -f 100
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        if (use_lsm)
+        {
+            rc = lsm_get_student(&lsm, id, &student);
+        }
+        else
+        {
+            cache_point_lookups(shard_fd(&map, id));
+            rc = get_student(shard_fd(&map, id), id, &student);
+        }
+
+        switch (rc)
+        {
+        case NO_ERROR:
+            print_student(&student);
+            break;
+        case SRCH_NOT_FOUND:
+            printf(M_STD_NOT_FND_MSG, id);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        default:
+            printf(M_ERR_DB_READ);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        break;
+
+    case 'p':
+        //    arv[0] arv[1]
+        // prog_name     -p
+        //-----------------
+        // example:  prog_name -p
+        if (use_lsm)
+            rc = lsm_print_db(&lsm);
+        else
+            rc = shard_print_db(&map);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'g':
+        //    arv[0] arv[1]
+        // prog_name     -g
+        //-----------------
+        // example:  prog_name -g
+        if (use_lsm)
+        {
+            printf(M_NOT_IMPL);
+            exit_code = EXIT_NOT_IMPL;
+            break;
+        }
+        rc = col_gpa_stats(&map);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'q':
+        //    arv[0] arv[1]  arv[2]  arv[3]
+        // prog_name     -q     min     max
+        //---------------------------------
+        // example:  prog_name -q 300 400
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (use_lsm)
+        {
+            printf(M_NOT_IMPL);
+            exit_code = EXIT_NOT_IMPL;
+            break;
+        }
+        rc = col_gpa_filter(&map, atoi(argv[2]), atoi(argv[3]));
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'l':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -l    file
+        //-------------------------
+        // example:  prog_name -l students.txt
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (use_lsm)
+            rc = lsm_load_db(&lsm, argv[2]);
+        else
+            rc = shard_load_db(&map, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'e':
+    case 'E':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -e    file
+        //-------------------------
+        // example:  prog_name -e students.txt
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (use_lsm)
+        {
+            printf(M_NOT_IMPL);
+            exit_code = EXIT_NOT_IMPL;
+            break;
+        }
+        rc = shard_export_db(&map, argv[2], opt == 'E');
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'B':
+    case 'R':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -B     dir
+        //-------------------------
+        // example:  prog_name -B backup
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (use_lsm)
+        {
+            printf(M_NOT_IMPL);
+            exit_code = EXIT_NOT_IMPL;
+            break;
+        }
+        if (opt == 'B')
+        {
+            rc = backup_db(&map, DB_FILE, argv[2]);
+        }
+        else
+        {
+            // the restore rewrites the files, reopen them afterwards
+            shard_close_db(&map);
+            rc = restore_db(DB_FILE, SHARD_DIR, argv[2]);
+            if (shard_open_db(&map, DB_FILE, SHARD_DIR, false) < 0)
+                rc = ERR_DB_FILE;
+        }
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 's':
+        //    arv[0] arv[1]
+        // prog_name     -s
+        //-----------------
+        // example:  echo "f 100" | prog_name -s
+        if (use_lsm)
+        {
+            printf(M_NOT_IMPL);
+            exit_code = EXIT_NOT_IMPL;
+            break;
+        }
+        rc = mem_open_db(&mem, &map);
+        if (rc < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        mem_report(&mem);
+        rc = mem_serve(&mem, stdin);
+        mem_close_db(&mem);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'x':
+        //    arv[0] arv[1]
+        // prog_name     -x
+        //-----------------
+        // example:  prog_name -x
+
+        // the LSM engine has no holes to squeeze out, -x merges its runs
+        if (use_lsm)
+        {
+            rc = lsm_compact(&lsm);
+            if (rc < 0)
+            {
+                printf(M_ERR_DB_WRITE);
+                exit_code = EXIT_FAIL_DB;
+                break;
+            }
+            printf(M_LSM_COMPACTED_OK, rc);
+            break;
+        }
+
+        // remember compress_db returns a fd of the compressed database.
+        // we close it after this switch statement
+        fd = compress_db(fd);
+        map.fds[0] = fd;
+        if (fd < 0)
+        {
+            map.nshards = 0;
+            exit_code = EXIT_FAIL_DB;
+        }
+        break;
+
+    case 'z':
+        //    arv[0] arv[1]
+        // prog_name     -x
+        //-----------------
+        // example:  prog_name -x
+        // HINT:  close the db file, we already have fd
+        //       and reopen db indicating truncate=true
+        if (use_lsm)
+        {
+            lsm_close_db(&lsm);
+            rc = lsm_open_db(&lsm, LSM_DIR, true);
+        }
+        else
+        {
+            shard_close_db(&map);
+            rc = shard_open_db(&map, DB_FILE, SHARD_DIR, true);
+        }
+        if (rc < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        printf(M_DB_ZERO_OK);
+        exit_code = EXIT_OK;
+        break;
+    default:
+        usage(argv[0]);
+        exit_code = EXIT_FAIL_ARGS;
+    }
+    stats_end();
+
+    // dont forget to close the file before exiting, and setting the
+    // proper exit code - see the header file for expected values
+    if (use_lsm)
+        lsm_close_db(&lsm);
+    else
+        shard_close_db(&map);
+    stats_report();
+    exit(exit_code);
+}
@@ -0,0 +1,628 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbshard.h"
+#include "sdbstats.h"
+#include "sdbcache.h"
+#include "sdbpipe.h"
+
+//records read per pread() when scanning a shard
+#define SHARD_SCAN_RECORDS  256
+
+/*
+ *  shard_wanted
+ *
+ *  returns:  the shard count requested through SDB_SHARDS, or 0 if it is
+ *            not set or not a valid count
+ */
+static int shard_wanted(void)
+{
+    const char *env = getenv(SHARD_ENV);
+
+    if (env == NULL || *env == '\0')
+        return 0;
+
+    int n = atoi(env);
+    if (n < 1 || n > SHARD_MAX)
+        return 0;
+    return n;
+}
+
+/*
+ *  shard_existing
+ *      shardDir:  directory holding the shard files
+ *
+ *  returns:  the number of consecutive shard files found in shardDir
+ */
+static int shard_existing(char *shardDir)
+{
+    char path[512];
+    int n = 0;
+
+    while (n < SHARD_MAX) {
+        snprintf(path, sizeof(path), SHARD_FILE_FMT, shardDir, n);
+        if (access(path, F_OK) != 0)
+            break;
+        n++;
+    }
+    return n;
+}
+
+/*
+ *  shard_open_db
+ *      map:              shard map to fill in
+ *      dbFile:           name of the single file database
+ *      shardDir:         name of the sharded database directory
+ *      should_truncate:  indicates if opening the shards also empties them
+ *
+ *  Opens the database.  If shardDir holds shard files they are all opened,
+ *  if it does not exist but SDB_SHARDS asks for more than one shard the
+ *  directory and shards are created, unless dbFile already holds records
+ *  that would be hidden by the new shards.  Otherwise dbFile is opened as
+ *  a map with a single shard covering every id.
+ *
+ *  returns:  NO_ERROR       all shards opened
+ *            ERR_DB_FILE    a shard could not be opened, or the shard count
+ *                           on disk disagrees with SDB_SHARDS, or dbFile
+ *                           is in the way of a new sharded database
+ *
+ *  console:  Does not produce any console I/O on success
+ *            M_ERR_DB_OPEN on error
+ *            M_ERR_SHARD_CNT if the shard count does not match
+ *            M_ERR_SHARD_DB if dbFile is not empty
+ */
+int shard_open_db(shard_map_t *map, char *dbFile, char *shardDir, bool should_truncate)
+{
+    char path[512];
+    struct stat st;
+    int wanted = shard_wanted();
+    int existing = 0;
+
+    memset(map, 0, sizeof(*map));
+    if (stat(shardDir, &st) == 0 && S_ISDIR(st.st_mode))
+        existing = shard_existing(shardDir);
+
+    if (existing > 0 && wanted > 0 && wanted != existing) {
+        printf(M_ERR_SHARD_CNT, shardDir, existing, SHARD_ENV, wanted);
+        return ERR_DB_FILE;
+    }
+
+    if (existing == 0 && wanted <= 1) {
+        map->nshards = 1;
+        map->ids_per_shard = MAX_STD_ID - MIN_STD_ID + 1;
+        map->fds[0] = open_db(dbFile, should_truncate);
+        return map->fds[0] < 0 ? ERR_DB_FILE : NO_ERROR;
+    }
+
+    if (existing == 0) {
+        if (stat(dbFile, &st) == 0 && st.st_size > 0) {
+            printf(M_ERR_SHARD_DB, dbFile, SHARD_ENV, wanted);
+            return ERR_DB_FILE;
+        }
+        if (mkdir(shardDir, S_IRWXU | S_IRWXG) != 0 && stat(shardDir, &st) != 0) {
+            printf(M_ERR_DB_CREATE);
+            return ERR_DB_FILE;
+        }
+        existing = wanted;
+    }
+
+    map->nshards = existing;
+    map->ids_per_shard = (MAX_STD_ID - MIN_STD_ID + existing) / existing;
+    strncpy(map->dir, shardDir, sizeof(map->dir) - 1);
+
+    for (int i = 0; i < map->nshards; i++) {
+        snprintf(path, sizeof(path), SHARD_FILE_FMT, shardDir, i);
+        map->fds[i] = open_db(path, should_truncate);
+        if (map->fds[i] < 0) {
+            map->nshards = i;
+            shard_close_db(map);
+            return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
+
+void shard_close_db(shard_map_t *map)
+{
+    for (int i = 0; i < map->nshards; i++)
+        close(map->fds[i]);
+    map->nshards = 0;
+}
+
+/*
+ *  shard_of
+ *      map:  shard map
+ *      id:   student id
+ *
+ *  returns:  the index of the shard that owns id.  Out of range ids are
+ *            sent to the nearest shard, they will simply not be found there.
+ */
+int shard_of(shard_map_t *map, int id)
+{
+    if (map->nshards <= 1 || id < MIN_STD_ID)
+        return 0;
+    if (id > MAX_STD_ID)
+        return map->nshards - 1;
+    return (id - MIN_STD_ID) / map->ids_per_shard;
+}
+
+int shard_fd(shard_map_t *map, int id)
+{
+    return map->fds[shard_of(map, id)];
+}
+
+int shard_first_id(shard_map_t *map, int shard)
+{
+    return MIN_STD_ID + shard * map->ids_per_shard;
+}
+
+/*
+ *  Per shard scan state, one per thread.  When printing, rows are formatted
+ *  into a memory stream so the shards can be scanned at the same time and
+ *  still be written out in id order.
+ */
+typedef struct shard_scan{
+    shard_map_t *map;
+    int     shard;
+    bool    print;
+    int     count;
+    int     rc;
+    char   *out;
+    size_t  out_len;
+} shard_scan_t;
+
+static void *shard_scan_thread(void *arg)
+{
+    shard_scan_t *scan = arg;
+    shard_map_t *map = scan->map;
+    int fd = map->fds[scan->shard];
+    int first = shard_first_id(map, scan->shard);
+    int last = first + map->ids_per_shard - 1;
+    student_t block[SHARD_SCAN_RECORDS];
+    FILE *out = NULL;
+    cache_scan_t cs;
+
+    if (last > MAX_STD_ID)
+        last = MAX_STD_ID;
+    if (scan->print) {
+        out = open_memstream(&scan->out, &scan->out_len);
+        if (out == NULL) {
+            scan->rc = ERR_DB_FILE;
+            return NULL;
+        }
+    }
+    cache_scan_begin(&cs, fd, (off_t)first * sizeof(student_t), 0);
+
+    int id = first;
+    while (id <= last) {
+        int want = last - id + 1;
+        if (want > SHARD_SCAN_RECORDS)
+            want = SHARD_SCAN_RECORDS;
+
+        ssize_t n = stats_pread(fd, block, want * sizeof(student_t),
+                                (off_t)id * sizeof(student_t));
+        if (n < 0 || n % sizeof(student_t) != 0) {
+            scan->rc = ERR_DB_FILE;
+            break;
+        }
+        if (n == 0)
+            break;
+
+        int got = n / sizeof(student_t);
+        cache_scan_advance(&cs, (off_t)(id + got) * sizeof(student_t));
+        for (int i = 0; i < got; i++) {
+            if (memcmp(&block[i], &EMPTY_STUDENT_RECORD, sizeof(student_t)) == 0) {
+                stats_hole(1);
+                continue;
+            }
+            scan->count++;
+            if (out != NULL)
+                fprintf(out, STUDENT_PRINT_FMT_STRING, block[i].id, block[i].fname,
+                        block[i].lname, block[i].gpa / 100.0);
+        }
+        id += got;
+    }
+    cache_scan_end(&cs);
+
+    if (out != NULL)
+        fclose(out);
+    return NULL;
+}
+
+/*
+ *  shard_scan
+ *      map:    shard map
+ *      scans:  one scan state per shard, filled in by this function
+ *      print:  format the rows as well as counting them
+ *
+ *  Scans every shard on its own thread and waits for all of them.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if any shard failed
+ */
+static int shard_scan(shard_map_t *map, shard_scan_t *scans, bool print)
+{
+    pthread_t tids[SHARD_MAX];
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < map->nshards; i++) {
+        memset(&scans[i], 0, sizeof(scans[i]));
+        scans[i].map = map;
+        scans[i].shard = i;
+        scans[i].print = print;
+        if (pthread_create(&tids[i], NULL, shard_scan_thread, &scans[i]) != 0) {
+            // fall back to scanning this shard on the calling thread
+            tids[i] = 0;
+            shard_scan_thread(&scans[i]);
+        }
+    }
+    for (int i = 0; i < map->nshards; i++) {
+        if (tids[i] != 0)
+            pthread_join(tids[i], NULL);
+        if (scans[i].rc != NO_ERROR)
+            rc = scans[i].rc;
+    }
+    return rc;
+}
+
+/*
+ *  shard_count_db_records
+ *      map:  shard map
+ *
+ *  Sharded version of count_db_records(), the shards are counted in
+ *  parallel.  A single file map goes straight to count_db_records().
+ *
+ *  returns:  <number>       the number of records in db on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  same as count_db_records()
+ */
+int shard_count_db_records(shard_map_t *map)
+{
+    shard_scan_t scans[SHARD_MAX];
+    int total = 0;
+
+    if (map->nshards == 1)
+        return count_db_records(map->fds[0]);
+
+    if (shard_scan(map, scans, false) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    for (int i = 0; i < map->nshards; i++)
+        total += scans[i].count;
+
+    if (total == 0)
+        printf(M_DB_EMPTY);
+    else
+        printf(M_DB_RECORD_CNT, total);
+    return total;
+}
+
+/*
+ *  shard_print_db
+ *      map:  shard map
+ *
+ *  Sharded version of print_db().  Every shard is scanned and formatted on
+ *  its own thread, then the results are written out in shard (and so id)
+ *  order.  A single file map is printed by the pipelined pipe_print_db().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  same as print_db()
+ */
+int shard_print_db(shard_map_t *map)
+{
+    shard_scan_t scans[SHARD_MAX];
+    int total = 0;
+    int rc;
+
+    if (map->nshards == 1)
+        return pipe_print_db(map->fds[0]);
+
+    rc = shard_scan(map, scans, true);
+    if (rc == NO_ERROR) {
+        for (int i = 0; i < map->nshards; i++)
+            total += scans[i].count;
+
+        if (total == 0) {
+            printf(M_DB_EMPTY);
+        } else {
+            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+            for (int i = 0; i < map->nshards; i++)
+                fwrite(scans[i].out, 1, scans[i].out_len, stdout);
+        }
+    } else {
+        printf(M_ERR_DB_READ);
+    }
+
+    for (int i = 0; i < map->nshards; i++)
+        free(scans[i].out);
+    return rc;
+}
+
+/*
+ *  Bulk load state, one batch of records per shard.
+ */
+typedef struct shard_load{
+    shard_map_t *map;
+    int         shard;
+    student_t  *recs;
+    int         nrecs;
+    int         cap;
+    int         loaded;
+    int         dups;
+    int         rc;
+} shard_load_t;
+
+static int cmp_student_id(const void *a, const void *b)
+{
+    const student_t *sa = a;
+    const student_t *sb = b;
+
+    return (sa->id > sb->id) - (sa->id < sb->id);
+}
+
+static void *shard_load_thread(void *arg)
+{
+    shard_load_t *load = arg;
+    int fd = load->map->fds[load->shard];
+    student_t cur;
+
+    // write in id order so each shard file is filled front to back
+    qsort(load->recs, load->nrecs, sizeof(student_t), cmp_student_id);
+
+    for (int i = 0; i < load->nrecs; i++) {
+        off_t pos = (off_t)load->recs[i].id * sizeof(student_t);
+        ssize_t n = stats_pread(fd, &cur, sizeof(cur), pos);
+
+        if (n < 0) {
+            load->rc = ERR_DB_FILE;
+            return NULL;
+        }
+        if (n == sizeof(cur) && memcmp(&cur, &EMPTY_STUDENT_RECORD, sizeof(cur)) != 0) {
+            load->dups++;
+            continue;
+        }
+        if (stats_pwrite(fd, &load->recs[i], sizeof(student_t), pos) != sizeof(student_t)) {
+            load->rc = ERR_DB_FILE;
+            return NULL;
+        }
+        load->loaded++;
+    }
+    return NULL;
+}
+
+static int shard_load_add(shard_load_t *load, student_t *s)
+{
+    if (load->nrecs == load->cap) {
+        int cap = load->cap ? load->cap * 2 : 1024;
+        student_t *recs = realloc(load->recs, cap * sizeof(student_t));
+        if (recs == NULL)
+            return ERR_DB_OP;
+        load->recs = recs;
+        load->cap = cap;
+    }
+    load->recs[load->nrecs++] = *s;
+    return NO_ERROR;
+}
+
+/*
+ *  shard_load_db
+ *      map:       shard map
+ *      loadFile:  text file with one "id first_name last_name gpa" per line
+ *
+ *  Bulk loads students.  The file is parsed and split by shard, then every
+ *  shard is written by its own thread.  Lines that are malformed or out of
+ *  range are skipped with a message, ids already in the database are
+ *  skipped and counted as duplicates.
+ *
+ *  returns:  NO_ERROR       load finished
+ *            ERR_DB_FILE    database or load file I/O issue
+ *            ERR_DB_OP      out of memory
+ *
+ *  console:  M_DB_LOADED       on success
+ *            M_ERR_LOAD_OPEN   the load file could not be opened
+ *            M_ERR_LOAD_LINE   for every line that was skipped
+ *            M_ERR_LOAD_MEM    out of memory
+ *            M_ERR_DB_WRITE    error writing to a shard
+ */
+int shard_load_db(shard_map_t *map, char *loadFile)
+{
+    shard_load_t loads[SHARD_MAX];
+    pthread_t tids[SHARD_MAX];
+    char line[256];
+    int lineno = 0;
+    int loaded = 0;
+    int dups = 0;
+    int rc = NO_ERROR;
+
+    FILE *in = fopen(loadFile, "r");
+    if (in == NULL) {
+        printf(M_ERR_LOAD_OPEN, loadFile);
+        return ERR_DB_FILE;
+    }
+
+    memset(loads, 0, sizeof(loads));
+    for (int i = 0; i < map->nshards; i++) {
+        loads[i].map = map;
+        loads[i].shard = i;
+    }
+
+    while (rc == NO_ERROR && fgets(line, sizeof(line), in) != NULL) {
+        student_t s = EMPTY_STUDENT_RECORD;
+
+        lineno++;
+        if (sscanf(line, "%d %23s %31s %d", &s.id, s.fname, s.lname, &s.gpa) != 4 ||
+            validate_range(s.id, s.gpa) != NO_ERROR) {
+            printf(M_ERR_LOAD_LINE, lineno);
+            continue;
+        }
+        rc = shard_load_add(&loads[shard_of(map, s.id)], &s);
+    }
+    fclose(in);
+
+    if (rc == NO_ERROR) {
+        for (int i = 0; i < map->nshards; i++) {
+            if (pthread_create(&tids[i], NULL, shard_load_thread, &loads[i]) != 0) {
+                tids[i] = 0;
+                shard_load_thread(&loads[i]);
+            }
+        }
+        for (int i = 0; i < map->nshards; i++) {
+            if (tids[i] != 0)
+                pthread_join(tids[i], NULL);
+            if (loads[i].rc != NO_ERROR)
+                rc = loads[i].rc;
+            loaded += loads[i].loaded;
+            dups += loads[i].dups;
+        }
+    }
+
+    for (int i = 0; i < map->nshards; i++)
+        free(loads[i].recs);
+
+    if (rc == ERR_DB_FILE)
+        printf(M_ERR_DB_WRITE);
+    else if (rc == ERR_DB_OP)
+        printf(M_ERR_LOAD_MEM, loadFile);
+    else if (rc == NO_ERROR)
+        printf(M_DB_LOADED, loaded, dups);
+    return rc;
+}
+
+/*
+ *  export_shard
+ *      fd:      shard to export
+ *      out:     export file
+ *      direct:  read the shard with O_DIRECT
+ *      buf:     CACHE_DIRECT_CHUNK byte buffer aligned to CACHE_DIRECT_ALIGN
+ *      count:   incremented for every record written
+ *
+ *  Walks the shard in CACHE_DIRECT_CHUNK reads, using SEEK_DATA to jump
+ *  over holes.  Reads start on CACHE_DIRECT_ALIGN boundaries so the same
+ *  loop works for O_DIRECT.  If the file system refuses O_DIRECT the
+ *  shard is read through the page cache with scan hints instead.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int export_shard(int fd, FILE *out, bool direct, char *buf, int *count)
+{
+    int flags = fcntl(fd, F_GETFL);
+    bool use_direct = direct && flags >= 0 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+    off_t end = stats_lseek(fd, 0, SEEK_END);
+    off_t pos = 0;
+    int rc = NO_ERROR;
+    cache_scan_t cs;
+
+    // O_DIRECT reads do not go through the page cache, nothing to hint
+    cs.fd = -1;
+    if (!use_direct)
+        cache_scan_begin(&cs, fd, 0, end);
+
+    while (pos < end) {
+        off_t data = stats_lseek(fd, pos, SEEK_DATA);
+        if (data == (off_t)-1) {
+            if (errno == ENXIO)
+                break;
+            data = pos;     //no SEEK_DATA support, read the hole
+        }
+
+        data &= ~(off_t)(CACHE_DIRECT_ALIGN - 1);
+        if (data > pos)
+            stats_hole((data - pos) / sizeof(student_t));
+        pos = data;
+
+        ssize_t n = stats_pread(fd, buf, CACHE_DIRECT_CHUNK, pos);
+        if (n < 0) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        if (n == 0)
+            break;
+
+        student_t *recs = (student_t *)buf;
+        for (size_t i = 0; i < n / sizeof(student_t); i++) {
+            if (memcmp(&recs[i], &EMPTY_STUDENT_RECORD, sizeof(student_t)) == 0) {
+                stats_hole(1);
+                continue;
+            }
+            fprintf(out, "%d %s %s %d\n", recs[i].id, recs[i].fname, recs[i].lname, recs[i].gpa);
+            (*count)++;
+        }
+        pos += n;
+        cache_scan_advance(&cs, pos);
+    }
+    cache_scan_end(&cs);
+
+    if (use_direct)
+        fcntl(fd, F_SETFL, flags);
+    return rc;
+}
+
+/*
+ *  shard_export_db
+ *      map:      shard map
+ *      outFile:  text file to write, same format shard_load_db() reads
+ *      direct:   read the database with O_DIRECT
+ *
+ *  Exports every student in id order.  A plain export reads through the
+ *  page cache with sequential hints, dropping the pages again if the
+ *  database was not cached before.  A direct export bypasses the page
+ *  cache for the database entirely and also drops the export file from
+ *  it once written, for exports much larger than memory.
+ *
+ *  returns:  NO_ERROR       export written
+ *            ERR_DB_FILE    database or export file I/O issue
+ *            ERR_DB_OP      out of memory
+ *
+ *  console:  M_DB_EXPORTED      on success
+ *            M_ERR_EXPORT_OPEN  the export file could not be created
+ *            M_ERR_DB_READ      error reading a shard
+ */
+int shard_export_db(shard_map_t *map, char *outFile, bool direct)
+{
+    char *buf;
+    int count = 0;
+    int rc = NO_ERROR;
+
+    if (posix_memalign((void **)&buf, CACHE_DIRECT_ALIGN, CACHE_DIRECT_CHUNK) != 0)
+        return ERR_DB_OP;
+
+    FILE *out = fopen(outFile, "w");
+    if (out == NULL) {
+        free(buf);
+        printf(M_ERR_EXPORT_OPEN, outFile);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < map->nshards && rc == NO_ERROR; i++)
+        rc = export_shard(map->fds[i], out, direct, buf, &count);
+    free(buf);
+
+    if (rc == NO_ERROR && fflush(out) != 0)
+        rc = ERR_DB_FILE;
+    if (rc == NO_ERROR && direct && cache_hints_enabled()) {
+        fdatasync(fileno(out));
+        posix_fadvise(fileno(out), 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if (fclose(out) != 0 && rc == NO_ERROR)
+        rc = ERR_DB_FILE;
+
+    if (rc != NO_ERROR)
+        printf(M_ERR_DB_READ);
+    else
+        printf(M_DB_EXPORTED, count, outFile);
+    return rc;
+}
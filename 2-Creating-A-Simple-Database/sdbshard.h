@@ -0,0 +1,54 @@
+#ifndef __SDB_SHARD_H__
+    #define __SDB_SHARD_H__
+
+#include <stdbool.h>
+
+#include "db.h"
+
+//Sharded database layout.  The id space MIN_STD_ID..MAX_STD_ID is split
+//into nshards contiguous ranges, each range lives in its own file inside
+//SHARD_DIR with its own fd.  A record keeps the offset it would have had in
+//a single student.db (id * STUDENT_RECORD_SIZE), the part of each shard
+//file before its range is a hole and costs nothing on disk.  That means the
+//single record functions in sdbsc.c work unchanged on a shard fd, and
+//walking the shards in order walks the ids in order.
+//
+//A plain student.db is treated as a map with a single shard, so callers
+//can always go through the shard map.
+//
+//The sharded layout is used when SHARD_DIR exists, or created when the
+//SDB_SHARDS environment variable asks for more than one shard.
+
+#define SHARD_DIR           "student.db.d"
+#define SHARD_FILE_FMT      "%s/shard-%03d.db"
+#define SHARD_MAX           64
+#define SHARD_ENV           "SDB_SHARDS"
+
+typedef struct shard_map{
+    int  nshards;
+    int  ids_per_shard;
+    int  fds[SHARD_MAX];
+    char dir[256];          //empty when using a single db file
+} shard_map_t;
+
+//prototypes
+int  shard_open_db(shard_map_t *map, char *dbFile, char *shardDir, bool should_truncate);
+void shard_close_db(shard_map_t *map);
+int  shard_of(shard_map_t *map, int id);
+int  shard_fd(shard_map_t *map, int id);
+int  shard_first_id(shard_map_t *map, int shard);
+int  shard_count_db_records(shard_map_t *map);
+int  shard_print_db(shard_map_t *map);
+int  shard_load_db(shard_map_t *map, char *loadFile);
+int  shard_export_db(shard_map_t *map, char *outFile, bool direct);
+
+#define M_ERR_SHARD_CNT   "Shard count mismatch, %s has %d shard(s) but %s=%d\n"
+#define M_ERR_SHARD_DB    "%s already holds records, refusing to create shards for %s=%d\n"
+#define M_ERR_LOAD_OPEN   "Error opening load file %s\n"
+#define M_ERR_LOAD_LINE   "Skipping bad load line %d\n"
+#define M_ERR_LOAD_MEM    "Out of memory loading %s\n"
+#define M_DB_LOADED       "Loaded %d student record(s), %d duplicate(s) skipped.\n"
+#define M_ERR_EXPORT_OPEN "Error creating export file %s\n"
+#define M_DB_EXPORTED     "Exported %d student record(s) to %s.\n"
+
+#endif
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sdbstats.h"
+
+static int stats_fmt = STATS_FMT_OFF;
+static op_stats_t op_table[STATS_MAX_OPS];
+static int op_count = 0;
+
+//the operation currently being measured, and when it started
+static op_stats_t *cur_op = NULL;
+static uint64_t cur_start_ns = 0;
+
+/*
+ *  stats_init
+ *
+ *  Reads the SDB_STATS environment variable to decide if stats should be
+ *  collected and how they should be reported.  Unknown values are treated
+ *  as "text" so that SDB_STATS=1 does the obvious thing.
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  Does not produce any console I/O
+ */
+void stats_init(void)
+{
+    const char *mode = getenv("SDB_STATS");
+
+    stats_reset();
+    if (mode == NULL || *mode == '\0' || strcmp(mode, "0") == 0)
+        stats_fmt = STATS_FMT_OFF;
+    else if (strcmp(mode, "json") == 0)
+        stats_fmt = STATS_FMT_JSON;
+    else
+        stats_fmt = STATS_FMT_TEXT;
+}
+
+int stats_enabled(void)
+{
+    return stats_fmt != STATS_FMT_OFF;
+}
+
+/*
+ *  stats_now_ns
+ *
+ *  returns:  the current CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ *  Latencies are kept in a log-linear histogram: values below
+ *  STATS_SUB_BUCKETS get their own bucket, above that every power of two
+ *  is split into STATS_SUB_BUCKETS equal parts.  That bounds the error of a
+ *  reported percentile to 1/STATS_SUB_BUCKETS (12.5%) of the true value
+ *  while keeping the table a fixed size.
+ */
+static int hist_bucket(uint64_t v)
+{
+    if (v < STATS_SUB_BUCKETS)
+        return (int)v;
+
+    int msb = 63 - __builtin_clzll(v);
+    return (msb - 2) * STATS_SUB_BUCKETS + (int)((v >> (msb - 3)) & (STATS_SUB_BUCKETS - 1));
+}
+
+static uint64_t hist_upper(int idx)
+{
+    if (idx < STATS_SUB_BUCKETS)
+        return (uint64_t)idx;
+
+    int msb = idx / STATS_SUB_BUCKETS + 2;
+    uint64_t sub = idx % STATS_SUB_BUCKETS;
+    uint64_t lower = (STATS_SUB_BUCKETS + sub) << (msb - 3);
+    return lower + (1ull << (msb - 3)) - 1;
+}
+
+static op_stats_t *find_op(const char *op, int create)
+{
+    for (int i = 0; i < op_count; i++) {
+        if (strcmp(op_table[i].name, op) == 0)
+            return &op_table[i];
+    }
+    if (!create || op_count >= STATS_MAX_OPS)
+        return NULL;
+
+    op_stats_t *st = &op_table[op_count++];
+    memset(st, 0, sizeof(*st));
+    st->name = op;
+    return st;
+}
+
+const op_stats_t *stats_lookup(const char *op)
+{
+    return find_op(op, 0);
+}
+
+/*
+ *  stats_begin
+ *      op:  name of the operation, normally the name of the sdbsc function
+ *           that implements it.  The string must outlive the stats table,
+ *           string literals are what is expected here.
+ *
+ *  Starts timing op.  Every syscall made through the stats_* wrappers until
+ *  the matching stats_end() is charged to op.
+ */
+void stats_begin(const char *op)
+{
+    if (!stats_enabled())
+        return;
+
+    cur_op = find_op(op, 1);
+    cur_start_ns = stats_now_ns();
+}
+
+/*
+ *  stats_end
+ *
+ *  Stops timing the current operation and records its latency.
+ */
+void stats_end(void)
+{
+    if (!stats_enabled() || cur_op == NULL)
+        return;
+
+    uint64_t ns = stats_now_ns() - cur_start_ns;
+    cur_op->calls++;
+    cur_op->total_ns += ns;
+    if (ns > cur_op->max_ns)
+        cur_op->max_ns = ns;
+    cur_op->hist[hist_bucket(ns)]++;
+    cur_op = NULL;
+}
+
+/*
+ *  The syscall wrappers may be called from several threads at once (the
+ *  sharded scans run one thread per shard) so the counters are bumped with
+ *  relaxed atomics.  Nothing orders against them, they only need to add up.
+ */
+#define STAT_ADD(field, v)  __atomic_fetch_add(&(field), (uint64_t)(v), __ATOMIC_RELAXED)
+
+ssize_t stats_read(int fd, void *buf, size_t count)
+{
+    ssize_t n = read(fd, buf, count);
+
+    if (cur_op != NULL) {
+        STAT_ADD(cur_op->read_calls, 1);
+        if (n > 0)
+            STAT_ADD(cur_op->bytes_read, n);
+    }
+    return n;
+}
+
+ssize_t stats_write(int fd, const void *buf, size_t count)
+{
+    ssize_t n = write(fd, buf, count);
+
+    if (cur_op != NULL) {
+        STAT_ADD(cur_op->write_calls, 1);
+        if (n > 0)
+            STAT_ADD(cur_op->bytes_written, n);
+    }
+    return n;
+}
+
+ssize_t stats_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    ssize_t n = pread(fd, buf, count, offset);
+
+    if (cur_op != NULL) {
+        STAT_ADD(cur_op->read_calls, 1);
+        if (n > 0)
+            STAT_ADD(cur_op->bytes_read, n);
+    }
+    return n;
+}
+
+ssize_t stats_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    ssize_t n = pwrite(fd, buf, count, offset);
+
+    if (cur_op != NULL) {
+        STAT_ADD(cur_op->write_calls, 1);
+        if (n > 0)
+            STAT_ADD(cur_op->bytes_written, n);
+    }
+    return n;
+}
+
+off_t stats_lseek(int fd, off_t offset, int whence)
+{
+    if (cur_op != NULL)
+        STAT_ADD(cur_op->lseek_calls, 1);
+    return lseek(fd, offset, whence);
+}
+
+void stats_hole(uint64_t nrecords)
+{
+    if (cur_op != NULL)
+        STAT_ADD(cur_op->holes_skipped, nrecords);
+}
+
+/*
+ *  stats_percentile
+ *      st:   operation stats
+ *      pct:  percentile to compute, 0 < pct <= 100
+ *
+ *  returns:  the latency in ns at or below which pct percent of the calls
+ *            completed.  This is the upper edge of the histogram bucket
+ *            so it is never optimistic, but it is capped by the largest
+ *            latency actually observed.
+ */
+uint64_t stats_percentile(const op_stats_t *st, double pct)
+{
+    if (st == NULL || st->calls == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)((pct / 100.0) * st->calls + 0.999999);
+    uint64_t seen = 0;
+
+    if (target == 0)
+        target = 1;
+    for (int i = 0; i < STATS_HIST_BUCKETS; i++) {
+        seen += st->hist[i];
+        if (seen >= target) {
+            uint64_t v = hist_upper(i);
+            return v < st->max_ns ? v : st->max_ns;
+        }
+    }
+    return st->max_ns;
+}
+
+void stats_reset(void)
+{
+    memset(op_table, 0, sizeof(op_table));
+    op_count = 0;
+    cur_op = NULL;
+}
+
+static void report_text(FILE *out)
+{
+    fprintf(out, "%-18s %7s %7s %7s %7s %10s %10s %8s %10s %10s %10s\n",
+            "OP", "CALLS", "READS", "WRITES", "LSEEKS", "BYTES_RD", "BYTES_WR",
+            "HOLES", "P50_NS", "P99_NS", "MAX_NS");
+    for (int i = 0; i < op_count; i++) {
+        op_stats_t *st = &op_table[i];
+        fprintf(out, "%-18s %7llu %7llu %7llu %7llu %10llu %10llu %8llu %10llu %10llu %10llu\n",
+                st->name,
+                (unsigned long long)st->calls,
+                (unsigned long long)st->read_calls,
+                (unsigned long long)st->write_calls,
+                (unsigned long long)st->lseek_calls,
+                (unsigned long long)st->bytes_read,
+                (unsigned long long)st->bytes_written,
+                (unsigned long long)st->holes_skipped,
+                (unsigned long long)stats_percentile(st, 50.0),
+                (unsigned long long)stats_percentile(st, 99.0),
+                (unsigned long long)st->max_ns);
+    }
+}
+
+static void report_json(FILE *out)
+{
+    fprintf(out, "{\"ops\":[");
+    for (int i = 0; i < op_count; i++) {
+        op_stats_t *st = &op_table[i];
+        fprintf(out, "%s{\"op\":\"%s\",\"calls\":%llu,\"read_calls\":%llu,"
+                "\"write_calls\":%llu,\"lseek_calls\":%llu,\"bytes_read\":%llu,"
+                "\"bytes_written\":%llu,\"holes_skipped\":%llu,\"total_ns\":%llu,"
+                "\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}",
+                i ? "," : "",
+                st->name,
+                (unsigned long long)st->calls,
+                (unsigned long long)st->read_calls,
+                (unsigned long long)st->write_calls,
+                (unsigned long long)st->lseek_calls,
+                (unsigned long long)st->bytes_read,
+                (unsigned long long)st->bytes_written,
+                (unsigned long long)st->holes_skipped,
+                (unsigned long long)st->total_ns,
+                (unsigned long long)stats_percentile(st, 50.0),
+                (unsigned long long)stats_percentile(st, 99.0),
+                (unsigned long long)st->max_ns);
+    }
+    fprintf(out, "]}\n");
+}
+
+/*
+ *  stats_report
+ *
+ *  Writes the collected stats in the format selected by SDB_STATS, to the
+ *  file named by SDB_STATS_FILE (appending, so repeated runs build up a
+ *  log) or to stderr.  stdout is never used so the normal program output
+ *  is unchanged when stats are turned on.
+ */
+void stats_report(void)
+{
+    if (!stats_enabled())
+        return;
+
+    FILE *out = stderr;
+    const char *path = getenv("SDB_STATS_FILE");
+    if (path != NULL && *path != '\0') {
+        out = fopen(path, "a");
+        if (out == NULL) {
+            perror("SDB_STATS_FILE");
+            out = stderr;
+        }
+    }
+
+    if (stats_fmt == STATS_FMT_JSON)
+        report_json(out);
+    else
+        report_text(out);
+
+    if (out != stderr)
+        fclose(out);
+}
@@ -0,0 +1,56 @@
+#ifndef __SDB_STATS_H__
+    #define __SDB_STATS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+//Instrumentation for sdbsc.  Every read(), write(), pread(), pwrite() and
+//lseek() the database code makes goes through the stats_* wrappers below so that calls and bytes
+//can be charged to the operation that is currently running (see
+//stats_begin() / stats_end()).  Stats are only collected when the SDB_STATS
+//environment variable is set, otherwise the wrappers are plain syscalls.
+//
+//  SDB_STATS=text      human readable report on stderr at exit
+//  SDB_STATS=json      one line machine readable JSON report on stderr
+//  SDB_STATS_FILE=path write the report to path instead of stderr
+
+#define STATS_MAX_OPS       16      //distinct operation names tracked
+#define STATS_SUB_BUCKETS   8       //histogram sub-buckets per power of 2
+#define STATS_HIST_BUCKETS  (64 * STATS_SUB_BUCKETS)
+
+#define STATS_FMT_OFF       0
+#define STATS_FMT_TEXT      1
+#define STATS_FMT_JSON      2
+
+typedef struct op_stats{
+    const char *name;
+    uint64_t calls;
+    uint64_t read_calls;
+    uint64_t write_calls;
+    uint64_t lseek_calls;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t holes_skipped;     //empty record slots passed over
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint32_t hist[STATS_HIST_BUCKETS];
+} op_stats_t;
+
+//prototypes
+void    stats_init(void);
+int     stats_enabled(void);
+void    stats_begin(const char *op);
+void    stats_end(void);
+ssize_t stats_read(int fd, void *buf, size_t count);
+ssize_t stats_write(int fd, const void *buf, size_t count);
+ssize_t stats_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t stats_pwrite(int fd, const void *buf, size_t count, off_t offset);
+off_t   stats_lseek(int fd, off_t offset, int whence);
+void    stats_hole(uint64_t nrecords);
+uint64_t stats_now_ns(void);
+uint64_t stats_percentile(const op_stats_t *st, double pct);
+const op_stats_t *stats_lookup(const char *op);
+void    stats_reset(void);
+void    stats_report(void);
+
+#endif
@@ -1,11 +1,19 @@
 #!/usr/bin/env bats
 
+# Remove every database file, a left over shard directory would otherwise
+# be picked up instead of student.db
+clean_db() {
+    rm -rf student.db student.db.d student.lsm .student.col .student.mem
+    rm -rf test_load.txt test_export*.txt test_backup test_shards test_stats*
+}
+
 # The setup function runs before every test
 setup_file() {
     # Delete the student.db file if it exists
     if [ -f "student.db" ]; then
         rm "student.db"
     fi
+    clean_db
 }
 
 @test "Check if database is empty to start" {
@@ -193,4 +201,563 @@ setup_file() {
         echo "Failed Output:  $output"
         return 1
     }
-}
\ No newline at end of file
+}
+
+@test "SDB_SHARDS creates a sharded database in student.db.d" {
+    clean_db
+    SDB_SHARDS=4 run ./sdbsc -a 1 john doe 345
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 1 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ -d student.db.d ]
+    [ ! -e student.db ]
+    [ "$(ls student.db.d | wc -l)" -eq 4 ]
+}
+
+@test "Add, find, print and count across shards" {
+    run ./sdbsc -a 50000 jane doe 390
+    [ "$status" -eq 0 ]
+    run ./sdbsc -a 99999 big dude 205
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -f 50000
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "50000 jane doe 3.90" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 50000 jane doe 3.90 99999 big dude 2.05"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Shard count mismatch is an error" {
+    SDB_SHARDS=2 run ./sdbsc -c
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Shard count mismatch, student.db.d has 4 shard(s) but SDB_SHARDS=2" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "SDB_SHARDS refuses to hide a single file database" {
+    mv student.db.d test_shards
+    ./sdbsc -a 2 amy lee 310
+    SDB_SHARDS=4 run ./sdbsc -c
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "student.db already holds records, refusing to create shards for SDB_SHARDS=4" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ ! -e student.db.d ]
+    rm student.db
+    mv test_shards student.db.d
+}
+
+@test "Bulk load skips duplicates and bad lines" {
+    printf '5 amy lee 310\n1 dup student 200\nnot a student\n70000 bob ray 250\n' > test_load.txt
+    run ./sdbsc -l test_load.txt
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Skipping bad load line 3" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Loaded 2 student record(s), 1 duplicate(s) skipped." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 1
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "1 john doe 3.45" ]
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 5 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    clean_db
+}
+
+@test "GPA stats and range query from the columnar side file" {
+    clean_db
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 3 jane doe 390
+    ./sdbsc -a 63 jim doe 285
+
+    run ./sdbsc -g
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "GPA stats: count=3 min=2.85 max=3.90 avg=3.40" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ -f .student.col ]
+
+    run ./sdbsc -q 300 400
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 3 jane doe 3.90"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -q 100 200
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "No students with GPA between 1.00 and 2.00." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Columnar side file follows a delete" {
+    run ./sdbsc -d 3
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -g
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "GPA stats: count=2 min=2.85 max=3.45 avg=3.15" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -q 300 400
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+}
+
+@test "Columnar side file is rebuilt after student.db is removed" {
+    rm student.db
+    run ./sdbsc -a 7 new student 250
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -g
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "GPA stats: count=1 min=2.50 max=2.50 avg=2.50" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -q 0 500
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST_NAME LAST_NAME GPA 7 new student 2.50" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+    clean_db
+}
+
+@test "LSM engine add, duplicate, delete, find and count" {
+    clean_db
+    SDB_ENGINE=lsm run ./sdbsc -a 1 john doe 345
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 1 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ -f student.lsm/wal.log ]
+    [ ! -e student.db ]
+
+    # student.lsm exists now, so the engine is used without SDB_ENGINE
+    run ./sdbsc -a 1 dup student 300
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant add student with ID=1, already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    ./sdbsc -a 3 jane doe 390
+    ./sdbsc -a 63 jim doe 285
+    run ./sdbsc -d 3
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 3 was deleted from database." ]
+    run ./sdbsc -d 3
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 3 was not found in database." ]
+
+    run ./sdbsc -f 63
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "63 jim doe 2.85" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "LSM compaction merges every run into one" {
+    # more than a memtable worth of records, so they spill into runs
+    seq 100 9099 | awk '{ print $1, "first" $1, "last" $1, 300 }' > test_load.txt
+    run ./sdbsc -l test_load.txt
+    [ "$status" -eq 0 ]
+    [ "$(ls student.lsm | grep -c '\.sst$')" -gt 1 ]
+    ./sdbsc -d 500
+
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database successfully compacted into 1 run(s)!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(ls student.lsm | grep -c '\.sst$')" -eq 1 ]
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 9001 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -f 500
+    [ "$status" -eq 1 ]
+    run ./sdbsc -f 9099
+    [ "$status" -eq 0 ]
+}
+
+@test "LSM engine reports -g, -q and -B as not implemented" {
+    run ./sdbsc -g
+    [ "$status" -eq 3 ]
+    [ "${lines[0]}" = "The requested operation is not implemented yet!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -q 100 400
+    [ "$status" -eq 3 ]
+    [ "${lines[0]}" = "The requested operation is not implemented yet!" ]
+    run ./sdbsc -B test_backup
+    [ "$status" -eq 3 ]
+    [ "${lines[0]}" = "The requested operation is not implemented yet!" ]
+    [ ! -e test_backup ]
+}
+
+@test "LSM engine zero removes every record" {
+    run ./sdbsc -z
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "All database records removed!" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(ls student.lsm | grep -c '\.sst$')" -eq 0 ]
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains no student records." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    clean_db
+}
+
+@test "O_DIRECT export matches the normal export" {
+    clean_db
+    seq 1 2000 | awk '{ print $1 * 7, "first" $1, "last" $1, $1 % 500 }' > test_load.txt
+    ./sdbsc -l test_load.txt
+    ./sdbsc -a 99999 big dude 205
+
+    run ./sdbsc -e test_export_e.txt
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Exported 2001 student record(s) to test_export_e.txt." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    run ./sdbsc -E test_export_direct.txt
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Exported 2001 student record(s) to test_export_direct.txt." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    cmp test_export_e.txt test_export_direct.txt
+}
+
+@test "SDB_CACHE=off does not change any output" {
+    for args in "-p" "-c" "-f 700" "-f 701"; do
+        run ./sdbsc $args
+        expected_status=$status
+        expected_output=$output
+        SDB_CACHE=off run ./sdbsc $args
+        [ "$status" -eq "$expected_status" ]
+        [ "$output" = "$expected_output" ] || {
+            echo "Failed Output for $args: $output"
+            echo "Expected Output: $expected_output"
+            return 1
+        }
+    done
+
+    SDB_CACHE=off ./sdbsc -e test_export_off.txt
+    cmp test_export_e.txt test_export_off.txt
+    clean_db
+}
+
+@test "Serve mode answers f, a, d and c from stdin" {
+    clean_db
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 3 jane doe 390
+
+    run ./sdbsc -s <<< $'f 3\na 7 amy lee 310\na 7 dup student 100\nd 1\nd 1\nf 1\nc\nbogus\nq'
+    [ "$status" -eq 0 ]
+    [[ "${lines[0]}" == "Loaded 2 student record(s) from the database in "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    normalized_output=$(echo -n "${lines[3]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "3 jane doe 3.90" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[4]}" = "Student 7 added to database." ]
+    [ "${lines[5]}" = "Cant add student with ID=7, already exists in db." ]
+    [ "${lines[6]}" = "Student 1 was deleted from database." ]
+    [ "${lines[7]}" = "Student 1 was not found in database." ]
+    [ "${lines[8]}" = "Student 1 was not found in database." ]
+    [ "${lines[9]}" = "Database contains 2 student record(s)." ]
+    [ "${lines[10]}" = "Unknown command, use f id | a id first last gpa | d id | c | m | s | q" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ -f .student.mem ]
+}
+
+@test "Serve mode writes reach student.db" {
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 3 jane doe 3.90 7 amy lee 3.10"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Serve mode ignores a snapshot once the db has changed" {
+    run ./sdbsc -s <<< 'c'
+    [[ "${lines[0]}" == "Loaded 2 student record(s) from .student.mem in "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    ./sdbsc -a 9 new student 200
+    run ./sdbsc -s <<< $'f 9\nc'
+    [ "$status" -eq 0 ]
+    [[ "${lines[0]}" == "Loaded 3 student record(s) from the database in "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    normalized_output=$(echo -n "${lines[3]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "9 new student 2.00" ]
+    [ "${lines[4]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+# overwrite bytes of .student.mem at an offset, leaving the rest as it is
+damage_snapshot() {
+    printf "$2" | dd of=.student.mem bs=1 seek="$1" conv=notrunc status=none
+}
+
+@test "Serve mode rebuilds a damaged snapshot from the db" {
+    # nrecords larger than the table can hold
+    damage_snapshot 8 '\377\377\377\377'
+    run ./sdbsc -s <<< 'c'
+    [[ "${lines[0]}" == "Loaded 3 student record(s) from the database in "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # the arena no longer ends in a terminator
+    run ./sdbsc -s <<< 'c'
+    [[ "${lines[0]}" == "Loaded 3 student record(s) from .student.mem in "* ]]
+    damage_snapshot $(( $(stat -c %s .student.mem) - 1 )) 'x'
+    run ./sdbsc -s <<< 'c'
+    [[ "${lines[0]}" == "Loaded 3 student record(s) from the database in "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # name offsets past the end of the arena in every slot
+    damage_snapshot 40 "$(printf '\\377%.0s' $(seq 1 64))"
+    run ./sdbsc -s <<< $'f 9\nc'
+    [[ "${lines[0]}" == "Loaded 3 student record(s) from the database in "* ]] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    normalized_output=$(echo -n "${lines[3]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "9 new student 2.00" ]
+    clean_db
+}
+
+@test "Backup, incremental backup and restore round trip" {
+    clean_db
+    ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 3 jane doe 390
+    ./sdbsc -a 99999 big dude 205
+
+    run ./sdbsc -B test_backup
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Backup of 1 file(s) to test_backup: 2 chunk(s), 2 changed, 108544 byte(s) written." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # only the 64K chunk holding student 3 changes
+    ./sdbsc -d 3
+    run ./sdbsc -B test_backup
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Backup of 1 file(s) to test_backup: 2 chunk(s), 1 changed, 65536 byte(s) written." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    expected_output=$(./sdbsc -p)
+
+    run ./sdbsc -z
+    [ "$status" -eq 0 ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains no student records." ]
+
+    run ./sdbsc -R test_backup
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Restored 1 file(s) from test_backup, 108544 byte(s) of data." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    [ "$output" = "$expected_output" ] || {
+        echo "Failed Output: $output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+    clean_db
+}
+
+@test "Restore replaces a database of a different layout" {
+    clean_db
+    SDB_SHARDS=4 ./sdbsc -a 1 john doe 345
+    ./sdbsc -a 60000 jane doe 390
+    ./sdbsc -B test_backup
+    expected_output=$(./sdbsc -p)
+
+    # 4 shard backup over 8 shards
+    rm -rf student.db.d
+    SDB_SHARDS=8 ./sdbsc -a 70000 jim doe 285
+    run ./sdbsc -R test_backup
+    [ "$status" -eq 0 ]
+    [ "$(ls student.db.d | wc -l)" -eq 4 ]
+    run ./sdbsc -p
+    [ "$output" = "$expected_output" ] || {
+        echo "Failed Output: $output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+    run ./sdbsc -f 60000
+    [ "$status" -eq 0 ]
+
+    # single file backup over shards
+    rm -rf student.db.d test_backup
+    ./sdbsc -a 3 big dude 205
+    ./sdbsc -B test_backup
+    expected_output=$(./sdbsc -p)
+    rm student.db
+    SDB_SHARDS=4 ./sdbsc -a 70000 jim doe 285
+    run ./sdbsc -R test_backup
+    [ "$status" -eq 0 ]
+    [ ! -e student.db.d ]
+    run ./sdbsc -p
+    [ "$output" = "$expected_output" ] || {
+        echo "Failed Output: $output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Restore refuses manifest paths outside the database" {
+    printf 'SDBBACKUP1\nfile ../test_escape.db 64 0 0\n' > test_backup/MANIFEST
+    run ./sdbsc -R test_backup
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Backup manifest in test_backup names files that are not database files" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ ! -e ../test_escape.db ]
+
+    printf 'SDBBACKUP1\nfile /tmp/test_escape.db 64 0 0\n' > test_backup/MANIFEST
+    run ./sdbsc -R test_backup
+    [ "$status" -eq 1 ]
+    [ ! -e /tmp/test_escape.db ]
+    clean_db
+}
+
+@test "SDB_STATS=json reports each op with its latency percentiles" {
+    ./sdbsc -a 1 john doe 345 > /dev/null
+    SDB_STATS=json ./sdbsc -f 1 > test_stats_out.txt 2> test_stats.json
+    # stdout is the normal output, the report only goes to stderr
+    [[ "$(head -n 1 test_stats_out.txt)" == "ID "*"FIRST_NAME"*"GPA" ]] || {
+        cat test_stats_out.txt
+        return 1
+    }
+    run cat test_stats.json
+    [ "${#lines[@]}" -eq 1 ]
+    [[ "$output" == '{"ops":[{"op":"get_student","calls":1,'* ]] || {
+        echo "Failed Output: $output"
+        return 1
+    }
+    for field in read_calls bytes_read total_ns p50_ns p99_ns max_ns; do
+        [[ "$output" =~ \"$field\":[0-9]+[,}] ]] || {
+            echo "Missing $field: $output"
+            return 1
+        }
+    done
+    [[ "$output" == *'}]}' ]]
+    clean_db
+}
+
+@test "SDB_STATS_FILE appends a report per run" {
+    SDB_STATS=json SDB_STATS_FILE=test_stats.json ./sdbsc -a 1 john doe 345 > /dev/null
+    SDB_STATS=json SDB_STATS_FILE=test_stats.json ./sdbsc -d 1 > /dev/null
+    run cat test_stats.json
+    [ "${#lines[@]}" -eq 2 ]
+    [[ "${lines[0]}" == '{"ops":[{"op":"add_student","calls":1,'* ]] || {
+        echo "Failed Output: $output"
+        return 1
+    }
+    [[ "${lines[1]}" == '{"ops":[{"op":"del_student","calls":1,'* ]] || {
+        echo "Failed Output: $output"
+        return 1
+    }
+
+    # the text report goes to the same file, after the json ones
+    SDB_STATS=1 SDB_STATS_FILE=test_stats.json ./sdbsc -c > /dev/null
+    run cat test_stats.json
+    [ "${#lines[@]}" -eq 4 ]
+    [[ "${lines[2]}" == "OP "*"CALLS"*"P50_NS"*"P99_NS"*"MAX_NS" ]]
+    [[ "${lines[3]}" == "count_db_records "* ]] || {
+        echo "Failed Output: $output"
+        return 1
+    }
+    clean_db
+}
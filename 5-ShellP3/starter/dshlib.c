@@ -3,8 +3,10 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include "dragon.h"
 #include "dshlib.h"
@@ -214,49 +216,142 @@ int free_cmd_list(command_list_t *cmd_lst) {
     return OK;
 }
 
+/*
+ * Starting commands
+ *
+ * fork() copies the page tables of the whole shell only for the child to
+ * throw them away in execvp(), so a command costs more the bigger the
+ * shell has grown.  posix_spawnp() starts the program without that copy;
+ * glibc runs it with clone(CLONE_VM|CLONE_VFORK).  The dup2() and close()
+ * plumbing a forked child would do becomes spawn file actions, and
+ * redirection files are opened here in the parent, so the error still
+ * says which one failed.  fork() remains the fallback when the spawn
+ * itself can not be had, and runs everything when DSH_SPAWN=fork is set.
+ */
+static bool spawn_enabled(void) {
+    const char *mode = getenv("DSH_SPAWN");
+    return !mode || strcmp(mode, "fork") != 0;
+}
+
+// Opens cmd's < file onto *in_fd and its > or >> file onto *out_fd
+static int open_redirects(cmd_buff_t *cmd, bool first, bool last, int *in_fd, int *out_fd) {
+    if (first && cmd->input_file) {
+        *in_fd = open(cmd->input_file, O_RDONLY);
+        if (*in_fd == -1) {
+            perror("Input redirection failed");
+            return -1;
+        }
+    }
+    if (last && cmd->output_file) {
+        int flags = O_WRONLY | O_CREAT | (cmd->append_mode ? O_APPEND : O_TRUNC);
+        *out_fd = open(cmd->output_file, flags, 0644);
+        if (*out_fd == -1) {
+            perror("Output redirection failed");
+            return -1;
+        }
+    }
+    return OK;
+}
+
+/*
+ * start_cmd
+ *      cmd:            the command to run
+ *      in_fd, out_fd:  what becomes its stdin and stdout
+ *      fds, nfds:      every pipe end and redirection file, all closed in
+ *                      the child, each listed once
+ *
+ * Returns the child's pid, or -1 if it could not be started.  The reason
+ * has been printed.
+ */
+static pid_t start_cmd(cmd_buff_t *cmd, int in_fd, int out_fd, const int *fds, int nfds) {
+    extern char **environ;
+
+    if (spawn_enabled()) {
+        posix_spawn_file_actions_t actions;
+        pid_t pid;
+        int rc = posix_spawn_file_actions_init(&actions);
+
+        if (rc == 0 && in_fd != STDIN_FILENO) {
+            rc = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+        }
+        if (rc == 0 && out_fd != STDOUT_FILENO) {
+            rc = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+        }
+        for (int i = 0; rc == 0 && i < nfds; i++) {
+            rc = posix_spawn_file_actions_addclose(&actions, fds[i]);
+        }
+        if (rc == 0) {
+            rc = posix_spawnp(&pid, cmd->argv[0], &actions, NULL, cmd->argv, environ);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+
+        if (rc == 0) {
+            return pid;
+        }
+        // Anything but a failed clone() is the program failing to start
+        if (rc != EAGAIN && rc != ENOMEM && rc != ENOSYS) {
+            fprintf(stderr, "Command execution failed: %s\n", strerror(rc));
+            return -1;
+        }
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Fork failed");
+        return -1;
+    } else if (pid == 0) {
+        if (in_fd != STDIN_FILENO && dup2(in_fd, STDIN_FILENO) == -1) {
+            perror("dup2");
+            _exit(EXIT_FAILURE);
+        }
+        if (out_fd != STDOUT_FILENO && dup2(out_fd, STDOUT_FILENO) == -1) {
+            perror("dup2");
+            _exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        // _exit(), as exit() would flush the copy of the shell's stdout buffer
+        execvp(cmd->argv[0], cmd->argv);
+        perror("Command execution failed");
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
 // Prototype for executing one command
 int exec_cmd(cmd_buff_t *cmd) {
     Built_In_Cmds type = exec_built_in_cmd(cmd);
     if (type == BI_NOT_BI) {
-        pid_t pid = fork();
+        int in_fd = STDIN_FILENO;
+        int out_fd = STDOUT_FILENO;
+        int fds[2];
+        int nfds = 0;
+        pid_t pid = -1;
+
+        int rc = open_redirects(cmd, true, true, &in_fd, &out_fd);
+        if (in_fd > STDIN_FILENO) {
+            fds[nfds++] = in_fd;
+        }
+        if (out_fd > STDOUT_FILENO) {
+            fds[nfds++] = out_fd;
+        }
+        if (rc == OK) {
+            pid = start_cmd(cmd, in_fd, out_fd, fds, nfds);
+        }
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
         if (pid < 0) {
-            perror("Fork failed");
-            return -1;
-        } else if (pid == 0) {
-            // Handle input redirection
-            if (cmd->input_file) {
-                int fd = open(cmd->input_file, O_RDONLY);
-                if (fd == -1) {
-                    perror("Input redirection failed");
-                    exit(EXIT_FAILURE);
-                }
-                dup2(fd, STDIN_FILENO);
-                close(fd);
-            }
-            
-            // Handle output redirection
-            if (cmd->output_file) {
-                int flags = O_WRONLY | O_CREAT | (cmd->append_mode ? O_APPEND : O_TRUNC);
-                int fd = open(cmd->output_file, flags, 0644);
-                if (fd == -1) {
-                    perror("Output redirection failed");
-                    exit(EXIT_FAILURE);
-                }
-                dup2(fd, STDOUT_FILENO);
-                close(fd);
-            }
-            
-            execvp(cmd->argv[0], cmd->argv);
-            perror("Command execution failed");
-            exit(EXIT_FAILURE);
-        } else {
-            int status;
-            waitpid(pid, &status, 0);
-            if (WIFEXITED(status)) {
-                return WEXITSTATUS(status);
-            }
             return -1;
         }
+
+        int status;
+        waitpid(pid, &status, 0);
+        if (WIFEXITED(status)) {
+            return WEXITSTATUS(status);
+        }
+        return -1;
     }
     return OK;
 }
@@ -269,79 +364,52 @@ int execute_pipeline(command_list_t *clist) {
 
     int pipes[clist->num - 1][2];
     pid_t pids[clist->num];
+    int fds[2 * clist->num];    // pipe ends, then the redirection files
+    int nfds = 0;
 
     for (int i = 0; i < clist->num - 1; i++) {
         if (pipe(pipes[i]) == -1) {
             perror("pipe");
+            for (int j = 0; j < nfds; j++) {
+                close(fds[j]);
+            }
             return -1;
         }
+        fds[nfds++] = pipes[i][0];
+        fds[nfds++] = pipes[i][1];
     }
 
-    for (int i = 0; i < clist->num; i++) {
-        pids[i] = fork();
-        if (pids[i] < 0) {
-            perror("fork");
-            return -1;
-        }
-        
-        if (pids[i] == 0) {
-            if (i == 0 && clist->commands[i].input_file) {
-                int fd = open(clist->commands[i].input_file, O_RDONLY);
-                if (fd == -1) {
-                    perror("Input redirection failed");
-                    exit(EXIT_FAILURE);
-                }
-                if (dup2(fd, STDIN_FILENO) == -1) {
-                    perror("Input redirection failed");
-                    exit(EXIT_FAILURE);
-                }
-                close(fd);
-            } else if (i > 0) {
-                if (dup2(pipes[i - 1][0], STDIN_FILENO) == -1) {
-                    perror("dup2");
-                    exit(EXIT_FAILURE);
-                }
-            }
-            
-            if (i == clist->num - 1 && clist->commands[i].output_file) {
-                int flags = O_WRONLY | O_CREAT | (clist->commands[i].append_mode ? O_APPEND : O_TRUNC);
-                int fd = open(clist->commands[i].output_file, flags, 0644);
-                if (fd == -1) {
-                    perror("Output redirection failed");
-                    exit(EXIT_FAILURE);
-                }
-                if (dup2(fd, STDOUT_FILENO) == -1) {
-                    perror("Output redirection failed");
-                    exit(EXIT_FAILURE);
-                }
-                close(fd);
-            } else if (i < clist->num - 1) {
-                if (dup2(pipes[i][1], STDOUT_FILENO) == -1) {
-                    perror("dup2");
-                    exit(EXIT_FAILURE);
-                }
-            }
-
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
+    int first_in = STDIN_FILENO;
+    int last_out = STDOUT_FILENO;
+    bool in_ok = open_redirects(&clist->commands[0], true, false, &first_in, &last_out) == OK;
+    bool out_ok = open_redirects(&clist->commands[clist->num - 1], false, true, &first_in, &last_out) == OK;
+    if (first_in > STDIN_FILENO) {
+        fds[nfds++] = first_in;
+    }
+    if (last_out > STDOUT_FILENO) {
+        fds[nfds++] = last_out;
+    }
 
-            if (execvp(clist->commands[i].argv[0], clist->commands[i].argv) == -1) {
-                perror("Command execution failed");
-                exit(EXIT_FAILURE);
-            }
+    for (int i = 0; i < clist->num; i++) {
+        bool first = i == 0;
+        bool last = i == clist->num - 1;
+        int in_fd = first ? first_in : pipes[i - 1][0];
+        int out_fd = last ? last_out : pipes[i][1];
+
+        // a stage whose redirection file could not be opened is not run
+        pids[i] = -1;
+        if ((!first || in_ok) && (!last || out_ok)) {
+            pids[i] = start_cmd(&clist->commands[i], in_fd, out_fd, fds, nfds);
         }
     }
 
-    for (int i = 0; i < clist->num - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
     }
 
     for (int i = 0; i < clist->num; i++) {
         int status;
-        if (waitpid(pids[i], &status, 0) == -1) {
+        if (pids[i] > 0 && waitpid(pids[i], &status, 0) == -1) {
             perror("waitpid");
             return -1;
         }
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "../dshlib.h"
+
+/*
+ *  parsebench - command line parse throughput of dsh
+ *
+ *  Parses each line of a small corpus over and over, once with the lexer
+ *  behind build_cmd_list() and once with the parser it replaced: split the
+ *  line on '|' with strtok_r(), trim each segment, copy it, then tokenize
+ *  the copy a byte at a time.  The old parser is kept here, with its fixed
+ *  CMD_MAX commands of CMD_ARGV_MAX arguments, parsing into a scratch
+ *  buffer as it did into the arena.
+ *
+ *  Both start from a fresh copy of the line, since strtok_r() writes into
+ *  it.  Each measurement is warmup untimed runs, then reps timed runs of
+ *  calls parses each, alternating between the parsers.  ns/line is the
+ *  median over the reps, MB/s is line bytes over it.
+ */
+
+#define BENCH_DEF_CALLS     100000
+#define BENCH_DEF_WARMUP    1
+#define BENCH_DEF_REPS      7
+#define BENCH_MAX_REPS      101
+#define BENCH_LINE_MAX      4096
+
+static const char *corpus[] = {
+    "ls -la",
+    "echo \"hello, world\" | tr a-z A-Z | rev",
+    "cat access.log | grep \"GET /index.html\" | cut -d \" \" -f 1 | sort | uniq -c | sort -rn | head",
+    "gcc -Wall -O2 -g -o dsh dsh_cli.c dshlib.c",
+    "find /usr/share/doc -name README | xargs grep -l license | wc -l",
+};
+#define NCORPUS ((int)(sizeof(corpus) / sizeof(corpus[0])))
+
+static const char *methods[] = { "strtok", "lexer" };
+#define NMETHODS ((int)(sizeof(methods) / sizeof(methods[0])))
+
+typedef struct strtok_cmd{
+    int     argc;
+    char   *argv[CMD_ARGV_MAX];
+    char   *_cmd_buffer;
+} strtok_cmd_t;
+
+typedef struct strtok_list{
+    int             num;
+    strtok_cmd_t    commands[CMD_MAX];
+} strtok_list_t;
+
+typedef struct bench_args{
+    int     calls;
+    int     warmup;
+    int     reps;
+    char   *line;       //measured instead of the corpus if set
+} bench_args_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ *  strtok_parse_cmd
+ *
+ *  The old parse_cmd_line(): tokens are terminated in place in cmd_line.
+ *
+ *  returns:  OK, or the same errors as the lexer
+ */
+static int strtok_parse_cmd(char *cmd_line, strtok_cmd_t *cb)
+{
+    char *p = cmd_line;
+
+    cb->argc = 0;
+    while (*p && isspace((unsigned char)*p))
+        p++;
+
+    while (*p) {
+        if (isspace((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+
+        char *start;
+        if (*p == '"') {
+            start = ++p;
+            while (*p && *p != '"')
+                p++;
+            if (*p != '"')
+                return ERR_CMD_ARGS_BAD;
+            *p++ = '\0';
+        } else {
+            start = p;
+            while (*p && !isspace((unsigned char)*p))
+                p++;
+            if (*p)
+                *p++ = '\0';
+        }
+        if (cb->argc >= CMD_ARGV_MAX - 1)
+            return ERR_CMD_OR_ARGS_TOO_BIG;
+        cb->argv[cb->argc++] = start;
+    }
+
+    if (cb->argc == 0)
+        return WARN_NO_CMDS;
+    cb->argv[cb->argc] = NULL;
+    return OK;
+}
+
+/*
+ *  strtok_split
+ *
+ *  The old split_into_cmds(), with scratch standing in for the arena.
+ *
+ *  returns:  OK, or the same errors as the lexer
+ */
+static int strtok_split(char *cmd_line, strtok_list_t *clist, char *scratch)
+{
+    char *saveptr = NULL;
+    char *segment = strtok_r(cmd_line, PIPE_STRING, &saveptr);
+
+    clist->num = 0;
+    while (segment) {
+        while (*segment && isspace((unsigned char)*segment))
+            segment++;
+        size_t len = strlen(segment);
+        while (len > 0 && isspace((unsigned char)segment[len - 1]))
+            len--;
+
+        if (len > 0) {
+            if (clist->num >= CMD_MAX)
+                return ERR_TOO_MANY_COMMANDS;
+            strtok_cmd_t *cb = &clist->commands[clist->num];
+            char *tokens = scratch;
+
+            memcpy(tokens, segment, len);
+            tokens[len] = '\0';
+            cb->_cmd_buffer = tokens + len + 1;
+            memcpy(cb->_cmd_buffer, segment, len);
+            cb->_cmd_buffer[len] = '\0';
+            scratch += 2 * (len + 1);
+
+            int rc = strtok_parse_cmd(tokens, cb);
+            if (rc != OK)
+                return rc;
+            clist->num++;
+        }
+        segment = strtok_r(NULL, PIPE_STRING, &saveptr);
+    }
+    return clist->num ? OK : WARN_NO_CMDS;
+}
+
+static int parse_with(int method, const char *line, size_t len, char *work,
+                      char *scratch, strtok_list_t *old, command_list_t *clist)
+{
+    memcpy(work, line, len + 1);
+    if (method == 0)
+        return strtok_split(work, old, scratch);
+    return build_cmd_list(work, clist);
+}
+
+/*
+ *  same_parse
+ *
+ *  Whether both parsers split line into the same commands and arguments.
+ */
+static int same_parse(const char *line, char *work, char *scratch)
+{
+    strtok_list_t a;
+    command_list_t b;
+    size_t len = strlen(line);
+    int same;
+
+    init_cmd_list(&b);
+    same = parse_with(0, line, len, work, scratch, &a, NULL) == OK &&
+           parse_with(1, line, len, work + BENCH_LINE_MAX, scratch, NULL, &b) == OK &&
+           a.num == b.num;
+    for (int c = 0; same && c < a.num; c++) {
+        same = a.commands[c].argc == b.commands[c].argc;
+        for (int i = 0; same && i < a.commands[c].argc; i++)
+            same = strcmp(a.commands[c].argv[i], b.commands[c].argv[i]) == 0;
+    }
+    close_cmd_list(&b);
+    return same;
+}
+
+/*
+ *  measure
+ *
+ *  Median ns per parse of line with every method.  The timed runs of the
+ *  methods take turns, so a slow patch of the machine is shared between
+ *  them instead of landing on one.
+ *
+ *  returns:  0 on success, -1 if the line did not parse
+ */
+static int measure(const char *line, bench_args_t *args, char *work,
+                   char *scratch, strtok_list_t *old, command_list_t *clist,
+                   double ns_per_line[NMETHODS])
+{
+    double ns[NMETHODS][BENCH_MAX_REPS];
+    size_t len = strlen(line);
+
+    for (int m = 0; m < NMETHODS; m++)
+        for (int w = 0; w < args->warmup; w++)
+            for (int i = 0; i < args->calls; i++)
+                if (parse_with(m, line, len, work, scratch, old, clist) != OK)
+                    return -1;
+
+    for (int r = 0; r < args->reps; r++) {
+        for (int m = 0; m < NMETHODS; m++) {
+            uint64_t t0 = now_ns();
+            for (int i = 0; i < args->calls; i++)
+                if (parse_with(m, line, len, work, scratch, old, clist) != OK)
+                    return -1;
+            uint64_t t1 = now_ns();
+
+            ns[m][r] = (double)(t1 - t0) / args->calls;
+        }
+    }
+
+    for (int m = 0; m < NMETHODS; m++) {
+        qsort(ns[m], args->reps, sizeof(double), cmp_double);
+        ns_per_line[m] = ns[m][args->reps / 2];
+    }
+    return 0;
+}
+
+static void bench_usage(const char *progname)
+{
+    printf("Usage: %s [-n CALLS] [-w WARMUP] [-r REPS] [-l LINE]\n", progname);
+    printf("  -n CALLS    parses per timed run (default %d)\n", BENCH_DEF_CALLS);
+    printf("  -w WARMUP   untimed runs before measuring (default %d)\n", BENCH_DEF_WARMUP);
+    printf("  -r REPS     timed runs, the median is reported (default %d)\n", BENCH_DEF_REPS);
+    printf("  -l LINE     command line to parse instead of the built in ones\n");
+    exit(1);
+}
+
+static void parse_args(int argc, char *argv[], bench_args_t *args)
+{
+    int opt;
+
+    memset(args, 0, sizeof(*args));
+    args->calls = BENCH_DEF_CALLS;
+    args->warmup = BENCH_DEF_WARMUP;
+    args->reps = BENCH_DEF_REPS;
+
+    while ((opt = getopt(argc, argv, "n:w:r:l:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                args->calls = atoi(optarg);
+                if (args->calls < 1)
+                    bench_usage(argv[0]);
+                break;
+            case 'w':
+                args->warmup = atoi(optarg);
+                if (args->warmup < 0)
+                    bench_usage(argv[0]);
+                break;
+            case 'r':
+                args->reps = atoi(optarg);
+                if (args->reps < 1 || args->reps > BENCH_MAX_REPS)
+                    bench_usage(argv[0]);
+                break;
+            case 'l':
+                args->line = optarg;
+                if (strlen(args->line) >= BENCH_LINE_MAX)
+                    bench_usage(argv[0]);
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bench_args_t args;
+    command_list_t clist;
+    static strtok_list_t old;
+    static char work[2 * BENCH_LINE_MAX];
+    static char scratch[4 * BENCH_LINE_MAX];
+    const char **lines = corpus;
+    int nlines = NCORPUS;
+
+    parse_args(argc, argv, &args);
+    if (args.line) {
+        lines = (const char **)&args.line;
+        nlines = 1;
+    }
+    init_cmd_list(&clist);
+
+    printf("%d parses per rep, %d reps, median reported\n", args.calls, args.reps);
+    for (int l = 0; l < nlines; l++) {
+        printf("%4d  %s\n", l, lines[l]);
+        if (!same_parse(lines[l], work, scratch))
+            printf("      (the parsers do not agree on this line)\n");
+    }
+    printf("\n%4s %6s %-7s %10s %8s %8s\n", "LINE", "BYTES", "METHOD", "NS/LINE", "MB/S", "SPEEDUP");
+
+    int rc = 0;
+    for (int l = 0; l < nlines; l++) {
+        size_t len = strlen(lines[l]);
+        double ns[NMETHODS];
+
+        if (measure(lines[l], &args, work, scratch, &old, &clist, ns) != 0) {
+            fprintf(stderr, "parsebench: \"%s\" does not parse\n", lines[l]);
+            rc = 1;
+            break;
+        }
+        for (int m = 0; m < NMETHODS; m++)
+            printf("%4d %6zu %-7s %10.1f %8.1f %7.2fx\n",
+                   l, len, methods[m], ns[m], len * 1000.0 / ns[m], ns[0] / ns[m]);
+        fflush(stdout);
+    }
+
+    close_cmd_list(&clist);
+    return rc;
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "../dshlib.h"
+
+/*
+ *  spawnbench - command start latency of dsh against the shell's size
+ *
+ *  Runs a one command pipeline through execute_pipeline() over and over,
+ *  once with DSH_SPAWN=fork and once with posix_spawn, after growing the
+ *  process by each RSS size.  The memory is written so it is resident and
+ *  has page table entries, which is what fork() has to copy.
+ *
+ *  Each measurement is warmup untimed runs, then reps timed runs of calls
+ *  commands each.  us/cmd is the median over the reps, RSS is what
+ *  /proc/self/statm reports while measuring.
+ */
+
+#define BENCH_DEF_RSS       "0,64,256,1024"     //MB
+#define BENCH_DEF_CMD       "/bin/true"
+#define BENCH_DEF_CALLS     200
+#define BENCH_DEF_WARMUP    1
+#define BENCH_DEF_REPS      7
+#define BENCH_MAX_LIST      16
+#define BENCH_MAX_REPS      101
+
+typedef struct bench_args{
+    long    rss_mb[BENCH_MAX_LIST];
+    int     nrss;
+    int     calls;
+    int     warmup;
+    int     reps;
+    char   *cmd;
+} bench_args_t;
+
+static const char *methods[] = { "fork", "spawn" };
+#define NMETHODS ((int)(sizeof(methods) / sizeof(methods[0])))
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static long rss_mb(void)
+{
+    long size = 0;
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &size, &pages) != 2)
+            pages = 0;
+        fclose(f);
+    }
+    return pages * sysconf(_SC_PAGESIZE) >> 20;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ *  measure
+ *
+ *  Median us per execute_pipeline() call of clist, with DSH_SPAWN set to
+ *  method.
+ *
+ *  returns:  0 on success, -1 if a command failed
+ */
+static int measure(command_list_t *clist, const char *method, bench_args_t *args,
+                   double *us_per_cmd)
+{
+    double us[BENCH_MAX_REPS];
+
+    setenv("DSH_SPAWN", method, 1);
+    for (int w = 0; w < args->warmup; w++)
+        for (int i = 0; i < args->calls; i++)
+            if (execute_pipeline(clist) != OK)
+                return -1;
+
+    for (int r = 0; r < args->reps; r++) {
+        uint64_t t0 = now_ns();
+        for (int i = 0; i < args->calls; i++)
+            if (execute_pipeline(clist) != OK)
+                return -1;
+        uint64_t t1 = now_ns();
+
+        us[r] = (double)(t1 - t0) / args->calls / 1000.0;
+    }
+
+    qsort(us, args->reps, sizeof(double), cmp_double);
+    *us_per_cmd = us[args->reps / 2];
+    return 0;
+}
+
+static void bench_usage(const char *progname)
+{
+    printf("Usage: %s [-m RSS] [-n CALLS] [-w WARMUP] [-r REPS] [-c CMD]\n", progname);
+    printf("  -m RSS      comma separated extra resident MB (default %s)\n", BENCH_DEF_RSS);
+    printf("  -n CALLS    commands per timed run (default %d)\n", BENCH_DEF_CALLS);
+    printf("  -w WARMUP   untimed runs before measuring (default %d)\n", BENCH_DEF_WARMUP);
+    printf("  -r REPS     timed runs, the median is reported (default %d)\n", BENCH_DEF_REPS);
+    printf("  -c CMD      command line to run, no pipes (default %s)\n", BENCH_DEF_CMD);
+    exit(1);
+}
+
+static int parse_list(const char *str, long *out, int max)
+{
+    char *copy = strdup(str);
+    int n = 0;
+
+    for (char *tok = strtok(copy, ","); tok != NULL && n < max; tok = strtok(NULL, ","))
+        out[n++] = atol(tok);
+    free(copy);
+    return n;
+}
+
+static void parse_args(int argc, char *argv[], bench_args_t *args)
+{
+    int opt;
+
+    memset(args, 0, sizeof(*args));
+    args->calls = BENCH_DEF_CALLS;
+    args->warmup = BENCH_DEF_WARMUP;
+    args->reps = BENCH_DEF_REPS;
+    args->cmd = BENCH_DEF_CMD;
+    args->nrss = parse_list(BENCH_DEF_RSS, args->rss_mb, BENCH_MAX_LIST);
+
+    while ((opt = getopt(argc, argv, "m:n:w:r:c:h")) != -1) {
+        switch (opt) {
+            case 'm':
+                args->nrss = parse_list(optarg, args->rss_mb, BENCH_MAX_LIST);
+                for (int i = 0; i < args->nrss; i++)
+                    if (args->rss_mb[i] < 0)
+                        bench_usage(argv[0]);
+                break;
+            case 'n':
+                args->calls = atoi(optarg);
+                if (args->calls < 1)
+                    bench_usage(argv[0]);
+                break;
+            case 'w':
+                args->warmup = atoi(optarg);
+                if (args->warmup < 0)
+                    bench_usage(argv[0]);
+                break;
+            case 'r':
+                args->reps = atoi(optarg);
+                if (args->reps < 1 || args->reps > BENCH_MAX_REPS)
+                    bench_usage(argv[0]);
+                break;
+            case 'c':
+                args->cmd = optarg;
+                break;
+            default:
+                bench_usage(argv[0]);
+        }
+    }
+    if (args->nrss == 0)
+        bench_usage(argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_args_t args;
+    command_list_t clist;
+
+    parse_args(argc, argv, &args);
+    init_cmd_list(&clist);
+
+    char *line = strdup(args.cmd);
+    if (line == NULL || build_cmd_list(line, &clist) != OK || clist.num != 1) {
+        fprintf(stderr, "spawnbench: bad command \"%s\"\n", args.cmd);
+        return 1;
+    }
+
+    printf("%s, %d commands per rep, %d reps, median reported\n",
+           args.cmd, args.calls, args.reps);
+    printf("%8s %8s %-7s %10s %8s\n", "EXTRA_MB", "RSS_MB", "METHOD", "US/CMD", "SPEEDUP");
+
+    int rc = 0;
+    for (int s = 0; s < args.nrss && rc == 0; s++) {
+        size_t bytes = (size_t)args.rss_mb[s] << 20;
+        char *ballast = bytes ? malloc(bytes) : NULL;
+
+        if (bytes && ballast == NULL) {
+            fprintf(stderr, "spawnbench: can not allocate %ld MB\n", args.rss_mb[s]);
+            rc = 1;
+            break;
+        }
+        if (bytes)
+            memset(ballast, 1, bytes);
+
+        double base = 0;
+        for (int m = 0; m < NMETHODS; m++) {
+            double us;
+
+            if (measure(&clist, methods[m], &args, &us) != 0) {
+                fprintf(stderr, "spawnbench: \"%s\" failed\n", args.cmd);
+                rc = 1;
+                break;
+            }
+            if (m == 0)
+                base = us;
+            printf("%8ld %8ld %-7s %10.1f %7.2fx\n",
+                   args.rss_mb[s], rss_mb(), methods[m], us, base / us);
+            fflush(stdout);
+        }
+        free(ballast);
+    }
+
+    close_cmd_list(&clist);
+    free(line);
+    return rc;
+}
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "dshlib.h"
+
+/*
+ * Command hash
+ *
+ * execvp() finds a program by trying execve() in every PATH directory in
+ * turn, so each command pays for a failed exec in every directory before
+ * the one it lives in.  The hash remembers where each command was found
+ * and the shell runs that path directly.
+ *
+ * A cached path is only as good as the directories that were searched to
+ * find it: a program added to an earlier directory would now win, and one
+ * removed from its own directory is gone.  Both change the mtime of that
+ * directory, so a lookup stats the directories up to and including the
+ * one the command was found in, and any change drops every entry that
+ * depended on it.  A new PATH drops everything.
+ */
+
+typedef struct hash_entry {
+    char              *name;
+    char              *path;
+    int                dir;     //index in PATH of the directory it is in
+    unsigned           hits;
+    struct hash_entry *next;
+} hash_entry_t;
+
+typedef struct hash_dir {
+    const char     *name;       //points into hash_path
+    size_t          len;
+    bool            seen;       //mtime is valid
+    struct timespec mtime;
+} hash_dir_t;
+
+static hash_entry_t *hash_table[HASH_BUCKETS];
+static char         *hash_path;     //copy of the PATH the table is for
+static hash_dir_t    hash_dirs[HASH_DIRS_MAX];
+static int           hash_ndirs;
+
+static unsigned hash_name(const char *name) {
+    unsigned h = 2166136261u;   //FNV-1a
+
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h % HASH_BUCKETS;
+}
+
+/*
+ * hash_drop_from - Forget every entry found in directory @dir or later.
+ */
+static void hash_drop_from(int dir) {
+    for (int b = 0; b < HASH_BUCKETS; b++) {
+        hash_entry_t **link = &hash_table[b];
+        while (*link) {
+            hash_entry_t *e = *link;
+            if (e->dir >= dir) {
+                *link = e->next;
+                free(e->name);
+                free(e->path);
+                free(e);
+            } else {
+                link = &e->next;
+            }
+        }
+    }
+}
+
+/*
+ * hash_clear - Empty the command hash, as `hash -r` does.
+ */
+void hash_clear(void) {
+    hash_drop_from(0);
+    for (int i = 0; i < hash_ndirs; i++) {
+        hash_dirs[i].seen = false;
+    }
+}
+
+/*
+ * hash_set_path - Make the table follow @path, dropping it if PATH changed.
+ *
+ * Returns: false if there is no PATH to search.
+ */
+static bool hash_set_path(const char *path) {
+    if (!path) {
+        return false;
+    }
+    if (hash_path && strcmp(hash_path, path) == 0) {
+        return true;
+    }
+
+    hash_drop_from(0);
+    free(hash_path);
+    hash_ndirs = 0;
+    hash_path = strdup(path);
+    if (!hash_path) {
+        return false;
+    }
+
+    // An empty entry means the current directory, as for execvp()
+    for (const char *p = hash_path; hash_ndirs < HASH_DIRS_MAX; p++) {
+        const char *end = strchr(p, ':');
+        if (!end) {
+            end = p + strlen(p);
+        }
+        hash_dirs[hash_ndirs].name = end > p ? p : ".";
+        hash_dirs[hash_ndirs].len = end > p ? (size_t)(end - p) : 1;
+        hash_dirs[hash_ndirs].seen = false;
+        hash_ndirs++;
+        if (*end == '\0') {
+            break;
+        }
+        p = end;
+    }
+    return true;
+}
+
+/*
+ * hash_dir_changed - Check directory @i against the mtime last seen.
+ *
+ * A change drops the entries that depended on it.
+ *
+ * Returns: true if it changed, or was never seen before.
+ */
+static bool hash_dir_changed(int i) {
+    hash_dir_t *d = &hash_dirs[i];
+    char dir[PATH_MAX];
+    struct stat st;
+
+    snprintf(dir, sizeof(dir), "%.*s", (int)d->len, d->name);
+    if (stat(dir, &st) != 0) {
+        st.st_mtim.tv_sec = -1;
+        st.st_mtim.tv_nsec = 0;
+    }
+    if (d->seen && d->mtime.tv_sec == st.st_mtim.tv_sec &&
+        d->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        return false;
+    }
+    hash_drop_from(i);
+    d->seen = true;
+    d->mtime = st.st_mtim;
+    return true;
+}
+
+static hash_entry_t *hash_find(const char *name) {
+    for (hash_entry_t *e = hash_table[hash_name(name)]; e; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * hash_search - Walk PATH for @name like execvp() would and remember it.
+ */
+static hash_entry_t *hash_search(const char *name) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    for (int i = 0; i < hash_ndirs; i++) {
+        hash_dir_changed(i);
+        int n = snprintf(path, sizeof(path), "%.*s/%s",
+                         (int)hash_dirs[i].len, hash_dirs[i].name, name);
+        if (n < 0 || n >= (int)sizeof(path)) {
+            continue;
+        }
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || access(path, X_OK) != 0) {
+            continue;
+        }
+        // what a relative directory holds changes with every cd
+        if (hash_dirs[i].name[0] != '/') {
+            return NULL;
+        }
+
+        hash_entry_t *e = calloc(1, sizeof(hash_entry_t));
+        if (!e || !(e->name = strdup(name)) || !(e->path = strdup(path))) {
+            if (e) {
+                free(e->name);
+            }
+            free(e);
+            return NULL;
+        }
+        e->dir = i;
+        unsigned b = hash_name(name);
+        e->next = hash_table[b];
+        hash_table[b] = e;
+        return e;
+    }
+    return NULL;
+}
+
+/*
+ * hash_lookup - Resolve a command name to the program execvp() would run.
+ * @name: argv[0] of the command.
+ *
+ * Names with a '/' are not looked up, and neither is anything when PATH
+ * is not set.
+ *
+ * Returns: the absolute path, valid until the next hash call, or NULL to
+ * leave the search to execvp() / posix_spawnp().
+ */
+const char *hash_lookup(const char *name) {
+    if (!name || !*name || strchr(name, '/') || !hash_set_path(getenv("PATH"))) {
+        return NULL;
+    }
+
+    hash_entry_t *e = hash_find(name);
+    if (e) {
+        // anything up to its own directory may have changed since
+        int dir = e->dir;
+        for (int i = 0; i <= dir; i++) {
+            if (hash_dir_changed(i)) {
+                e = NULL;
+                break;
+            }
+        }
+    }
+    if (!e) {
+        e = hash_search(name);
+    }
+    if (!e) {
+        return NULL;
+    }
+    e->hits++;
+    return e->path;
+}
+
+/*
+ * hash_forget - Drop @name, when running its cached path failed.
+ */
+void hash_forget(const char *name) {
+    hash_entry_t **link = &hash_table[hash_name(name)];
+
+    while (*link) {
+        hash_entry_t *e = *link;
+        if (strcmp(e->name, name) == 0) {
+            *link = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            return;
+        }
+        link = &e->next;
+    }
+}
+
+/*
+ * hash_print - List the command hash in the format of bash's `hash`.
+ */
+void hash_print(void) {
+    bool empty = true;
+
+    for (int b = 0; b < HASH_BUCKETS; b++) {
+        for (hash_entry_t *e = hash_table[b]; e; e = e->next) {
+            if (empty) {
+                printf("hits\tcommand\n");
+                empty = false;
+            }
+            printf("%4u\t%s\n", e->hits, e->path);
+        }
+    }
+    if (empty) {
+        printf("hash: hash table empty\n");
+    }
+}
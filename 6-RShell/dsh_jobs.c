@@ -0,0 +1,478 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include "dshlib.h"
+
+/*
+ * Background jobs
+ *
+ * A pipeline ending in '&' is started like any other, but the shell does
+ * not wait for it; it goes in the job table and the prompt comes back.
+ *
+ * SIGCHLD is blocked in the shell and read from a signalfd instead of a
+ * handler, so a child exiting never interrupts the shell in the middle of
+ * something.  While the prompt waits for input it polls the signalfd
+ * along with stdin and reaps the jobs whose children exited, so a job is
+ * never left a zombie until the next command.  Like sh, the shell says
+ * which jobs are done just before the next prompt.
+ *
+ * Only the pids of jobs are ever waited for here, never any child, so a
+ * foreground pipeline is still waited for by execute_pipeline() alone.
+ * There is no terminal job control: fg waits for the job, but it stays in
+ * the shell's process group and reads nothing from the terminal.
+ */
+
+typedef struct job {
+    int          id;
+    pid_t       *pids;      //0 once reaped
+    int          npids;
+    int          left;      //children not reaped yet
+    int          status;    //of the last stage, once it is reaped
+    char        *cmd;
+    struct job  *next;
+} job_t;
+
+static job_t   *job_list;           //by id
+static int      job_sigfd = -1;
+static sigset_t job_child_mask;     //what the shell had, for its children
+static bool     job_ready;
+
+/*
+ * The input line reader.  It keeps what read() returned past the end of
+ * a line for the next one, so the prompt knows when it has to wait.
+ */
+static struct {
+    char   *buf;
+    size_t  start;      //of the next line
+    size_t  len;
+    size_t  cap;
+    bool    eof;
+} input;
+
+/*
+ * jobs_init - Block SIGCHLD and open the signalfd it is read from.
+ *
+ * Without it jobs still run, but are only reaped by jobs, wait and fg.
+ *
+ * Returns: OK, or ERR_EXEC_CMD if the signalfd could not be made.
+ */
+int jobs_init(void) {
+    sigset_t chld;
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &chld, &job_child_mask) < 0) {
+        perror("sigprocmask");
+        return ERR_EXEC_CMD;
+    }
+    job_ready = true;
+    job_sigfd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (job_sigfd < 0) {
+        perror("signalfd");
+        return ERR_EXEC_CMD;
+    }
+    return OK;
+}
+
+/*
+ * jobs_child_sigmask - The signal mask a child of the shell starts with,
+ * which is the one the shell had before jobs_init() blocked SIGCHLD.
+ */
+void jobs_child_sigmask(sigset_t *mask) {
+    if (job_ready) {
+        *mask = job_child_mask;
+    } else {
+        sigprocmask(SIG_BLOCK, NULL, mask);
+    }
+}
+
+static void job_free(job_t *job) {
+    free(job->pids);
+    free(job->cmd);
+    free(job);
+}
+
+/*
+ * jobs_close - Forget every job, leaving them running, and undo
+ * jobs_init().
+ */
+void jobs_close(void) {
+    while (job_list) {
+        job_t *next = job_list->next;
+        job_free(job_list);
+        job_list = next;
+    }
+    if (job_sigfd >= 0) {
+        close(job_sigfd);
+        job_sigfd = -1;
+    }
+    if (job_ready) {
+        sigprocmask(SIG_SETMASK, &job_child_mask, NULL);
+        job_ready = false;
+    }
+    free(input.buf);
+    memset(&input, 0, sizeof(input));
+}
+
+/*
+ * job_cmd - Put the commands of @clist back together as a line.
+ *
+ * Returns: the line, to be freed, or NULL if malloc failed.
+ */
+static char *job_cmd(const command_list_t *clist) {
+    size_t len = 1;
+
+    for (int i = 0; i < clist->num; i++) {
+        len += strlen(clist->commands[i]._cmd_buffer) + 3;
+    }
+    char *cmd = malloc(len);
+    if (!cmd) {
+        return NULL;
+    }
+    cmd[0] = '\0';
+    for (int i = 0; i < clist->num; i++) {
+        if (i > 0) {
+            strcat(cmd, " | ");
+        }
+        strcat(cmd, clist->commands[i]._cmd_buffer);
+    }
+    return cmd;
+}
+
+/*
+ * job_add - Put a pipeline started in the background in the job table.
+ * @clist: The pipeline.
+ * @pids: Its children, -1 for a stage that did not start.
+ *
+ * Prints the job number and the pid of its last stage, as sh does.
+ *
+ * Returns: the job number, or -1 if no stage started or malloc failed.
+ * The children are then waited for right away.
+ */
+int job_add(const command_list_t *clist, const pid_t *pids) {
+    pid_t last = 0;
+
+    for (int i = 0; i < clist->num; i++) {
+        if (pids[i] > 0) {
+            last = pids[i];
+        }
+    }
+    if (last == 0) {
+        return -1;      //nothing to wait for
+    }
+
+    job_t *job = calloc(1, sizeof(job_t));
+    if (job) {
+        job->pids = malloc(clist->num * sizeof(pid_t));
+        job->cmd = job_cmd(clist);
+    }
+    if (!job || !job->pids || !job->cmd) {
+        perror("malloc");
+        for (int i = 0; i < clist->num; i++) {
+            if (pids[i] > 0) {
+                waitpid(pids[i], NULL, 0);
+            }
+        }
+        if (job) {
+            job_free(job);
+        }
+        return -1;
+    }
+
+    job->npids = clist->num;
+    for (int i = 0; i < clist->num; i++) {
+        job->pids[i] = pids[i] > 0 ? pids[i] : 0;
+        job->left += pids[i] > 0;
+    }
+    if (pids[clist->num - 1] <= 0) {
+        job->status = 127 << 8;     //as if it exited like a missing command
+    }
+
+    // After the highest job number in use, like sh
+    job_t **link = &job_list;
+    job->id = 1;
+    while (*link) {
+        job->id = (*link)->id + 1;
+        link = &(*link)->next;
+    }
+    *link = job;
+
+    printf("[%d] %d\n", job->id, last);
+    return job->id;
+}
+
+/*
+ * job_reap - Collect whichever children of @job have exited.
+ * @block: Wait for all of them instead.
+ */
+static void job_reap(job_t *job, bool block) {
+    for (int i = 0; i < job->npids; i++) {
+        int status;
+
+        if (job->pids[i] == 0) {
+            continue;
+        }
+        pid_t rc = waitpid(job->pids[i], &status, block ? 0 : WNOHANG);
+        if (rc == 0 || (rc < 0 && errno == EINTR)) {
+            continue;
+        }
+        // a child that can not be waited for is as good as reaped
+        if (rc > 0 && i == job->npids - 1) {
+            job->status = status;
+        }
+        job->pids[i] = 0;
+        job->left--;
+    }
+}
+
+/*
+ * jobs_reap - Reap every job child that exited, if SIGCHLD said one did.
+ */
+static void jobs_reap(void) {
+    struct signalfd_siginfo si;
+    bool chld = job_sigfd < 0;
+
+    while (job_sigfd >= 0 && read(job_sigfd, &si, sizeof(si)) == sizeof(si)) {
+        chld = true;
+    }
+    if (!chld) {
+        return;
+    }
+    for (job_t *job = job_list; job; job = job->next) {
+        job_reap(job, false);
+    }
+}
+
+static void job_print(const job_t *job) {
+    char state[32];
+
+    if (job->left > 0) {
+        snprintf(state, sizeof(state), "Running");
+    } else if (WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0) {
+        snprintf(state, sizeof(state), "Done");
+    } else if (WIFEXITED(job->status)) {
+        snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(job->status));
+    } else {
+        snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(job->status)));
+    }
+    printf("[%d]%c  %-24s%s%s\n", job->id, job->next ? ' ' : '+', state, job->cmd,
+           job->left > 0 ? " &" : "");
+}
+
+/*
+ * jobs_forget - Forget the jobs that are done, after reporting them if
+ * @report is set.
+ */
+static void jobs_forget(bool report) {
+    job_t **link = &job_list;
+
+    while (*link) {
+        job_t *job = *link;
+        if (job->left == 0) {
+            if (report) {
+                job_print(job);
+            }
+            *link = job->next;
+            job_free(job);
+        } else {
+            link = &job->next;
+        }
+    }
+}
+
+/*
+ * jobs_notify - Report the jobs that are done and forget them.
+ *
+ * Called before each prompt.
+ */
+void jobs_notify(void) {
+    jobs_reap();
+    jobs_forget(true);
+}
+
+/*
+ * jobs_print - The jobs builtin: list every job.  Those that are done are
+ * then forgotten.
+ */
+void jobs_print(void) {
+    jobs_reap();
+    for (job_t *job = job_list; job; job = job->next) {
+        job_print(job);
+    }
+    jobs_forget(false);
+}
+
+/*
+ * job_find - Look up a job by @spec, "%N" for job N or the pid of one of
+ * its children.  NULL means the current job, the most recent one.
+ *
+ * Returns: the job, or NULL after saying why.
+ */
+static job_t *job_find(const char *builtin, const char *spec) {
+    job_t *found = NULL;
+
+    for (job_t *job = job_list; job; job = job->next) {
+        if (!spec) {
+            found = job;
+        } else if (spec[0] == '%' && atoi(spec + 1) == job->id) {
+            return job;
+        } else if (spec[0] != '%') {
+            for (int i = 0; i < job->npids; i++) {
+                if (job->pids[i] != 0 && job->pids[i] == atoi(spec)) {
+                    return job;
+                }
+            }
+        }
+    }
+    if (!found) {
+        fprintf(stderr, "%s: %s: no such job\n", builtin, spec ? spec : "current");
+    }
+    return found;
+}
+
+static void job_remove(job_t *job) {
+    for (job_t **link = &job_list; *link; link = &(*link)->next) {
+        if (*link == job) {
+            *link = job->next;
+            job_free(job);
+            return;
+        }
+    }
+}
+
+/*
+ * jobs_wait - The wait builtin: wait for the job @spec, or for all of them
+ * if it is NULL.  They are reported as done before the next prompt.
+ *
+ * Returns: the exit status of the job, or of the last one waited for.
+ */
+int jobs_wait(const char *spec) {
+    job_t *job = spec ? job_find("wait", spec) : job_list;
+    int status = 0;
+
+    if (spec && !job) {
+        return 127;
+    }
+    for (; job; job = spec ? NULL : job->next) {
+        job_reap(job, true);
+        status = job->status;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/*
+ * jobs_fg - The fg builtin: wait for the job @spec, or the current one,
+ * as if it had been run in the foreground.
+ *
+ * Returns: the exit status of the job, or 1 if there is no such job.
+ */
+int jobs_fg(const char *spec) {
+    job_t *job = job_find("fg", spec);
+
+    if (!job) {
+        return 1;
+    }
+    printf("%s\n", job->cmd);
+    fflush(stdout);
+    job_reap(job, true);
+
+    int status = job->status;
+    job_remove(job);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/*
+ * read_cmd_line - Read the next line of input, reaping jobs while it
+ * waits for one.
+ *
+ * Lines have no length limit.  The last one does not need a newline.
+ *
+ * Returns: the line without its newline, valid until the next call, or
+ * NULL at the end of input.
+ */
+char *read_cmd_line(void) {
+    static int flush = -1;
+
+    if (flush < 0) {
+        // stdio would flush the prompt to a terminal before reading
+        flush = isatty(STDOUT_FILENO);
+    }
+
+    if (!input.buf) {
+        input.buf = malloc(SH_CMD_MAX);
+        if (!input.buf) {
+            perror("malloc");
+            return NULL;
+        }
+        input.cap = SH_CMD_MAX;
+    }
+
+    while (true) {
+        char *line = input.buf + input.start;
+        char *nl = memchr(line, '\n', input.len - input.start);
+        if (nl) {
+            *nl = '\0';
+            input.start = nl + 1 - input.buf;
+            return line;
+        }
+        if (input.eof) {
+            if (input.start == input.len) {
+                return NULL;
+            }
+            input.buf[input.len] = '\0';    //there is always room, see below
+            input.start = input.len;
+            return line;
+        }
+
+        // Keep the start of the line and make room for the rest
+        memmove(input.buf, line, input.len - input.start);
+        input.len -= input.start;
+        input.start = 0;
+        if (input.cap - input.len < 2) {
+            size_t cap = input.cap * 2;
+            char *buf = realloc(input.buf, cap);
+            if (!buf) {
+                perror("realloc");
+                return NULL;
+            }
+            input.buf = buf;
+            input.cap = cap;
+        }
+
+        if (flush) {
+            fflush(stdout);
+        }
+        struct pollfd fds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = job_sigfd, .events = POLLIN },
+        };
+        if (poll(fds, job_sigfd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return NULL;
+        }
+        if (fds[1].revents & POLLIN) {
+            jobs_reap();
+        }
+        if (fds[0].revents) {
+            ssize_t n = read(STDIN_FILENO, input.buf + input.len, input.cap - input.len - 1);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                input.eof = true;
+            } else {
+                input.len += n;
+            }
+        }
+    }
+}
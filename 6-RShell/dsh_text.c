@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "dshlib.h"
+#include "libstringfun.h"
+
+/*
+ * Text builtins
+ *
+ * wc -w, rev and words are common last stages of a pipeline and are all
+ * things the stringfun kernels already do.  execute_pipeline() still
+ * forks a stage for them, so the pipes and the exit status work like for
+ * any other command, but the child runs them directly instead of paying
+ * for execvp() and the dynamic loader.  Any other form, like wc -l or
+ * wc with file names, is left to the real program.
+ *
+ * They read stdin and write stdout with read()/write() and their own
+ * buffer, never stdio, so nothing the shell had buffered is written twice.
+ */
+
+typedef struct text_out {
+    size_t len;
+    char   buf[TEXT_IO_SIZE];
+} text_out_t;
+
+/*
+ * text_flush - Write out everything buffered in @o.
+ *
+ * Returns: 0 on success, -1 if stdout failed.
+ */
+static int text_flush(text_out_t *o) {
+    size_t done = 0;
+
+    while (done < o->len) {
+        ssize_t n = write(STDOUT_FILENO, o->buf + done, o->len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    o->len = 0;
+    return 0;
+}
+
+static int text_put(text_out_t *o, const char *p, size_t n) {
+    while (n > 0) {
+        if (o->len == TEXT_IO_SIZE && text_flush(o) < 0) {
+            return -1;
+        }
+        size_t room = TEXT_IO_SIZE - o->len;
+        size_t take = n < room ? n : room;
+        memcpy(o->buf + o->len, p, take);
+        o->len += take;
+        p += take;
+        n -= take;
+    }
+    return 0;
+}
+
+static ssize_t text_read(char *buf, size_t len) {
+    ssize_t n;
+
+    do {
+        n = read(STDIN_FILENO, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+/*
+ * A word or line cut by the end of a read is kept here until the rest of
+ * it arrives.  It grows as needed, so neither has a length limit.
+ */
+typedef struct text_carry {
+    char  *buf;
+    size_t len;
+    size_t cap;
+} text_carry_t;
+
+static int carry_add(text_carry_t *c, const char *p, size_t n) {
+    if (c->len + n > c->cap) {
+        size_t cap = c->cap ? c->cap : TEXT_IO_SIZE;
+        while (cap < c->len + n) {
+            cap *= 2;
+        }
+        char *buf = realloc(c->buf, cap);
+        if (!buf) {
+            return -1;
+        }
+        c->buf = buf;
+        c->cap = cap;
+    }
+    memcpy(c->buf + c->len, p, n);
+    c->len += n;
+    return 0;
+}
+
+/*
+ * text_wc - wc -w: count the whitespace separated words on stdin.
+ */
+static int text_wc(char *chunk, text_out_t *o) {
+    size_t count = 0;
+    int in_word = 0;
+    ssize_t n;
+
+    while ((n = text_read(chunk, TEXT_IO_SIZE)) > 0) {
+        count += sf_count_words(chunk, n, SF_SEP_SHELL, &in_word);
+    }
+    if (n == 0) {
+        o->len = snprintf(o->buf, TEXT_IO_SIZE, "%zu\n", count);
+    }
+    if (n < 0 || text_flush(o) < 0) {
+        perror("wc");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * rev_line - Reverse one line, in characters if it is valid UTF-8 and in
+ * bytes otherwise, and write it out.
+ */
+static int rev_line(text_out_t *o, char *line, size_t n, int newline) {
+    if (sf_reverse_utf8(line, n) == SF_ERR_UTF8) {
+        sf_reverse(line, n);
+    }
+    if (text_put(o, line, n) < 0) {
+        return -1;
+    }
+    return newline ? text_put(o, "\n", 1) : 0;
+}
+
+/*
+ * text_rev - rev: reverse each line of stdin.
+ */
+static int text_rev(char *chunk, text_out_t *o) {
+    text_carry_t line = { 0 };
+    int rc = 0;
+    ssize_t n = 0;
+
+    while (rc == 0 && (n = text_read(chunk, TEXT_IO_SIZE)) > 0) {
+        char *p = chunk;
+        char *end = chunk + n;
+        char *nl;
+
+        while (rc == 0 && (nl = memchr(p, '\n', end - p)) != NULL) {
+            if (line.len == 0) {
+                rc = rev_line(o, p, nl - p, 1);
+            } else if ((rc = carry_add(&line, p, nl - p)) == 0) {
+                rc = rev_line(o, line.buf, line.len, 1);
+                line.len = 0;
+            }
+            p = nl + 1;
+        }
+        if (rc == 0) {
+            rc = carry_add(&line, p, end - p);
+        }
+    }
+    if (rc == 0 && n < 0) {
+        rc = -1;
+    }
+    if (rc == 0 && line.len > 0) {
+        rc = rev_line(o, line.buf, line.len, 0);
+    }
+    if (rc == 0) {
+        rc = text_flush(o);
+    }
+    free(line.buf);
+    if (rc != 0) {
+        perror("rev");
+        return 1;
+    }
+    return 0;
+}
+
+static int words_emit(text_out_t *o, size_t *count, const char *w, size_t n) {
+    char num[32];
+    int len = snprintf(num, sizeof(num), "%zu. ", ++*count);
+
+    if (text_put(o, num, len) < 0 || text_put(o, w, n) < 0) {
+        return -1;
+    }
+    len = snprintf(num, sizeof(num), "(%zu)\n", n);
+    return text_put(o, num, len);
+}
+
+/*
+ * text_words - words: list the words of stdin with their lengths, in the
+ * format of stringfun -W.
+ */
+static int text_words(char *chunk, text_out_t *o) {
+    text_carry_t word = { 0 };
+    size_t count = 0;
+    int rc = text_put(o, "Word Print\n----------\n", 22);
+    ssize_t n = 0;
+
+    while (rc == 0 && (n = text_read(chunk, TEXT_IO_SIZE)) > 0) {
+        size_t start = 0;
+        size_t len;
+
+        // finish the word the last read ended in
+        if (word.len > 0 && !sf_is_sep(chunk[0], SF_SEP_SHELL)) {
+            len = sf_next_word(chunk, n, SF_SEP_SHELL, &start);
+            rc = carry_add(&word, chunk, len);
+            start = len;
+            if (rc != 0 || len == (size_t)n) {
+                continue;
+            }
+        }
+        if (word.len > 0) {
+            rc = words_emit(o, &count, word.buf, word.len);
+            word.len = 0;
+        }
+
+        while (rc == 0 && (len = sf_next_word(chunk, n, SF_SEP_SHELL, &start)) > 0) {
+            if (start + len == (size_t)n) {
+                rc = carry_add(&word, chunk + start, len);
+                break;
+            }
+            rc = words_emit(o, &count, chunk + start, len);
+            start += len;
+        }
+    }
+    if (rc == 0 && n < 0) {
+        rc = -1;
+    }
+    if (rc == 0 && word.len > 0) {
+        rc = words_emit(o, &count, word.buf, word.len);
+    }
+    if (rc == 0) {
+        char tail[64];
+        int len = snprintf(tail, sizeof(tail), "\nNumber of words returned: %zu\n", count);
+        rc = text_put(o, tail, len);
+    }
+    if (rc == 0) {
+        rc = text_flush(o);
+    }
+    free(word.buf);
+    if (rc != 0) {
+        perror("words");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * match_text_builtin - Check whether @cmd is one of the text builtins.
+ *
+ * Returns the builtin, or TEXT_NOT_BI.
+ */
+Text_Built_In_Cmds match_text_builtin(const cmd_buff_t *cmd) {
+    if (cmd->argc == 2 && !strcmp(cmd->argv[0], "wc") && !strcmp(cmd->argv[1], "-w")) {
+        return TEXT_BI_WC;
+    }
+    if (cmd->argc == 1 && !strcmp(cmd->argv[0], "rev")) {
+        return TEXT_BI_REV;
+    }
+    if (cmd->argc == 1 && !strcmp(cmd->argv[0], "words")) {
+        return TEXT_BI_WORDS;
+    }
+    return TEXT_NOT_BI;
+}
+
+/*
+ * exec_text_builtin - Run a text builtin on stdin and stdout.
+ * @type: What match_text_builtin() returned, not TEXT_NOT_BI.
+ *
+ * Meant for a forked pipeline stage, which then exits with the status.
+ *
+ * Returns: the exit status, 0 on success and 1 on an I/O or memory error.
+ */
+int exec_text_builtin(Text_Built_In_Cmds type) {
+    char *chunk = malloc(TEXT_IO_SIZE);
+    text_out_t *out = malloc(sizeof(text_out_t));
+    int rc = 1;
+
+    if (!chunk || !out) {
+        perror("malloc");
+    } else {
+        out->len = 0;
+        if (type == TEXT_BI_WC) {
+            rc = text_wc(chunk, out);
+        } else if (type == TEXT_BI_REV) {
+            rc = text_rev(chunk, out);
+        } else if (type == TEXT_BI_WORDS) {
+            rc = text_words(chunk, out);
+        }
+    }
+    free(chunk);
+    free(out);
+    return rc;
+}
@@ -1,51 +1,172 @@
+#define _GNU_SOURCE     //pipe2()
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include "dshlib.h"
 
+static void *cmd_arena_alloc_next(cmd_arena_t *arena, size_t n);
+
+/*
+ * cmd_arena_alloc - Carve @n bytes out of @arena.
+ * @arena: The arena of the command list being built.
+ * @n: Number of bytes wanted.
+ *
+ * Every piece is aligned for pointers.  This is called a few times for
+ * each line, so only the common case of room in the current block is
+ * inline.
+ *
+ * Returns: the memory, or NULL if malloc failed.
+ */
+static inline void *cmd_arena_alloc(cmd_arena_t *arena, size_t n) {
+    cmd_arena_block_t *b = arena->cur;
+
+    n = (n + CMD_ARENA_ALIGN - 1) & ~(size_t)(CMD_ARENA_ALIGN - 1);
+    if (b && b->size - b->used >= n) {
+        char *p = b->data + b->used;
+        b->used += n;
+        return p;
+    }
+    return cmd_arena_alloc_next(arena, n);
+}
+
+/*
+ * cmd_arena_alloc_next - Carve @n aligned bytes out of the first block
+ * after the current one that has room.
+ *
+ * Blocks left over from earlier lines are reused in order; a new block is
+ * only allocated when none of them has room.
+ *
+ * Returns: the memory, or NULL if malloc failed.
+ */
+static void *cmd_arena_alloc_next(cmd_arena_t *arena, size_t n) {
+    cmd_arena_block_t *b = arena->cur;
+    cmd_arena_block_t *last = b;
+
+    while (b && b->size - b->used < n) {
+        last = b;
+        b = b->next;
+        if (b) {
+            b->used = 0;    //still holds an earlier line
+        }
+    }
+    if (!b) {
+        size_t size = n > CMD_ARENA_BLOCK ? n : CMD_ARENA_BLOCK;
+        b = malloc(sizeof(cmd_arena_block_t) + size);
+        if (!b) {
+            perror("malloc");
+            return NULL;
+        }
+        b->next = NULL;
+        b->used = 0;
+        b->size = size;
+        if (last) {
+            last->next = b;
+        } else {
+            arena->head = b;
+        }
+    }
+    arena->cur = b;
+
+    char *p = b->data + b->used;
+    b->used += n;
+    return p;
+}
+
+/*
+ * cmd_arena_strndup - Copy @n bytes of @s into @arena as a string.
+ *
+ * Returns: the copy, or NULL if malloc failed.
+ */
+static char *cmd_arena_strndup(cmd_arena_t *arena, const char *s, size_t n) {
+    char *p = cmd_arena_alloc(arena, n + 1);
+
+    if (p) {
+        memcpy(p, s, n);
+        p[n] = '\0';
+    }
+    return p;
+}
+
+/*
+ * cmd_arena_grow - Move an array of @used bytes at @old to a new piece of
+ * @size bytes, as realloc() would.  The old piece is given back with the
+ * rest of the arena.
+ *
+ * Returns: the new piece, or NULL if malloc failed.
+ */
+static void *cmd_arena_grow(cmd_arena_t *arena, const void *old, size_t used, size_t size) {
+    void *p = cmd_arena_alloc(arena, size);
+
+    if (p && used) {
+        memcpy(p, old, used);
+    }
+    return p;
+}
+
+/*
+ * cmd_arena_reset - Give back everything carved out of @arena, keeping
+ * its blocks for the next line.
+ */
+static void cmd_arena_reset(cmd_arena_t *arena) {
+    arena->cur = arena->head;
+    if (arena->head) {
+        arena->head->used = 0;
+    }
+}
+
+/*
+ * cmd_arena_free - Free the blocks of @arena.
+ */
+static void cmd_arena_free(cmd_arena_t *arena) {
+    cmd_arena_block_t *b = arena->head;
+
+    while (b) {
+        cmd_arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->head = NULL;
+    arena->cur = NULL;
+}
+
 /*
  * init_cmd_buff - Initialize a command buffer structure.
  * @cb: Pointer to the cmd_buff_t structure to be initialized.
  *
- * This version uses an explicit loop to set all argv elements to NULL.
+ * argv is left NULL; the lexer gives it room in the arena with the first
+ * argument.
  *
  * Returns: OK on success.
  */
 int init_cmd_buff(cmd_buff_t *cb) {
     cb->argc = 0;
+    cb->argv = NULL;
+    cb->argv_cap = 0;
     cb->_cmd_buffer = NULL;
-    for (int i = 0; i < CMD_ARGV_MAX; i++) {
-        cb->argv[i] = NULL;
-    }
+    cb->input_file = NULL;
+    cb->output_file = NULL;
+    cb->append_mode = false;
     return OK;
 }
 
 /*
- * release_cmd_buff - Free allocated memory within a command buffer.
+ * release_cmd_buff - Drop the strings a command buffer points at.
  * @cb: Pointer to the cmd_buff_t structure.
  *
- * Iterates over the argument vector and frees any allocated memory.
+ * The strings belong to the arena of the command list, which frees them
+ * all at once, so this only clears the pointers.
  *
- * Returns: OK after deallocation.
+ * Returns: OK after the buffer has been released.
  */
 int release_cmd_buff(cmd_buff_t *cb) {
-    for (int i = 0; i < CMD_ARGV_MAX; i++) {
-        if (cb->argv[i]) {
-            free(cb->argv[i]);
-            cb->argv[i] = NULL;
-        }
-    }
-    if (cb->_cmd_buffer) {
-        free(cb->_cmd_buffer);
-        cb->_cmd_buffer = NULL;
-    }
-    cb->argc = 0;
-    return OK;
+    return init_cmd_buff(cb);
 }
 
 /*
@@ -60,76 +181,166 @@ int reset_cmd_buff(cmd_buff_t *cb) {
 }
 
 /*
- * parse_cmd_line - Tokenize a command line string into arguments.
- * @cmd_line: The input string containing the full command.
- * @cb: Pointer to the cmd_buff_t structure to store tokens.
+ * Command line lexer
  *
- * This function traverses the input string using a manual pointer-based approach.
- * It handles tokens enclosed in double quotes and tokens separated by whitespace.
- * Each token is duplicated with strdup and stored in the argv array.
+ * One pass over the line builds the whole command list: words, the '|'
+ * between commands, the <, > and >> redirections and a '&' at the end
+ * that runs the line in the background are all recognized
+ * by the same state machine, so a '|' or '>' inside double quotes is part
+ * of a word like any other character, and a quoted part joins the text
+ * around it into one word, as in sh.
  *
- * Returns:
- *   OK if tokens are parsed successfully,
- *   ERR_CMD_ARGS_BAD if a quoted token is not closed,
- *   ERR_MEMORY on memory allocation failure,
- *   WARN_NO_CMDS if no tokens are found,
- *   ERR_CMD_OR_ARGS_TOO_BIG if the token limit is exceeded.
+ * The line is copied into the arena once and words are terminated and
+ * unquoted in place in the copy, which argv and the file names point
+ * into.  A plain word is only scanned, through a table of the characters
+ * that end it; the text after a quote is moved down over the quotes, and
+ * a quoted part is skipped with memchr(), which glibc does with SIMD.
  */
-int parse_cmd_line(char *cmd_line, cmd_buff_t *cb) {
-    reset_cmd_buff(cb);
-    char *p = cmd_line;
-    
-    // Skip any initial spaces
-    while (*p && isspace((unsigned char)*p)) p++;
-    
-    while (*p) {
-        // Skip additional spaces between tokens
-        if (isspace((unsigned char)*p)) {
-            p++;
-            continue;
+#define LEX_SPACE   1       //separates words
+#define LEX_STOP    2       //ends a plain run: space, quote, operator, NUL
+
+static const unsigned char lex_class[256] = {
+    ['\0'] = LEX_STOP,
+    [' '] = LEX_SPACE | LEX_STOP, ['\t'] = LEX_SPACE | LEX_STOP,
+    ['\n'] = LEX_SPACE | LEX_STOP, ['\v'] = LEX_SPACE | LEX_STOP,
+    ['\f'] = LEX_SPACE | LEX_STOP, ['\r'] = LEX_SPACE | LEX_STOP,
+    ['"'] = LEX_STOP, ['|'] = LEX_STOP, ['<'] = LEX_STOP, ['>'] = LEX_STOP,
+    ['&'] = LEX_STOP,
+};
+
+#define lex_is(c, class) (lex_class[(unsigned char)(c)] & (class))
+
+typedef enum {
+    LEX_ARG,            //next word is an argument
+    LEX_IN,             //next word is the file of a <
+    LEX_OUT,            //next word is the file of a >
+    LEX_APPEND,         //next word is the file of a >>
+} lex_word_t;
+
+/*
+ * lex_word - Find the end of the word at *@r and unquote it in place.
+ * @r: First character of the word, or its first quote since the text
+ * before that needs no moving, left where the word ended.
+ * @line_end: The terminating NUL of the line.
+ *
+ * The character the word ended at is returned in *@stop, since the word
+ * may be terminated right on top of it.
+ *
+ * Returns: OK, or ERR_CMD_ARGS_BAD if a quote is not closed.
+ */
+static int lex_word(char **r, const char *line_end, char *stop) {
+    char *in = *r;
+    char *out = in;     //catches up with in after the first quote
+
+    while (true) {
+        char *run = in;
+        while (!lex_is(*run, LEX_STOP)) run++;
+        if (out != in) {
+            memmove(out, in, run - in);
         }
-        
-        char *start = NULL;
-        if (*p == '"') {
-            // Handle quoted token: advance pointer and mark beginning
-            p++;
-            start = p;
-            // Look for the closing quote manually
-            while (*p && *p != '"') p++;
-            if (*p != '"') {
-                fprintf(stderr, "Unbalanced quotes in command line\n");
-                return ERR_CMD_ARGS_BAD;
-            }
-            *p = '\0'; // Terminate the token string
-            p++;       // Move past the closing quote
-        } else {
-            // Normal token: record the start and find the token boundary
-            start = p;
-            while (*p && !isspace((unsigned char)*p)) p++;
-            // Terminate token if not at end-of-string
-            if (*p) {
-                *p = '\0';
-                p++;
-            }
+        out += run - in;
+        in = run;
+        if (*in != '"') {
+            break;
         }
-        // Ensure token count is within the allowed maximum
-        if (cb->argc >= CMD_ARGV_MAX - 1) {
-            fprintf(stderr, "Too many arguments provided\n");
-            return ERR_CMD_OR_ARGS_TOO_BIG;
+        char *close = memchr(in + 1, '"', line_end - in - 1);
+        if (!close) {
+            fprintf(stderr, "Unbalanced quotes in command line\n");
+            return ERR_CMD_ARGS_BAD;
         }
-        cb->argv[cb->argc] = strdup(start);
-        if (!cb->argv[cb->argc]) {
-            perror("strdup");
-            return ERR_MEMORY;
+        memmove(out, in + 1, close - in - 1);
+        out += close - in - 1;
+        in = close + 1;
+    }
+    *stop = *in;
+    *out = '\0';
+    *r = in;
+    return OK;
+}
+
+/*
+ * lex_add_cmd - Start the next command of @clist, growing the array.
+ *
+ * Returns: the command, or NULL if malloc failed.
+ */
+static cmd_buff_t *lex_add_cmd(command_list_t *clist) {
+    if (clist->num == clist->cap) {
+        int cap = clist->cap ? clist->cap * 2 : CMD_MAX;
+        cmd_buff_t *cmds = cmd_arena_grow(&clist->arena, clist->commands,
+                                          clist->num * sizeof(cmd_buff_t),
+                                          cap * sizeof(cmd_buff_t));
+        if (!cmds) {
+            return NULL;
         }
-        cb->argc++;
+        clist->commands = cmds;
+        clist->cap = cap;
+    }
+    cmd_buff_t *cb = &clist->commands[clist->num++];
+    init_cmd_buff(cb);
+    return cb;
+}
+
+/*
+ * lex_grow_argv - Give the argv of @cb twice the room, or CMD_ARGV_MAX
+ * slots for its first argument.
+ *
+ * Returns: OK, or ERR_MEMORY if malloc failed.
+ */
+static int lex_grow_argv(command_list_t *clist, cmd_buff_t *cb) {
+    int cap = cb->argv_cap ? cb->argv_cap * 2 : CMD_ARGV_MAX;
+    char **argv = cmd_arena_grow(&clist->arena, cb->argv,
+                                 cb->argc * sizeof(char *), cap * sizeof(char *));
+    if (!argv) {
+        return ERR_MEMORY;
+    }
+    cb->argv = argv;
+    cb->argv_cap = cap;
+    return OK;
+}
+
+/*
+ * lex_add_arg - Append @word to the arguments of @cb, growing argv.
+ *
+ * argv always keeps a slot for the NULL after the last argument.
+ *
+ * Returns: OK, or ERR_MEMORY if malloc failed.
+ */
+static int lex_add_arg(command_list_t *clist, cmd_buff_t *cb, char *word) {
+    if (cb->argc + 2 > cb->argv_cap && lex_grow_argv(clist, cb) != OK) {
+        return ERR_MEMORY;
+    }
+    cb->argv[cb->argc++] = word;
+    return OK;
+}
+
+/*
+ * lex_end_cmd - Finish the command of the segment @seg .. @seg_end.
+ * @cb: The command, or NULL if the segment had nothing in it.
+ * @next: What the next word was going to be.
+ *
+ * Returns: OK, or ERR_CMD_ARGS_BAD for a redirection without a file name
+ * or a command that is only redirections.  ERR_MEMORY if the copy of the
+ * segment could not be allocated.
+ */
+static int lex_end_cmd(command_list_t *clist, cmd_buff_t *cb, lex_word_t next,
+                       const char *seg, const char *seg_end) {
+    if (next != LEX_ARG) {
+        fprintf(stderr, "Missing file name for redirection\n");
+        return ERR_CMD_ARGS_BAD;
+    }
+    if (!cb) {
+        return OK;      //empty segment, skipped
     }
-    
     if (cb->argc == 0) {
-        return WARN_NO_CMDS;
+        fprintf(stderr, "Missing command for redirection\n");
+        return ERR_CMD_ARGS_BAD;
     }
     cb->argv[cb->argc] = NULL;
-    return OK;
+
+    // Save the trimmed segment for potential debugging
+    while (seg_end > seg && lex_is(seg_end[-1], LEX_SPACE)) seg_end--;
+    cb->_cmd_buffer = cmd_arena_strndup(&clist->arena, seg, seg_end - seg);
+    return cb->_cmd_buffer ? OK : ERR_MEMORY;
 }
 
 /*
@@ -137,61 +348,113 @@ int parse_cmd_line(char *cmd_line, cmd_buff_t *cb) {
  * @cmd_line: The raw input command line.
  * @clist: Pointer to the command_list_t structure to populate.
  *
- * This function uses strtok_r to split the command line by the pipe character.
- * Each segment is trimmed for leading/trailing whitespace and then parsed
- * into a command buffer.
+ * Lexes the line in one pass, see above.  There is no limit on the length
+ * of the line or the number of commands and arguments.  Segments with
+ * nothing between their pipes are skipped.  Nothing in @clist points into @cmd_line, which
+ * is not modified, and whatever an earlier line left in @clist is dropped
+ * first.
  *
  * Returns:
  *   OK on success,
  *   WARN_NO_CMDS if no valid commands are found,
- *   ERR_TOO_MANY_COMMANDS if the command count exceeds the limit,
+ *   ERR_CMD_ARGS_BAD for an unclosed quote, an incomplete redirection or
+ *   a '&' that is not at the end,
  *   ERR_MEMORY on failure to allocate memory.
  */
 int split_into_cmds(char *cmd_line, command_list_t *clist) {
     clist->num = 0;
-    char *saveptr = NULL;
-    char *segment = strtok_r(cmd_line, PIPE_STRING, &saveptr);
-    
-    while (segment) {
-        // Trim leading whitespace
-        while (*segment && isspace((unsigned char)*segment)) segment++;
-        
-        // Create a copy so we can trim trailing spaces
-        char *cmd_copy = strdup(segment);
-        if (!cmd_copy) {
-            return ERR_MEMORY;
-        }
-        int len = strlen(cmd_copy);
-        while (len > 0 && isspace((unsigned char)cmd_copy[len - 1])) {
-            cmd_copy[len - 1] = '\0';
-            len--;
-        }
-        
-        // Only process non-empty command segments
-        if (cmd_copy[0] != '\0') {
-            if (clist->num >= CMD_MAX) {
-                free(cmd_copy);
-                return ERR_TOO_MANY_COMMANDS;
+    clist->cap = 0;
+    clist->commands = NULL;
+    clist->background = false;
+    cmd_arena_reset(&clist->arena);
+
+    size_t len = strlen(cmd_line);
+    char *line = cmd_arena_strndup(&clist->arena, cmd_line, len);
+    if (!line) {
+        return ERR_MEMORY;
+    }
+
+    char *r = line;
+    char c = *r;                    //*r, unless a word was terminated on it
+    size_t seg = 0;                 //offset of the current command
+    cmd_buff_t *cb = NULL;          //started by its first word
+    lex_word_t next = LEX_ARG;
+    int rc = OK;
+
+    while (true) {
+        while (lex_is(c, LEX_SPACE)) c = *++r;
+
+        if (c == '\0' || c == PIPE_CHAR) {
+            rc = lex_end_cmd(clist, cb, next, cmd_line + seg, cmd_line + (r - line));
+            if (rc != OK || c == '\0') {
+                break;
             }
-            init_cmd_buff(&clist->commands[clist->num]);
-            // Save the trimmed copy for potential debugging
-            clist->commands[clist->num]._cmd_buffer = strdup(cmd_copy);
-            if (!clist->commands[clist->num]._cmd_buffer) {
-                free(cmd_copy);
-                return ERR_MEMORY;
+            cb = NULL;
+            c = *++r;
+            while (lex_is(c, LEX_SPACE)) c = *++r;
+            seg = r - line;
+            continue;
+        }
+
+        if (c == '&') {
+            const char *amp = r;
+            c = *++r;
+            while (lex_is(c, LEX_SPACE)) c = *++r;
+            if (c != '\0') {
+                fprintf(stderr, "Syntax error near '&'\n");
+                return ERR_CMD_ARGS_BAD;
             }
-            int rc = parse_cmd_line(cmd_copy, &clist->commands[clist->num]);
-            free(cmd_copy);
+            clist->background = true;
+            rc = lex_end_cmd(clist, cb, next, cmd_line + seg, cmd_line + (amp - line));
+            break;
+        }
+
+        if (next != LEX_ARG && (c == '<' || c == '>')) {
+            fprintf(stderr, "Missing file name for redirection\n");
+            return ERR_CMD_ARGS_BAD;
+        }
+        if (!cb && !(cb = lex_add_cmd(clist))) {
+            return ERR_MEMORY;
+        }
+
+        if (c == '<') {
+            next = LEX_IN;
+            c = *++r;
+            continue;
+        }
+        if (c == '>') {
+            next = r[1] == '>' ? LEX_APPEND : LEX_OUT;
+            r += next == LEX_APPEND ? 1 : 0;
+            c = *++r;
+            continue;
+        }
+
+        // A plain word is only scanned, lex_word() takes over at a quote
+        char *word = r;
+        while (!lex_is(c, LEX_STOP)) c = *++r;
+        if (c == '"') {
+            rc = lex_word(&r, line + len, &c);
             if (rc != OK) {
                 return rc;
             }
-            clist->num++;
         } else {
-            free(cmd_copy);
+            *r = '\0';
+        }
+
+        if (next == LEX_IN) {
+            cb->input_file = word;
+        } else if (next == LEX_OUT || next == LEX_APPEND) {
+            cb->output_file = word;
+            cb->append_mode = next == LEX_APPEND;
+        } else if ((rc = lex_add_arg(clist, cb, word)) != OK) {
+            return rc;
         }
-        segment = strtok_r(NULL, PIPE_STRING, &saveptr);
+        next = LEX_ARG;
+    }
+
+    if (rc != OK) {
+        return rc;
     }
-    
     if (clist->num == 0) {
         return WARN_NO_CMDS;
     }
@@ -199,10 +462,31 @@ int split_into_cmds(char *cmd_line, command_list_t *clist) {
 }
 
 /*
- * cleanup_cmd_list - Free memory for all command buffers in the list.
+ * init_cmd_list - Initialize a command list and its empty arena.
+ * @clist: Pointer to the command_list_t structure.
+ *
+ * Must be called once before the list is first built.  The list can then
+ * be built and freed any number of times and is finally closed with
+ * close_cmd_list().
+ *
+ * Returns: OK on success.
+ */
+int init_cmd_list(command_list_t *clist) {
+    clist->num = 0;
+    clist->cap = 0;
+    clist->commands = NULL;
+    clist->background = false;
+    clist->arena.head = NULL;
+    clist->arena.cur = NULL;
+    return OK;
+}
+
+/*
+ * cleanup_cmd_list - Release all command buffers in the list.
  * @clist: Pointer to the command_list_t structure.
  *
- * Iterates through the command list and releases resources allocated for each.
+ * Clears every command and rewinds the arena in one go.  The arena keeps
+ * its blocks for the next line; close_cmd_list() frees them.
  *
  * Returns: OK after cleanup.
  */
@@ -211,6 +495,22 @@ int cleanup_cmd_list(command_list_t *clist) {
         release_cmd_buff(&clist->commands[i]);
     }
     clist->num = 0;
+    clist->cap = 0;
+    clist->commands = NULL;
+    clist->background = false;
+    cmd_arena_reset(&clist->arena);
+    return OK;
+}
+
+/*
+ * close_cmd_list - Release a command list and free its arena.
+ * @clist: Pointer to the command_list_t structure.
+ *
+ * Returns: OK after the list has been closed.
+ */
+int close_cmd_list(command_list_t *clist) {
+    cleanup_cmd_list(clist);
+    cmd_arena_free(&clist->arena);
     return OK;
 }
 
@@ -225,21 +525,24 @@ int cleanup_cmd_list(command_list_t *clist) {
  */
 int exec_local_cmd_loop()
 {
-    char input_line[SH_CMD_MAX + 1];
+    char *input_line;
     command_list_t cmd_list;
     int rc;
 
+    init_cmd_list(&cmd_list);
+    jobs_init();
     while (true) {
-        // Display the prompt
+        // Report finished background jobs, then display the prompt
+        jobs_notify();
         printf("%s", SH_PROMPT);
 
-        // Read user input; break on EOF
-        if (!fgets(input_line, sizeof(input_line), stdin)) {
+        // Read user input, however long, reaping jobs while waiting for
+        // it; break on EOF
+        input_line = read_cmd_line();
+        if (!input_line) {
             printf("\n");
             break;
         }
-        // Remove newline from the input string
-        input_line[strcspn(input_line, "\n")] = '\0';
 
         // Exit if user types the exit command
         if (strcmp(input_line, EXIT_CMD) == 0) {
@@ -258,14 +561,18 @@ int exec_local_cmd_loop()
         if (rc == WARN_NO_CMDS) {
             printf("%s\n", CMD_WARN_NO_CMD);
             continue;
-        } else if (rc == ERR_TOO_MANY_COMMANDS) {
-            printf(CMD_ERR_PIPE_LIMIT, CMD_MAX);
-            continue;
         } else if (rc != OK) {
             printf("%s\n", CMD_ERR_EXECUTE);
             continue;
         }
 
+        // Built-in commands run in the shell itself
+        if (cmd_list.num == 1 && identify_builtin(cmd_list.commands[0].argv[0]) != BI_NOT_BI &&
+            run_builtin_cmd(&cmd_list.commands[0]) == BI_EXECUTED) {
+            cleanup_cmd_list(&cmd_list);
+            continue;
+        }
+
         // Run the commands in a pipeline
         rc = execute_pipeline(&cmd_list);
         if (rc != OK) {
@@ -275,66 +582,294 @@ int exec_local_cmd_loop()
         // Free the resources used for this command list
         cleanup_cmd_list(&cmd_list);
     }
+    close_cmd_list(&cmd_list);
+    jobs_close();
     return OK;
 }
 
+/*
+ * Spawning pipeline stages
+ *
+ * fork() copies the page tables of the whole shell only for the child to
+ * throw them away in execvp(), so a stage costs more the bigger the shell
+ * (or the server running it) has grown.  posix_spawnp() starts the program
+ * without that copy; glibc runs it with clone(CLONE_VM|CLONE_VFORK).  The
+ * dup2() and close() plumbing a forked child would do becomes spawn file
+ * actions.
+ *
+ * fork() is still used for text builtins, which run in the child without
+ * an exec, when the spawn itself can not be had (no memory or processes
+ * for it), and when DSH_SPAWN=fork is set in the environment, to compare.
+ *
+ * Either way the program is run by the path the command hash resolved
+ * (see dsh_hash.c), so the PATH search is not repeated for every stage.
+ */
+static bool spawn_enabled(void) {
+    const char *mode = getenv("DSH_SPAWN");
+    return !mode || strcmp(mode, "fork") != 0;
+}
+
+/*
+ * spawn_stage - Start one pipeline stage with posix_spawn().
+ * @cmd: The command to run.
+ * @path: The program to run, or NULL to search PATH for argv[0].
+ * @in_fd, @out_fd, @err_fd: What becomes its stdin, stdout and stderr.
+ * @pid: Set to the child's pid on success.
+ *
+ * The pipes are close-on-exec, so the child needs no file action for the
+ * ones it does not use, however long the pipeline is.
+ *
+ * Returns: 0 on success, or the error number, as posix_spawnp() does.
+ */
+static int spawn_stage(cmd_buff_t *cmd, const char *path, int in_fd, int out_fd,
+                       int err_fd, pid_t *pid) {
+    extern char **environ;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    int rc = posix_spawn_file_actions_init(&actions);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = posix_spawnattr_init(&attr);
+    if (rc != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return rc;
+    }
+
+    // Not the SIGCHLD the shell blocks for its jobs
+    jobs_child_sigmask(&mask);
+    rc = posix_spawnattr_setsigmask(&attr, &mask);
+    if (rc == 0) {
+        rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    }
+    if (rc == 0 && in_fd != STDIN_FILENO) {
+        rc = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (rc == 0 && out_fd != STDOUT_FILENO) {
+        rc = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if (rc == 0 && err_fd != STDERR_FILENO) {
+        rc = posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+    }
+    if (rc == 0 && path) {
+        rc = posix_spawn(pid, path, &actions, &attr, cmd->argv, environ);
+    } else if (rc == 0) {
+        rc = posix_spawnp(pid, cmd->argv[0], &actions, &attr, cmd->argv, environ);
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return rc;
+}
+
+/*
+ * fork_stage - Start one pipeline stage with fork() and execv().
+ *
+ * Same arguments as spawn_stage(), plus @pipefds, @total_pipes: every
+ * pipe end, closed in the child by hand, since a text builtin runs there
+ * without an exec to close them.
+ *
+ * Returns: the child's pid, or -1 if fork() failed.
+ */
+static pid_t fork_stage(cmd_buff_t *cmd, const char *path, int in_fd, int out_fd,
+                        int err_fd, const int *pipefds, int total_pipes) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    sigset_t mask;
+    jobs_child_sigmask(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    if (in_fd != STDIN_FILENO && dup2(in_fd, STDIN_FILENO) < 0) {
+        perror("dup2");
+        _exit(ERR_EXEC_CMD);
+    }
+    if (out_fd != STDOUT_FILENO && dup2(out_fd, STDOUT_FILENO) < 0) {
+        perror("dup2");
+        _exit(ERR_EXEC_CMD);
+    }
+    if (err_fd != STDERR_FILENO && dup2(err_fd, STDERR_FILENO) < 0) {
+        perror("dup2");
+        _exit(ERR_EXEC_CMD);
+    }
+    // Close all pipe file descriptors in the child
+    for (int j = 0; j < total_pipes; j++) {
+        close(pipefds[j]);
+    }
+    // Text builtins run right here, without an exec
+    Text_Built_In_Cmds text_bi = match_text_builtin(cmd);
+    if (text_bi != TEXT_NOT_BI) {
+        _exit(exec_text_builtin(text_bi));
+    }
+    // Execute the command; if execvp fails, exit with error.  _exit(), as
+    // exit() would flush the copy of the shell's stdout buffer
+    if (path) {
+        execv(path, cmd->argv);
+    }
+    execvp(cmd->argv[0], cmd->argv);
+    perror("execvp");
+    _exit(ERR_EXEC_CMD);
+}
+
+/*
+ * start_stage - Start one pipeline stage, spawned if possible.
+ *
+ * Same arguments as fork_stage(), but the path comes from the hash.
+ *
+ * Returns: the child's pid, or -1 if the stage could not be started.  The
+ * reason has been written to @err_fd.
+ */
+static pid_t start_stage(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd,
+                         const int *pipefds, int total_pipes) {
+    bool text_bi = match_text_builtin(cmd) != TEXT_NOT_BI;
+    const char *path = text_bi ? NULL : hash_lookup(cmd->argv[0]);
+
+    if (spawn_enabled() && !text_bi) {
+        pid_t pid;
+        int rc = spawn_stage(cmd, path, in_fd, out_fd, err_fd, &pid);
+        if (rc != 0 && path) {
+            // the cached program went away, search again
+            hash_forget(cmd->argv[0]);
+            path = NULL;
+            rc = spawn_stage(cmd, NULL, in_fd, out_fd, err_fd, &pid);
+        }
+        if (rc == 0) {
+            return pid;
+        }
+        // Anything but a failed clone() is the program failing to start
+        if (rc != EAGAIN && rc != ENOMEM && rc != ENOSYS) {
+            dprintf(err_fd, "execvp: %s\n", strerror(rc));
+            return -1;
+        }
+    }
+
+    pid_t pid = fork_stage(cmd, path, in_fd, out_fd, err_fd, pipefds, total_pipes);
+    if (pid < 0) {
+        dprintf(err_fd, "fork: %s\n", strerror(errno));
+    }
+    return pid;
+}
+
+/*
+ * open_redirects - Open the redirection files of @cmd.
+ * @in_fd, @out_fd: The pipe ends the stage would use, replaced by the
+ * files it redirects to.
+ * @err_fd: Where a file that can not be opened is reported.
+ *
+ * The files are opened close-on-exec, so only the stdin and stdout made
+ * from them reach the program.
+ *
+ * Returns: 0 on success, -1 if a file could not be opened.  The reason
+ * has been written and nothing is left open.
+ */
+static int open_redirects(cmd_buff_t *cmd, int *in_fd, int *out_fd, int err_fd) {
+    int in = *in_fd;
+
+    if (cmd->input_file) {
+        in = open(cmd->input_file, O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            dprintf(err_fd, "%s: %s\n", cmd->input_file, strerror(errno));
+            return -1;
+        }
+    }
+    if (cmd->output_file) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (cmd->append_mode ? O_APPEND : O_TRUNC);
+        int out = open(cmd->output_file, flags, 0644);
+        if (out < 0) {
+            dprintf(err_fd, "%s: %s\n", cmd->output_file, strerror(errno));
+            if (in != *in_fd) {
+                close(in);
+            }
+            return -1;
+        }
+        *out_fd = out;
+    }
+    *in_fd = in;
+    return 0;
+}
+
 /*
  * execute_pipeline - Launch and connect a series of piped commands.
  * @clist: Pointer to the command_list_t structure with parsed commands.
  *
- * This function creates pipes for communication between commands, forks a child
- * for each command, sets up redirection via dup2(), and then executes the command.
- * The parent process waits for all children to complete.
+ * Runs the pipeline on the shell's own stdin, stdout and stderr, see
+ * execute_pipeline_io().
+ */
+int execute_pipeline(command_list_t *clist)
+{
+    return execute_pipeline_io(clist, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+}
+
+/*
+ * execute_pipeline_io - Launch and connect a series of piped commands.
+ * @clist: Pointer to the command_list_t structure with parsed commands.
+ * @in_fd: stdin of the first command.
+ * @out_fd: stdout of the last command.
+ * @err_fd: stderr of every command, and where a stage that can not be
+ * started is reported.
+ *
+ * The remote shell server passes the client socket as @out_fd and @err_fd,
+ * so the commands write to the client without the server forking itself.
+ *
+ * This function creates pipes for communication between commands, starts a
+ * child for each command with its stdin and stdout on the pipes, and then
+ * waits for all of them.  A < or > redirection of a command replaces its
+ * end of the pipe.  See start_stage() for how a child is started.
+ * A stage that fails to start does not stop the others.
+ *
+ * A background pipeline reads /dev/null instead of the shell's input and
+ * is not waited for; it is put in the job table instead.
  *
  * Returns:
- *   OK if all commands execute successfully,
- *   ERR_EXEC_CMD if an error occurs during the process.
+ *   the exit status of the last command,
+ *   ERR_EXEC_CMD if a pipe could not be made or the last command not started.
  */
-int execute_pipeline(command_list_t *clist)
+int execute_pipeline_io(command_list_t *clist, int in_fd, int out_fd, int err_fd)
 {
     int num_cmds = clist->num;
     int total_pipes = (num_cmds - 1) * 2;
     int pipefds[total_pipes];
-    pid_t pids[CMD_MAX];
+    pid_t pids[num_cmds];
 
     // Create all necessary pipes
     for (int i = 0; i < num_cmds - 1; i++) {
-        if (pipe(pipefds + i * 2) < 0) {
+        if (pipe2(pipefds + i * 2, O_CLOEXEC) < 0) {
             perror("pipe");
+            for (int j = 0; j < i * 2; j++) {
+                close(pipefds[j]);
+            }
             return ERR_EXEC_CMD;
         }
     }
 
-    // Fork a child for each command
+    // A background job does not read the shell's input, as in sh
+    int first_in = in_fd;
+    if (clist->background) {
+        first_in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (first_in < 0) {
+            first_in = in_fd;
+        }
+    }
+
+    // Start a child for each command
     for (int i = 0; i < num_cmds; i++) {
-        pids[i] = fork();
-        if (pids[i] < 0) {
-            perror("fork");
-            return ERR_EXEC_CMD;
+        // Input from the previous pipe, output to the next one
+        int pipe_in = i > 0 ? pipefds[(i - 1) * 2] : first_in;
+        int pipe_out = i < num_cmds - 1 ? pipefds[i * 2 + 1] : out_fd;
+        // Redirections take the place of the pipes
+        int stage_in = pipe_in;
+        int stage_out = pipe_out;
+        pids[i] = -1;
+        if (open_redirects(&clist->commands[i], &stage_in, &stage_out, err_fd) == 0) {
+            pids[i] = start_stage(&clist->commands[i], stage_in, stage_out, err_fd,
+                                  pipefds, total_pipes);
         }
-        if (pids[i] == 0) {  // Child process
-            // Redirect input if not the first command
-            if (i > 0) {
-                if (dup2(pipefds[(i - 1) * 2], STDIN_FILENO) < 0) {
-                    perror("dup2");
-                    exit(ERR_EXEC_CMD);
-                }
-            }
-            // Redirect output if not the last command
-            if (i < num_cmds - 1) {
-                if (dup2(pipefds[i * 2 + 1], STDOUT_FILENO) < 0) {
-                    perror("dup2");
-                    exit(ERR_EXEC_CMD);
-                }
-            }
-            // Close all pipe file descriptors in the child
-            for (int j = 0; j < total_pipes; j++) {
-                close(pipefds[j]);
-            }
-            // Execute the command; if execvp fails, exit with error
-            execvp(clist->commands[i].argv[0], clist->commands[i].argv);
-            perror("execvp");
-            exit(ERR_EXEC_CMD);
+        if (stage_in != pipe_in) {
+            close(stage_in);
+        }
+        if (stage_out != pipe_out) {
+            close(stage_out);
         }
     }
     
@@ -342,15 +877,26 @@ int execute_pipeline(command_list_t *clist)
     for (int i = 0; i < total_pipes; i++) {
         close(pipefds[i]);
     }
+    if (first_in != in_fd) {
+        close(first_in);
+    }
+
+    // A background job is reaped later, see dsh_jobs.c
+    if (clist->background) {
+        return job_add(clist, pids) < 0 ? ERR_EXEC_CMD : OK;
+    }
 
     // Wait for all children to finish
-    int status;
+    int status = 0;
     for (int i = 0; i < num_cmds; i++) {
-        if (waitpid(pids[i], &status, 0) < 0) {
+        if (pids[i] > 0 && waitpid(pids[i], &status, 0) < 0) {
             perror("waitpid");
             return ERR_EXEC_CMD;
         }
     }
+    if (pids[num_cmds - 1] < 0) {
+        return ERR_EXEC_CMD;
+    }
     return WEXITSTATUS(status);
 }
 
@@ -367,6 +913,18 @@ Built_In_Cmds identify_builtin(const char *cmd) {
     if (!strcmp(cmd, "stop-server")) {
         return BI_CMD_STOP_SVR;
     }
+    if (!strcmp(cmd, "hash")) {
+        return BI_CMD_HASH;
+    }
+    if (!strcmp(cmd, "jobs")) {
+        return BI_CMD_JOBS;
+    }
+    if (!strcmp(cmd, "wait")) {
+        return BI_CMD_WAIT;
+    }
+    if (!strcmp(cmd, "fg")) {
+        return BI_CMD_FG;
+    }
     if (!strncmp(cmd, "cd ", 3)) {
         return BI_CMD_CD;
     }
@@ -381,6 +939,9 @@ Built_In_Cmds identify_builtin(const char *cmd) {
  *   - "exit" causes the shell to terminate.
  *   - "cd" changes the current working directory.
  *   - "stop-server" is reserved for server termination (handled elsewhere).
+ *   - "hash" lists the command hash, "hash -r" empties it.
+ *   - "jobs" lists the background jobs, "wait" waits for them and "fg"
+ *     waits for one as if it ran in the foreground.
  *
  * Returns:
  *   BI_EXECUTED if the built-in command was processed,
@@ -400,6 +961,25 @@ Built_In_Cmds run_builtin_cmd(cmd_buff_t *cb) {
             perror("chdir");
         }
         return BI_EXECUTED;
+    } else if (type == BI_CMD_HASH) {
+        if (cb->argc == 1) {
+            hash_print();
+        } else if (cb->argc == 2 && !strcmp(cb->argv[1], "-r")) {
+            hash_clear();
+        } else {
+            fprintf(stderr, "hash: usage: hash [-r]\n");
+        }
+        return BI_EXECUTED;
+    }
+    if (type == BI_CMD_JOBS) {
+        jobs_print();
+        return BI_EXECUTED;
+    } else if (type == BI_CMD_WAIT) {
+        jobs_wait(cb->argc > 1 ? cb->argv[1] : NULL);
+        return BI_EXECUTED;
+    } else if (type == BI_CMD_FG) {
+        jobs_fg(cb->argc > 1 ? cb->argv[1] : NULL);
+        return BI_EXECUTED;
     }
     return BI_NOT_IMPLEMENTED;
 }
@@ -421,7 +1001,8 @@ int build_cmd_list(char *cmd_line, command_list_t *clist) {
  * free_cmd_list - Wrapper function to free a list of commands.
  * @cmd_lst: Pointer to the command_list_t structure to clean up.
  *
- * This wrapper calls cleanup_cmd_list to free allocated resources.
+ * This wrapper calls cleanup_cmd_list, which keeps the arena blocks for
+ * the next line; close_cmd_list() frees them.
  *
  * Returns: The result of cleanup_cmd_list.
  */
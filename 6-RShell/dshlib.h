@@ -5,9 +5,9 @@
 //Constants for command structure sizes
 #define EXE_MAX 64
 #define ARG_MAX 256
+// Initial sizes; command lists, argument vectors and lines grow past them
 #define CMD_MAX 8
 #define CMD_ARGV_MAX (CMD_MAX + 1)
-// Longest command that can be read from the shell
 #define SH_CMD_MAX EXE_MAX + ARG_MAX
 
 typedef struct command
@@ -17,20 +17,48 @@ typedef struct command
 } command_t;
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct cmd_buff
 {
     int  argc;
-    char *argv[CMD_ARGV_MAX];
+    char **argv;        // NULL terminated, argv_cap slots in the arena
+    int  argv_cap;
     char *_cmd_buffer;
     char *input_file;  // extra credit, stores input redirection file (for `<`)
     char *output_file; // extra credit, stores output redirection file (for `>`)
     bool append_mode; // extra credit, sets append mode fomr output_file
 } cmd_buff_t;
 
+/*
+ * Parsing arena: everything a command line is parsed into (the commands
+ * array, each argv and the strings they point at, _cmd_buffer and the
+ * redirection file names) is carved out of the blocks of its
+ * command_list_t.  Arrays grow by doubling into a new piece of the arena.
+ * Freeing the list only rewinds the blocks, so once a line of some size
+ * has been seen, parsing another like it does not malloc at all.
+ */
+#define CMD_ARENA_BLOCK 4096
+#define CMD_ARENA_ALIGN 8
+
+typedef struct cmd_arena_block {
+    struct cmd_arena_block *next;
+    size_t used;
+    size_t size;
+    _Alignas(CMD_ARENA_ALIGN) char data[];
+} cmd_arena_block_t;
+
+typedef struct cmd_arena {
+    cmd_arena_block_t *head;
+    cmd_arena_block_t *cur;     //block being carved, head after a reset
+} cmd_arena_t;
+
 typedef struct command_list{
     int num;
-    cmd_buff_t commands[CMD_MAX];
+    int cap;
+    cmd_buff_t *commands;       // cap slots in the arena
+    bool background;            // line ended in '&', see dsh_jobs.c
+    cmd_arena_t arena;
 }command_list_t;
 
 //Special character #defines
@@ -61,8 +89,10 @@ int free_cmd_buff(cmd_buff_t *cmd_buff);
 int clear_cmd_buff(cmd_buff_t *cmd_buff);
 int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff);
 int close_cmd_buff(cmd_buff_t *cmd_buff);
+int init_cmd_list(command_list_t *clist);
 int build_cmd_list(char *cmd_line, command_list_t *clist);
 int free_cmd_list(command_list_t *cmd_lst);
+int close_cmd_list(command_list_t *clist);
 
 //built in command stuff
 typedef enum {
@@ -71,17 +101,59 @@ typedef enum {
     BI_CMD_CD,
     BI_CMD_RC,              //extra credit command
     BI_CMD_STOP_SVR,        //new command "stop-server"
+    BI_CMD_HASH,            //command hash, see dsh_hash.c
+    BI_CMD_JOBS,            //background jobs, see dsh_jobs.c
+    BI_CMD_WAIT,
+    BI_CMD_FG,
     BI_NOT_BI,
     BI_EXECUTED,
     BI_NOT_IMPLEMENTED,
 } Built_In_Cmds;
 Built_In_Cmds match_command(const char *input); 
 Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd);
+Built_In_Cmds identify_builtin(const char *cmd);
+Built_In_Cmds run_builtin_cmd(cmd_buff_t *cb);
+
+//command hash, PATH lookups remembered across commands, see dsh_hash.c
+#define HASH_BUCKETS    64
+#define HASH_DIRS_MAX   64      //PATH entries past this are not cached
+
+const char *hash_lookup(const char *name);
+void hash_forget(const char *name);
+void hash_clear(void);
+void hash_print(void);
+
+//background jobs, reaped while the prompt waits for input, see dsh_jobs.c
+#include <signal.h>
+#include <sys/types.h>
+
+int jobs_init(void);
+void jobs_close(void);
+void jobs_child_sigmask(sigset_t *mask);
+int job_add(const command_list_t *clist, const pid_t *pids);
+void jobs_notify(void);
+void jobs_print(void);
+int jobs_wait(const char *spec);
+int jobs_fg(const char *spec);
+char *read_cmd_line(void);
+
+//text builtins, run in a forked pipeline stage without exec, see dsh_text.c
+#define TEXT_IO_SIZE    (64 * 1024)
+
+typedef enum {
+    TEXT_BI_WC,             //wc -w
+    TEXT_BI_REV,            //rev
+    TEXT_BI_WORDS,          //words, like stringfun -W
+    TEXT_NOT_BI,
+} Text_Built_In_Cmds;
+Text_Built_In_Cmds match_text_builtin(const cmd_buff_t *cmd);
+int exec_text_builtin(Text_Built_In_Cmds type);
 
 //main execution context
 int exec_local_cmd_loop();
 int exec_cmd(cmd_buff_t *cmd);
 int execute_pipeline(command_list_t *clist);
+int execute_pipeline_io(command_list_t *clist, int in_fd, int out_fd, int err_fd);
 
 
 //output constants
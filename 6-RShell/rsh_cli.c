@@ -19,12 +19,13 @@ int exec_remote_cmd_loop(char *address, int port) {
         return ERR_RDSH_CLIENT;
     }
 
-    char cmd_buffer[SH_CMD_MAX];
+    char *cmd_buffer = NULL;    // grown by getline() as needed
+    size_t cmd_size = 0;
     char response_buffer[RDSH_COMM_BUFF_SZ];
 
     while (1) {
         printf("%s", SH_PROMPT);
-        if (fgets(cmd_buffer, sizeof(cmd_buffer), stdin) == NULL) {
+        if (getline(&cmd_buffer, &cmd_size, stdin) < 0) {
             printf("\n");
             break;
         }
@@ -37,7 +38,17 @@ int exec_remote_cmd_loop(char *address, int port) {
             break;
         }
 
-        if (send(client_sock, cmd_buffer, strlen(cmd_buffer) + 1, 0) < 0) {
+        // A long command may take more than one send()
+        size_t len = strlen(cmd_buffer) + 1;
+        size_t sent = 0;
+        while (sent < len) {
+            ssize_t n = send(client_sock, cmd_buffer + sent, len - sent, 0);
+            if (n < 0) {
+                break;
+            }
+            sent += n;
+        }
+        if (sent < len) {
             perror("send");
             break;
         }
@@ -58,6 +69,7 @@ int exec_remote_cmd_loop(char *address, int port) {
         }
     }
 
+    free(cmd_buffer);
     close(client_sock);
     return OK;
 }
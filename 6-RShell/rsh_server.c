@@ -1,4 +1,5 @@
 
+#define _GNU_SOURCE     //accept4()
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <arpa/inet.h>
@@ -110,7 +111,7 @@ int boot_server(char *ifaces, int port){
     int opt = 1;
 
     // Create socket
-    if ((server_sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    if ((server_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
         perror("socket");
         return ERR_RDSH_COMMUNICATION;
     }
@@ -191,7 +192,9 @@ int process_cli_requests(int svr_socket) {
     while (1) {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
-        int client_sock = accept(svr_socket, (struct sockaddr *)&client_addr, &client_len);
+        // close-on-exec, the commands only get it as their stdout and stderr
+        int client_sock = accept4(svr_socket, (struct sockaddr *)&client_addr,
+                                  &client_len, SOCK_CLOEXEC);
         
         if (client_sock < 0) {
             perror("accept");
@@ -211,6 +214,44 @@ int process_cli_requests(int svr_socket) {
     return OK;
 }
 
+/*
+ * recv_cmd(cli_socket, buff, size)
+ *      cli_socket:  The server-side socket that is connected to the client
+ *      buff, size:  The buffer the command is read into and its size, both
+ *                   grown as needed, like getline() does
+ *
+ *  The client sends each command with its terminating '\0' and waits for
+ *  the EOF character before sending the next, so a command is read once
+ *  the '\0' has arrived, however many recv() calls that takes.
+ *
+ *  Returns:
+ *
+ *      The length of the command, or -1 if the client disconnected or
+ *      the buffer could not be grown.
+ */
+static ssize_t recv_cmd(int cli_socket, char **buff, size_t *size) {
+    size_t len = 0;
+
+    while (len == 0 || (*buff)[len - 1] != '\0') {
+        if (len == *size) {
+            size_t new_size = *size ? *size * 2 : SH_CMD_MAX;
+            char *p = realloc(*buff, new_size);
+            if (p == NULL) {
+                perror("realloc");
+                return -1;
+            }
+            *buff = p;
+            *size = new_size;
+        }
+        ssize_t n = recv(cli_socket, *buff + len, *size - len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        len += n;
+    }
+    return len - 1;
+}
+
 /*
  * exec_client_requests(cli_socket)
  *      cli_socket:  The server-side socket that is connected to the client
@@ -253,19 +294,30 @@ int process_cli_requests(int svr_socket) {
  *                or receive errors. 
  */
 int exec_client_requests(int cli_socket) {
-    char buffer[SH_CMD_MAX];
+    char *buffer = NULL;    // grown by recv_cmd() to the longest command
+    size_t buffer_size = 0;
+    command_list_t cmd_list;
+    // The commands get no input from the server, the client has none to send
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    if (null_fd < 0) {
+        perror("/dev/null");
+        return ERR_RDSH_COMMUNICATION;
+    }
+    init_cmd_list(&cmd_list);
     while (1) {
-        ssize_t bytes_received = recv(cli_socket, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received <= 0) {
+        if (recv_cmd(cli_socket, &buffer, &buffer_size) < 0) {
             printf("Client disconnected.\n");
             break;
         }
 
-        buffer[bytes_received] = '\0';  // Null-terminate the command
         printf("Executing command: %s\n", buffer);  // Debugging output
 
         // Handle built-in commands
         if (strcmp(buffer, "stop-server") == 0) {
+            close_cmd_list(&cmd_list);
+            free(buffer);
+            close(null_fd);
             close(cli_socket);
             return OK_EXIT;
         } else if (strncmp(buffer, "cd ", 3) == 0) {
@@ -278,47 +330,28 @@ int exec_client_requests(int cli_socket) {
             continue;
         }
 
-        command_list_t cmd_list;
         int build_result = build_cmd_list(buffer, &cmd_list);
         if (build_result != OK) {
             send_message_string(cli_socket, "Invalid command.");
             continue;
         }
-
-        // Fork to execute command
-        pid_t pid = fork();
-        if (pid == 0) {  // Child process
-                    // Redirect stdout and stderr to the client socket
-                    dup2(cli_socket, STDOUT_FILENO);
-                    dup2(cli_socket, STDERR_FILENO);
-
-                    // Close all file descriptors except the client socket
-                    for (int fd = 0; fd < getdtablesize(); fd++) {
-                        if (fd != cli_socket) {
-                            close(fd);
-                        }
-                    }
-
-                    // Execute the command pipeline
-                    execute_pipeline(&cmd_list);
-
-                    // Flush stdout and stderr to ensure all output is sent to the client
-                    fflush(stdout);
-                    fflush(stderr);
-
-                    exit(0);  // Exit child process after execution
-                } 
-        else if (pid > 0) {  // Parent process
-            waitpid(pid, NULL, 0);
-        } 
-        else {  // Fork failed
-            perror("fork");
-            send_message_string(cli_socket, "Failed to execute command.");
+        // The server has no job table, a pipeline is always waited for
+        if (cmd_list.background) {
+            free_cmd_list(&cmd_list);
+            send_message_string(cli_socket, CMD_ERR_RDSH_BG);
+            continue;
         }
 
+        // Run the pipeline from here, its commands write straight to the
+        // client, so the server is never copied by a fork() of its own
+        execute_pipeline_io(&cmd_list, null_fd, cli_socket, cli_socket);
+
         free_cmd_list(&cmd_list);
         send_message_eof(cli_socket);  // Signal end of response
     }
+    close_cmd_list(&cmd_list);
+    free(buffer);
+    close(null_fd);
     return OK;
 }
 
@@ -417,7 +450,7 @@ int rsh_execute_pipeline(int cli_sock, command_list_t *clist) {
     int num_cmds = clist->num;
     int num_pipes = num_cmds - 1;
     int pipefd[2 * num_pipes];
-    pid_t pids[CMD_MAX];
+    pid_t pids[num_cmds];
 
     // Create the required pipes using a temporary file descriptor array.
     for (int i = 0; i < num_pipes; i++) {
@@ -40,6 +40,7 @@ static const char RDSH_EOF_CHAR = 0x04;
 #define CMD_ERR_RDSH_COMM   "rdsh-error: communications error\n"
 #define CMD_ERR_RDSH_EXEC   "rdsh-error: command execution error\n"
 #define CMD_ERR_RDSH_ITRNL  "rdsh-error: internal server error - %d\n"
+#define CMD_ERR_RDSH_BG     "rdsh-error: background jobs (&) are not supported by the server\n"
 #define CMD_ERR_RDSH_SEND   "rdsh-error: partial send.  Sent %d, expected to send %d\n"
 #define RCMD_SERVER_EXITED  "server appeared to terminate - exiting\n"
 
@@ -69,3 +69,174 @@ EOF
     [ "$status" -eq 0 ]
     [[ "$actual_output" == "$expected_output" ]]
 }
+
+# Test the in-process text builtins against the real tools.
+@test "wc -w builtin counts words" {
+  # with no PATH only the builtin can answer, the real wc is not found
+  run env PATH= ./dsh <<EOF
+/bin/echo "  one two   three" four | wc -w
+exit
+EOF
+  actual="$(echo "$output" | head -n 1 | tr -d '[:space:]')"
+  [ "$status" -eq 0 ]
+  [ "$actual" = "4" ]
+}
+
+@test "rev builtin reverses each line" {
+  run ./dsh <<EOF
+printf "abc\nh\303\251llo\n" | rev
+exit
+EOF
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "cba" ]
+  [ "${lines[1]}" = "$(printf 'oll\303\251h')" ]
+}
+
+@test "words builtin lists words with lengths" {
+  run ./dsh <<EOF
+echo "a  bb ccc" | words
+exit
+EOF
+  [ "$status" -eq 0 ]
+  [ "${lines[2]}" = "1. a(1)" ]
+  [ "${lines[4]}" = "3. ccc(3)" ]
+  [[ "$output" == *"Number of words returned: 3"* ]]
+}
+
+@test "wc with other options still runs the real wc" {
+  run ./dsh <<EOF
+printf "a\nb\n" | wc -l
+exit
+EOF
+  actual="$(echo "$output" | head -n 1 | tr -d '[:space:]')"
+  [ "$status" -eq 0 ]
+  [ "$actual" = "2" ]
+}
+
+@test "hash remembers where commands were found" {
+  run ./dsh <<EOF
+hash
+ls
+ls
+hash
+hash -r
+hash
+exit
+EOF
+  [ "$status" -eq 0 ]
+  [[ "$output" == *"hash: hash table empty"*"hits"*"2"*"/ls"*"hash: hash table empty"* ]]
+}
+
+@test "pipe inside quotes is part of the argument" {
+  run ./dsh <<EOF
+echo "a | b" | cat
+exit
+EOF
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" = "a | b" ]
+}
+
+@test "redirections to and from files" {
+  tmp="$(mktemp -d)"
+  run ./dsh <<EOF
+echo one > $tmp/out
+echo two>>$tmp/out
+cat < $tmp/out | wc -l
+exit
+EOF
+  [ "$status" -eq 0 ]
+  [ "$(echo "${lines[0]}" | tr -d '[:space:]')" = "2" ]
+  [ "$(cat "$tmp/out")" = "$(printf 'one\ntwo')" ]
+  rm -rf "$tmp"
+}
+
+@test "no limit on pipeline stages, arguments or line length" {
+  args="$(seq 1 300 | tr '\n' ' ')"
+  cats="$(printf ' | cat%.0s' $(seq 1 20))"
+  long="$(head -c 5000 /dev/zero | tr '\0' x)"
+  run ./dsh <<EOF
+echo $args | wc -w
+echo start$cats
+echo $long | wc -c
+exit
+EOF
+  [ "$status" -eq 0 ]
+  [ "$(echo "${lines[0]}" | tr -d '[:space:]')" = "300" ]
+  [ "${lines[1]}" = "start" ]
+  [ "$(echo "${lines[2]}" | tr -d '[:space:]')" = "5001" ]
+}
+
+@test "background jobs run concurrently and are listed" {
+  start=$(date +%s%N)
+  run ./dsh <<EOF
+sleep 1 &
+sleep 1 | cat &
+jobs
+wait
+exit
+EOF
+  elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+  [ "$status" -eq 0 ]
+  [ "$elapsed" -lt 1800 ]
+  [[ "$output" == *"[1] "*"[2] "* ]]
+  [[ "$output" == *"Running"*"sleep 1 &"*"Running"*"sleep 1 | cat &"* ]]
+  [[ "$output" == *"[1]   Done"*"sleep 1"*"[2]+  Done"*"sleep 1 | cat"* ]]
+}
+
+@test "fg waits for the current job" {
+  run ./dsh <<EOF
+sleep 0.2 &
+fg
+jobs
+exit
+EOF
+  [ "$status" -eq 0 ]
+  [[ "$output" == *"sleep 0.2"* ]]
+  [[ "$output" != *"Done"* ]]
+}
+
+@test "ampersand only ends a line" {
+  run ./dsh <<EOF
+echo a & echo b
+echo "a & b"
+exit
+EOF
+  [ "$status" -eq 0 ]
+  [[ "$output" == *"Syntax error near '&'"* ]]
+  echo "$output" | grep -qx "a & b"
+}
+
+@test "server mode rejects background jobs" {
+  port=$((20000 + RANDOM % 10000))
+  ./dsh -s -p $port >/dev/null 2>&1 &
+  server=$!
+  sleep 0.3
+  run ./dsh -c -p $port <<EOF
+sleep 2 &
+exit
+EOF
+  ./dsh -c -p $port <<< "stop-server" >/dev/null
+  wait $server
+  [ "$status" -eq 0 ]
+  [[ "$output" == *"rdsh-error: background jobs (&) are not supported by the server"* ]]
+}
+
+@test "server pipelines write output and errors to the client" {
+  port=$((20000 + RANDOM % 10000))
+  ./dsh -s -p $port >/dev/null 2>&1 &
+  server=$!
+  sleep 0.3
+  run ./dsh -c -p $port <<EOF
+printf "a\nb\n" | wc -l
+nosuchcmd
+ls /proc/self/fd | wc -l
+exit
+EOF
+  ./dsh -c -p $port <<< "stop-server" >/dev/null
+  wait $server
+  [ "$status" -eq 0 ]
+  [[ "$output" == *"dsh4> 2"* ]]
+  [[ "$output" == *"execvp: No such file or directory"* ]]
+  # stdin, the client socket as stdout and stderr, and ls's own directory
+  [[ "$output" == *"dsh4> 4"* ]]
+}